@@ -4,14 +4,34 @@ cd shaders
 
 /home/matty/vulkan-sdk/default/x86_64/bin/glslc shader.vert -o vert.spv
 /home/matty/vulkan-sdk/default/x86_64/bin/glslc shader.frag -o frag.spv
+/home/matty/vulkan-sdk/default/x86_64/bin/glslc cull.comp -o cull.spv
+/home/matty/vulkan-sdk/default/x86_64/bin/glslc cluster.comp -o cluster.spv
+/home/matty/vulkan-sdk/default/x86_64/bin/glslc hiz.comp -o hiz.spv
+/home/matty/vulkan-sdk/default/x86_64/bin/glslc occlusion.comp -o occlusion.spv
 
 cd ..
 
 VERT_BINARY_FILE="shaders/vert.spv"
 FRAG_BINARY_FILE="shaders/frag.spv"
+CULL_BINARY_FILE="shaders/cull.spv"
+CLUSTER_BINARY_FILE="shaders/cluster.spv"
+HIZ_BINARY_FILE="shaders/hiz.spv"
+OCCLUSION_BINARY_FILE="shaders/occlusion.spv"
 VERT_CPP_HEADER="include/vert-shader.h"
 FRAG_CPP_HEADER="include/frag-shader.h"
+CULL_CPP_HEADER="include/cull-shader.h"
+CLUSTER_CPP_HEADER="include/cluster-shader.h"
+HIZ_CPP_HEADER="include/hiz-shader.h"
+OCCLUSION_CPP_HEADER="include/occlusion-shader.h"
 
 # Convert the binary file to a C-style byte array and save it to the header file
 xxd -i "$VERT_BINARY_FILE" >"$VERT_CPP_HEADER"
 xxd -i "$FRAG_BINARY_FILE" >"$FRAG_CPP_HEADER"
+xxd -i "$CULL_BINARY_FILE" >"$CULL_CPP_HEADER"
+xxd -i "$CLUSTER_BINARY_FILE" >"$CLUSTER_CPP_HEADER"
+xxd -i "$HIZ_BINARY_FILE" >"$HIZ_CPP_HEADER"
+xxd -i "$OCCLUSION_BINARY_FILE" >"$OCCLUSION_CPP_HEADER"
+
+# SPIR-V is consumed as 32-bit words straight out of the array
+sed -i 's/^unsigned char/alignas(4) unsigned char/' "$VERT_CPP_HEADER" "$FRAG_CPP_HEADER" \
+  "$CULL_CPP_HEADER" "$CLUSTER_CPP_HEADER" "$HIZ_CPP_HEADER" "$OCCLUSION_CPP_HEADER"
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <map>
+#include <mutex>
+#include <vector>
+
+constexpr vk::DeviceSize ALLOCATOR_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// buffers and images are never placed in the same block, which keeps
+// bufferImageGranularity out of the picture
+enum class AllocationCategory : uint32_t {
+  Staging,
+  Buffer,
+  Texture,
+  Attachment,
+  Count
+};
+
+constexpr uint32_t ALLOCATION_CATEGORY_COUNT =
+    static_cast<uint32_t>(AllocationCategory::Count);
+
+struct BulkinAllocation {
+  vk::DeviceMemory memory;
+  vk::DeviceSize offset = 0;
+  vk::DeviceSize size = 0;
+  // points at offset inside the block when the memory is host visible
+  void *mapped = nullptr;
+  uint32_t pool = 0;
+  uint32_t block = 0;
+};
+
+struct AllocatorStatistics {
+  vk::DeviceSize blockBytes = 0;
+  vk::DeviceSize liveBytes = 0;
+  uint32_t blockCount = 0;
+  uint32_t allocationCount = 0;
+  // 1 - largest free range / total free bytes, 0 when the free space is one
+  // contiguous range
+  double fragmentation = 0.0;
+};
+
+// carves buffers and images out of large per memory type blocks instead of
+// one vkAllocateMemory per resource. staging memory is handed out linearly
+// and rewound once every allocation in a block is gone, everything else
+// comes from a first-fit free list that coalesces on free
+class BulkinAllocator {
+public:
+  void create(vk::Device &device, vk::PhysicalDevice &physicalDevice,
+              vk::DeviceSize blockSize = ALLOCATOR_BLOCK_SIZE);
+  BulkinAllocation allocate(const vk::MemoryRequirements &requirements,
+                            vk::MemoryPropertyFlags properties,
+                            AllocationCategory category);
+  void free(BulkinAllocation &allocation);
+  bool supports(vk::MemoryPropertyFlags properties) const;
+  AllocatorStatistics getStatistics(AllocationCategory category);
+  void cleanup();
+  static const char *categoryName(AllocationCategory category);
+
+private:
+  struct Block {
+    vk::DeviceMemory memory;
+    vk::DeviceSize size = 0;
+    char *mapped = nullptr;
+    // offset -> size of every free range, unused by linear pools
+    std::map<vk::DeviceSize, vk::DeviceSize> freeRanges;
+    vk::DeviceSize head = 0;
+    vk::DeviceSize liveBytes = 0;
+    uint32_t liveAllocations = 0;
+    // holds a single allocation bigger than a block and is released with it
+    bool dedicated = false;
+  };
+
+  struct Pool {
+    AllocationCategory category;
+    uint32_t memoryType = 0;
+    bool linear = false;
+    std::vector<Block> blocks;
+  };
+
+  vk::Device device;
+  vk::PhysicalDeviceMemoryProperties memoryProperties;
+  vk::DeviceSize blockSize = ALLOCATOR_BLOCK_SIZE;
+  std::vector<Pool> pools;
+  std::array<uint32_t, ALLOCATION_CATEGORY_COUNT> allocationCounts{};
+  std::mutex mutex;
+
+  uint32_t findMemoryType(uint32_t typeFilter,
+                          vk::MemoryPropertyFlags properties);
+  uint32_t findPool(AllocationCategory category, uint32_t memoryType);
+  uint32_t createBlock(Pool &pool, vk::DeviceSize size, bool dedicated);
+  bool allocateFromBlock(Pool &pool, Block &block,
+                         const vk::MemoryRequirements &requirements,
+                         vk::DeviceSize &offset);
+  void releaseBlock(Block &block);
+};
@@ -1,73 +1,180 @@
 #pragma once
 
+#include "allocator.h"
 #include "camera.h"
+#include "constants.h"
 #include "light.h"
+#include "lightmap.h"
 #include "model.h"
 #include "quad.h"
+#include "uploader.h"
 #include <vulkan/vulkan.hpp>
 
+#include <array>
+#include <span>
+
+// what the cluster pass could not fit into a frame's light lists
+struct ClusterOverflow {
+  // clusters that dropped lights
+  uint32_t clusters = 0;
+  // the most lights any one cluster was reached by
+  uint32_t mostLights = 0;
+};
+
+struct MeshRange {
+  uint32_t firstIndex = 0;
+  uint32_t indexCount = 0;
+  int32_t vertexOffset = 0;
+};
+
 class BulkinBuffer {
 public:
   vk::Buffer quadVertexBuffer;
   vk::Buffer quadIndexBuffer;
-  std::vector<vk::Buffer> modelVertexBuffers;
-  std::vector<vk::Buffer> modelIndexBuffers;
+  vk::Buffer modelVertexBuffer;
+  vk::Buffer modelIndexBuffer;
+  vk::Buffer modelDrawCommandBuffer;
+  std::vector<MeshRange> modelRanges;
+  uint32_t modelDrawCount = 0;
   std::vector<vk::Buffer> uniformBuffers;
-  vk::Buffer ssboBuffer;
+  // one copy of the quad and model instances per frame in flight, so a frame
+  // can be updated while the previous one is still being drawn
+  std::vector<vk::Buffer> ssboBuffers;
+  std::vector<vk::Buffer> modelInstanceBuffers;
   vk::Buffer pointLightBuffer;
+  std::vector<vk::Buffer> visibleBuffers;
+  std::vector<vk::Buffer> cullSlotBuffers;
+  std::vector<vk::Buffer> drawCommandBuffers;
+  std::vector<vk::Buffer> clusterLightBuffers;
+  std::vector<vk::Buffer> clusterOverflowBuffers;
+  // per frame the pvs region of every quad, and a bit per region that the
+  // culling pass tests before the frustum
+  std::vector<vk::Buffer> quadRegionBuffers;
+  std::vector<vk::Buffer> visibleRegionBuffers;
+  // occlusion culling of models: a local bounding sphere per model, and per
+  // frame the early and late draw counts, the draws that passed each phase and
+  // which models the first phase left for the second
+  vk::Buffer modelBoundsBuffer;
+  std::vector<vk::Buffer> modelDrawCountBuffers;
+  std::vector<vk::Buffer> earlyModelDrawBuffers;
+  std::vector<vk::Buffer> lateModelDrawBuffers;
+  std::vector<vk::Buffer> modelRetestBuffers;
+  // per frame the atlas rectangle of every quad's baked lighting, zero for
+  // quads that are lit at runtime
+  std::vector<vk::Buffer> lightmapRectBuffers;
+  // copied into every frame's uniforms, zero turns grid shadows off
+  float wallHeight = 0.0f;
 
-  static void createBuffer(vk::Device &device,
-                           vk::PhysicalDevice &physicalDevice, size_t size,
-                           vk::BufferUsageFlags usage,
-                           vk::MemoryPropertyFlags properties,
-                           vk::Buffer &buffer, vk::DeviceMemory &bufferMemory);
-  void createBuffers(vk::Device &device, vk::PhysicalDevice &physicalDevice,
-                     vk::CommandPool &commandPool, vk::Queue &graphicsQueue,
-                     BulkinQuad quad, std::vector<PointLight> &pointLights,
-                     std::vector<BulkinModel> &models);
+  static void
+  createBuffer(vk::Device &device, BulkinAllocator &allocator, size_t size,
+               vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties,
+               vk::Buffer &buffer, BulkinAllocation &bufferMemory,
+               AllocationCategory category = AllocationCategory::Buffer);
+  void createBuffers(vk::Device &device, BulkinAllocator &allocator,
+                     BulkinUploader &uploader, const BulkinQuad &quad,
+                     std::span<const uint32_t> textureSlots,
+                     std::span<const PointLight> pointLights,
+                     std::span<const BulkinModel> models,
+                     const BulkinLightmap &lightmap);
   void updateUniformBuffer(uint32_t currentImage, float width, float height,
-                           BulkinCamera &camera);
-  void cleanup(vk::Device &device);
-  static uint32_t findMemoryType(uint32_t typeFilter,
-                                 vk::MemoryPropertyFlags properties,
-                                 vk::PhysicalDevice device);
+                           const glm::mat4 &view, const glm::vec3 &viewPos);
+  // a moved quad loses its baked lighting, which no longer matches where it is
+  void updateQuad(uint32_t quad, const PerInstanceData &instance,
+                  uint32_t region, bool moved);
+  void updateModel(uint32_t model, const glm::mat4 &matrix,
+                   uint32_t textureId);
+  void flushInstanceUpdates(uint32_t currentFrame);
+  // mapped bits of the regions visible this frame, only written once the
+  // frame's fence has signalled
+  std::span<uint32_t> visibleRegions(uint32_t currentFrame);
+  // reads and clears the frame's overflow, once the frame's fence has
+  // signalled
+  ClusterOverflow takeClusterOverflow(uint32_t currentFrame);
+  void cleanup(vk::Device &device, BulkinAllocator &allocator);
   static vk::CommandBuffer
   beginSingleTimeCommands(vk::Device device, vk::CommandPool &commandPool);
   static void endSingleTimeCommands(vk::CommandBuffer commandBuffer,
                                     vk::Device device, vk::Queue graphicsQueue,
                                     vk::CommandPool commandPool);
-  static void copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer,
-                         vk::DeviceSize size, vk::CommandPool &commandPool,
-                         vk::Device &device, vk::Queue &queue);
 
 private:
-  vk::DeviceMemory vertexBufferMemory;
-  vk::DeviceMemory indexBufferMemory;
-  std::vector<vk::DeviceMemory> modelVertexBuffersMemory;
-  std::vector<vk::DeviceMemory> modelIndexBuffersMemory;
-  std::vector<vk::DeviceMemory> uniformBuffersMemory;
-  std::vector<void *> uniformBuffersMapped;
-  vk::DeviceMemory ssboBufferMemory;
-  vk::DeviceMemory pointLightBufferMemory;
+  BulkinAllocation vertexBufferMemory;
+  BulkinAllocation indexBufferMemory;
+  BulkinAllocation modelVertexBufferMemory;
+  BulkinAllocation modelIndexBufferMemory;
+  BulkinAllocation modelDrawCommandBufferMemory;
+  std::vector<BulkinAllocation> uniformBuffersMemory;
+  std::vector<BulkinAllocation> ssboBuffersMemory;
+  std::vector<BulkinAllocation> modelInstanceBuffersMemory;
+
+  // what every frame's instance buffers converge to, with texture ids already
+  // turned into slots
+  std::vector<PerInstanceData> quadInstances;
+  std::vector<uint32_t> quadRegions;
+  std::vector<glm::vec4> lightmapRects;
+  uint32_t firstBakedLight = 0;
+  uint32_t bakedLightCount = 0;
+  std::vector<ModelInstanceData> modelInstances;
+  std::vector<uint32_t> textureSlots;
+
+  // half-open instance ranges still to be copied into each frame's buffers
+  struct DirtyRange {
+    uint32_t begin;
+    uint32_t end;
+  };
+  std::array<std::vector<DirtyRange>, MAX_FRAMES_IN_FLIGHT> dirtyQuads;
+  std::array<std::vector<DirtyRange>, MAX_FRAMES_IN_FLIGHT> dirtyModels;
+  BulkinAllocation pointLightBufferMemory;
+  std::vector<BulkinAllocation> visibleBuffersMemory;
+  std::vector<BulkinAllocation> cullSlotBuffersMemory;
+  std::vector<BulkinAllocation> drawCommandBuffersMemory;
+  std::vector<BulkinAllocation> clusterLightBuffersMemory;
+  std::vector<BulkinAllocation> clusterOverflowBuffersMemory;
+  std::vector<BulkinAllocation> quadRegionBuffersMemory;
+  std::vector<BulkinAllocation> visibleRegionBuffersMemory;
+  uint32_t visibleRegionWords = 0;
+  BulkinAllocation modelBoundsBufferMemory;
+  std::vector<BulkinAllocation> modelDrawCountBuffersMemory;
+  std::vector<BulkinAllocation> earlyModelDrawBuffersMemory;
+  std::vector<BulkinAllocation> lateModelDrawBuffersMemory;
+  std::vector<BulkinAllocation> modelRetestBuffersMemory;
+  std::vector<BulkinAllocation> lightmapRectBuffersMemory;
 
-  void createVertexBuffer(vk::Device &device,
-                          vk::PhysicalDevice &physicalDevice,
-                          vk::CommandPool &commandPool,
-                          vk::Queue &graphicsQueue, vk::DeviceSize size,
-                          std::vector<Vertex> vertices, vk::Buffer &buffer,
-                          vk::DeviceMemory &bufferMemory);
-  void createIndexBuffer(vk::Device &device, vk::PhysicalDevice &physicalDevice,
-                         vk::CommandPool &commandPool, vk::Queue &graphicsQueue,
-                         vk::DeviceSize size, std::vector<uint32_t> indices,
-                         vk::Buffer &buffer, vk::DeviceMemory &bufferMemory);
-  void createSSBOBuffer(vk::Device &device, vk::PhysicalDevice &physicalDevice,
-                        vk::CommandPool &commandPool, vk::Queue &graphicsQueue,
-                        BulkinQuad quad, std::vector<BulkinModel> &models);
-  void createUniformBuffers(vk::Device &device,
-                            vk::PhysicalDevice &physicalDevice);
-  void createPointLightBuffer(vk::Device &device,
-                              vk::PhysicalDevice &physicalDevice,
-                              vk::CommandPool &commandPool,
-                              vk::Queue &graphicsQueue,
-                              std::vector<PointLight> &pointLights);
+  void createSSBOBuffer(vk::Device &device, BulkinAllocator &allocator,
+                        const BulkinQuad &quad,
+                        std::span<const uint32_t> textureSlots,
+                        std::span<const BulkinModel> models);
+  void createInstanceBuffers(vk::Device &device, BulkinAllocator &allocator,
+                             vk::DeviceSize size, const void *contents,
+                             std::vector<vk::Buffer> &buffers,
+                             std::vector<BulkinAllocation> &buffersMemory);
+  PerInstanceData remapQuad(PerInstanceData instance);
+  ModelInstanceData modelInstance(const glm::mat4 &matrix,
+                                  uint32_t textureId);
+  static void markDirty(std::vector<DirtyRange> &ranges, uint32_t index);
+  static void copyDirty(const std::vector<DirtyRange> &ranges,
+                        const void *source, void *destination, size_t stride);
+  void createUniformBuffers(vk::Device &device, BulkinAllocator &allocator);
+  void createPointLightBuffer(vk::Device &device, BulkinAllocator &allocator,
+                              BulkinUploader &uploader,
+                              std::span<const PointLight> pointLights);
+  void createModelBuffers(vk::Device &device, BulkinAllocator &allocator,
+                          BulkinUploader &uploader,
+                          std::span<const BulkinModel> models);
+  void createOcclusionBuffers(vk::Device &device, BulkinAllocator &allocator,
+                              BulkinUploader &uploader,
+                              std::span<const BulkinModel> models);
+  void createClusterBuffers(vk::Device &device, BulkinAllocator &allocator);
+  void createLightmapBuffers(vk::Device &device, BulkinAllocator &allocator,
+                             const BulkinQuad &quad,
+                             const BulkinLightmap &lightmap);
+  void createCullingBuffers(vk::Device &device, BulkinAllocator &allocator,
+                            BulkinUploader &uploader, const BulkinQuad &quad);
+  void createDeviceLocalBuffer(vk::Device &device, BulkinAllocator &allocator,
+                               BulkinUploader &uploader, vk::DeviceSize size,
+                               const void *contents, vk::BufferUsageFlags usage,
+                               vk::Buffer &buffer,
+                               BulkinAllocation &bufferMemory);
+  static void extractFrustumPlanes(const glm::mat4 &viewProj,
+                                   glm::vec4 (&planes)[6]);
 };
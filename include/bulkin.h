@@ -6,6 +6,9 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include <array>
+#include <atomic>
+#include <exception>
 #include <memory>
 #include <unordered_map>
 #include <vulkan/vulkan.hpp>
@@ -13,23 +16,51 @@
 #include "camera.h"
 #include "constants.h"
 #include "device.h"
+#include "frame-snapshot.h"
 #include "light.h"
 #include "model.h"
 #include "quad.h"
+#include "raycaster.h"
+#include "triple-buffer.h"
+
+struct BenchmarkResult {
+  uint32_t frames = 0;
+  double minMilliseconds = 0.0;
+  double avgMilliseconds = 0.0;
+  double p99Milliseconds = 0.0;
+  double maxMilliseconds = 0.0;
+};
 
 class Bulkin {
 public:
   void run();
-  void addQuad(glm::vec3 position, float angle, glm::vec3 rotation, float scale,
-               int shadingId, uint32_t textureId);
-  void addPointLight(PointLight &light);
+  BenchmarkResult runBenchmark(uint32_t frameCount, uint32_t width = WIDTH,
+                               uint32_t height = HEIGHT);
+  uint32_t addQuad(glm::vec3 position, int faceId, uint32_t textureId,
+                   glm::vec2 size = glm::vec2(1.0f),
+                   uint32_t region = PVS_NO_REGION);
+  // returns the light's index among the scene's point lights
+  uint32_t addPointLight(PointLight &light);
   void setPlayerPos(glm::vec2 pos);
   uint32_t addTexture(std::string filename);
-  void addModel(std::string modelPath, glm::vec3 pos, float angle,
-                glm::vec3 rotation, float scale);
+  uint32_t addModel(std::string modelPath, glm::vec3 pos, float angle,
+                    glm::vec3 rotation, float scale);
+  // the handles returned by addQuad and addModel stay valid while running,
+  // changes reach the GPU with the next frame
+  void moveQuad(uint32_t quad, glm::vec3 position);
+  void setQuadTexture(uint32_t quad, uint32_t textureId);
+  void moveModel(uint32_t model, glm::vec3 pos, float angle,
+                 glm::vec3 rotation, float scale);
+  void setModelTexture(uint32_t model, uint32_t textureId);
+  // the pvs rows are only read with raycastVisibility off, so they are not
+  // baked unless asked for. with lightmap the level's own lights are baked
+  // into its quads at load and any other light is added per fragment on top.
+  // the bake never changes, so a moved level quad drops it and is lit by the
+  // light loop alone, the level's lights included, from then on
   void loadLevel(const std::string &path, uint32_t wallTexture,
                  uint32_t floorTexture, uint32_t ceilingTexture,
-                 size_t maxHeight = 2);
+                 size_t maxHeight = 2, bool greedyMeshing = true,
+                 bool pvs = false, bool lightmap = true);
 
   static vk::ImageView createImageView(vk::Device &device, vk::Image image,
                                        vk::Format format,
@@ -38,32 +69,77 @@ public:
   static void createImage(uint32_t width, uint32_t height, vk::Format format,
                           vk::ImageTiling tiling, vk::ImageUsageFlags usage,
                           vk::MemoryPropertyFlags properties,
-                          vk::Device &device,
-                          vk::PhysicalDevice &physicalDevice, vk::Image &image,
-                          vk::DeviceMemory &imageMemory, uint32_t mipLevels);
+                          vk::Device &device, BulkinAllocator &allocator,
+                          vk::Image &image, BulkinAllocation &imageMemory,
+                          uint32_t mipLevels,
+                          AllocationCategory category =
+                              AllocationCategory::Texture);
   static void transitionImageLayout(vk::Device device,
                                     vk::CommandPool commandPool,
                                     vk::Queue graphicsQueue, vk::Format format,
                                     vk::ImageLayout oldLayout,
                                     vk::ImageLayout newLayout, vk::Image &image,
                                     uint32_t mipLevels);
+  static void transitionImageLayout(vk::CommandBuffer commandBuffer,
+                                    vk::Format format,
+                                    vk::ImageLayout oldLayout,
+                                    vk::ImageLayout newLayout, vk::Image &image,
+                                    uint32_t mipLevels,
+                                    uint32_t arrayLayer = 0);
   void addCube(size_t x, size_t z, size_t texture);
+  // can be switched while running, the change reaches the GPU with the next
+  // frame. it stays off on devices without graphics queue timestamps
+  void setGpuProfiling(bool enabled);
+  PassStatistics getPassStatistics(ProfilerPass pass);
+  AllocatorStatistics getMemoryStatistics(AllocationCategory category);
+  void writeProfileCsv(const std::string &path);
 
 private:
-  GLFWwindow *window;
+  GLFWwindow *window = nullptr;
+  bool headless = false;
+  vk::Extent2D offscreenExtent;
   vk::Instance instance;
   BulkinDevice device;
   std::vector<vk::Semaphore> presentCompleteSemaphores;
   std::vector<vk::Semaphore> renderFinishedSemaphores;
   std::vector<vk::Fence> drawFences;
   uint32_t currentFrame = 0;
-  bool framebufferResized = false;
+  std::atomic<bool> framebufferResized = false;
+  // set when the swapchain went out of date while the window was minimised
+  bool swapchainStale = false;
   bool fullsize = false;
   BulkinQuad quad;
   std::vector<BulkinModel> models;
+  // set once the instances live in GPU buffers and updates have to be
+  // streamed
+  bool sceneUploaded = false;
+
+  // the main thread publishes snapshots and the render thread draws the latest
+  // one. a snapshot can be skipped, so every update not yet known to have
+  // reached the renderer is resent with the next one
+  BulkinTripleBuffer<FrameSnapshot> snapshots;
+  std::vector<QuadUpdate> pendingQuadUpdates;
+  std::vector<ModelUpdate> pendingModelUpdates;
+  size_t publishedQuadUpdates = 0;
+  size_t publishedModelUpdates = 0;
+  std::atomic<bool> stopRendering = false;
+  std::atomic<bool> renderFailed = false;
+  std::atomic<uint32_t> renderedFrames = 0;
+  std::exception_ptr renderError;
+  // the pvs region each frame's visible region bits hold the baked row of,
+  // PVS_NO_REGION when they were filled some other way
+  std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> visibleRegionsFrom;
+  // casts rays through the level every frame instead of using the baked pvs,
+  // with it off and no pvs baked every region is drawn
+  bool raycastVisibility = true;
+  BulkinRaycaster raycaster;
 
   bool showFrametime = false;
   double currentTime = 0.0;
+  // the render thread switches its profiler when a snapshot carries a change
+  bool gpuProfiling = false;
+  // the most lights a cluster has wanted that was already reported
+  uint32_t reportedClusterLights = MAX_LIGHTS_PER_CLUSTER;
 
   std::unique_ptr<BulkinLevel> currentLevel;
   std::unordered_map<std::string, uint32_t> loadedTextures;
@@ -89,10 +165,21 @@ private:
   void initWindow();
   void initVulkan();
   void mainLoop();
+  void renderLoop();
   void cleanup();
   void createInstance();
   void drawFrame();
+  void drawOffscreenFrame();
+  vk::CommandBuffer frameCommandBuffer(uint32_t imageIndex);
+  void updateBenchmarkCamera(const std::vector<glm::vec2> &path,
+                             float eyeHeight, uint32_t frame,
+                             uint32_t frameCount);
   void update();
+  void publishSnapshot();
+  void consumeSnapshot();
+  void reportClusterOverflow();
+  void prepareFrame();
+  void updateVisibleRegions(const FrameSnapshot &snapshot);
   void createSyncObjects();
   void updatePushConstants();
   void recreateSwapchain();
@@ -104,7 +191,7 @@ private:
   static void framebufferResizeCallback(GLFWwindow *window, int width,
                                         int height);
 
-  bool tick(float deltaTime, bool frameRendered = true);
+  bool tick(float deltaTime, uint32_t framesRendered = 1);
 
   float avgInterval = 0.5f;
   uint32_t numFrames = 0;
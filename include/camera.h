@@ -17,6 +17,7 @@ public:
   glm::mat4 getView();
   glm::vec3 getPosition();
   void setPlayerPos(glm::vec2 pos);
+  void setPose(const glm::vec3 &pos, const glm::vec3 &target);
 
   struct Movement {
     bool forward = false;
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+class BulkinClusterPipeline {
+public:
+  void createDescriptorLayout(vk::Device &device);
+  void create(vk::Device &device, vk::PipelineCache pipelineCache);
+  void createDescriptorSets(vk::Device &device, BulkinBuffer &buffers);
+  void record(vk::CommandBuffer commandBuffer, uint32_t currentFrame);
+  void cleanup(vk::Device &device);
+
+private:
+  vk::PipelineLayout pipelineLayout;
+  vk::Pipeline pipeline;
+  vk::DescriptorSetLayout descriptorSetLayout;
+  vk::DescriptorPool descriptorPool;
+  std::vector<vk::DescriptorSet> descriptorSets;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "constants.h"
+#include "job-pool.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// records work items into secondary command buffers on the job pool. every
+// worker has its own command pool per frame in flight, and the recorded
+// buffers come back in work item order whichever worker took them. the work
+// is split into one contiguous slice per worker, so a frame's recording
+// allocates nothing once the buffers exist
+class BulkinCommandRecorder {
+public:
+  void create(vk::Device &device, uint32_t queueFamily, BulkinJobPool &jobs);
+  // resets the frame's pools, so the buffers recorded the last time this
+  // frame slot was used must no longer be pending
+  template <typename RecordWork>
+  std::span<const vk::CommandBuffer>
+  record(uint32_t currentFrame, uint32_t workCount,
+         const vk::CommandBufferInheritanceInfo &inheritance,
+         RecordWork &&recordWork) {
+    reset(currentFrame, workCount);
+    auto slices = std::min(workCount, workerCount());
+    jobs->run(slices, [&](uint32_t slice) {
+      try {
+        auto first = slice * workCount / slices;
+        auto last = (slice + 1) * workCount / slices;
+        for (auto i = first; i < last; i++) {
+          auto commandBuffer = begin(currentFrame, inheritance);
+          recordWork(commandBuffer, i);
+          commandBuffer.end();
+          recorded[i] = commandBuffer;
+        }
+      } catch (...) {
+        std::lock_guard lock(errorMutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    });
+
+    if (error)
+      std::rethrow_exception(error);
+    return recorded;
+  }
+  uint32_t workerCount() const;
+  void cleanup(vk::Device &device);
+
+private:
+  struct WorkerPool {
+    vk::CommandPool pool;
+    // allocated on first use and kept, a pool reset only rewinds them
+    std::vector<vk::CommandBuffer> buffers;
+    uint32_t used = 0;
+  };
+
+  vk::Device device;
+  BulkinJobPool *jobs = nullptr;
+  std::array<std::vector<WorkerPool>, MAX_FRAMES_IN_FLIGHT> pools;
+  std::vector<vk::CommandBuffer> recorded;
+  std::mutex errorMutex;
+  std::exception_ptr error;
+
+  void reset(uint32_t currentFrame, uint32_t workCount);
+  // takes the calling worker's next secondary buffer and begins it
+  vk::CommandBuffer begin(uint32_t currentFrame,
+                          const vk::CommandBufferInheritanceInfo &inheritance);
+};
@@ -5,3 +5,17 @@
 constexpr uint32_t WIDTH = 1920;
 constexpr uint32_t HEIGHT = 1080;
 constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+// the main thread polls input and moves the camera at least this often,
+// whatever rate the render thread manages
+constexpr double SIMULATION_RATE = 240.0;
+// vertical field of view in degrees
+constexpr float FIELD_OF_VIEW = 45.0f;
+
+// clustered lighting splits the view frustum into a screen-space grid with
+// exponentially spaced depth slices; the shaders hardcode the same values
+constexpr uint32_t CLUSTER_GRID_X = 16;
+constexpr uint32_t CLUSTER_GRID_Y = 9;
+constexpr uint32_t CLUSTER_GRID_Z = 24;
+constexpr uint32_t CLUSTER_COUNT =
+    CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 64;
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+class BulkinCullingPipeline {
+public:
+  void createDescriptorLayout(vk::Device &device);
+  void create(vk::Device &device, vk::PipelineCache pipelineCache);
+  void createDescriptorSets(vk::Device &device, BulkinBuffer &buffers);
+  void record(vk::CommandBuffer commandBuffer, BulkinBuffer &buffers,
+              uint32_t currentFrame, uint32_t instanceCount);
+  void cleanup(vk::Device &device);
+
+private:
+  vk::PipelineLayout pipelineLayout;
+  vk::Pipeline pipeline;
+  vk::DescriptorSetLayout descriptorSetLayout;
+  vk::DescriptorPool descriptorPool;
+  std::vector<vk::DescriptorSet> descriptorSets;
+};
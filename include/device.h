@@ -3,9 +3,20 @@
 #include <vulkan/vulkan.hpp>
 #include <GLFW/glfw3.h>
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <span>
+
+#include "allocator.h"
 #include "swapchain.h"
 #include "queue-family.h"
 #include "graphics-pipeline.h"
+#include "job-pool.h"
+#include "pipeline-cache.h"
+#include "texture-set.h"
+#include "uploader.h"
 
 class BulkinDevice {
 public:
@@ -14,17 +25,35 @@ public:
   vk::Queue graphicsQueue;
   vk::Queue presentQueue;
   vk::SurfaceKHR surface;
+  BulkinAllocator allocator;
   BulkinSwapchain swapchain;
   BulkinGraphicsPipeline graphicsPipeline;
+  BulkinPipelineCache pipelineCache;
+  BulkinUploader uploader;
+  BulkinJobPool jobs;
+  BulkinTextureSet textureSet;
+  bool headless = false;
+  // BC textures are cooked and sampled when the device supports them
+  bool textureCompression = false;
 
   void pickPhysicalDevice(vk::Instance& instance);
   void createLogicalDevice();
   void createSurface(vk::Instance& instance, GLFWwindow *window);
   void createSwapchain(GLFWwindow* window);
-  void createGraphicsPipeline(BulkinQuad quad, std::vector<BulkinTexture>& textures, std::vector<PointLight>& pointLights, std::vector<BulkinModel>& models);
+  void createOffscreenTargets(uint32_t width, uint32_t height);
+  void createGraphicsPipeline(const BulkinQuad& quad, std::span<BulkinTexture> textures, std::span<const PointLight> pointLights, std::span<const BulkinModel> models, const BulkinLightmap& lightmap, const WallGrid& walls);
   void cleanup(vk::Instance& instance);
   QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice& device);
 private:
   bool isDeviceSuitable(vk::PhysicalDevice& physicalDevice);
   bool checkDeviceExtensionSupport(vk::PhysicalDevice& physicalDevice);
+  std::vector<const char*> enabledExtensions();
+  void decodeTextures(std::span<BulkinTexture> textures);
+  void uploadTextures(std::span<BulkinTexture> textures);
+  
+  // indices of textures whose decode job has finished, in completion order
+  std::mutex decodedMutex;
+  std::condition_variable decodedReady;
+  std::deque<size_t> decodedTextures;
+  std::exception_ptr decodeError;
 };
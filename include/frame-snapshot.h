@@ -0,0 +1,33 @@
+#pragma once
+
+#include "vertex.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct QuadUpdate {
+  uint32_t quad;
+  PerInstanceData instance;
+  uint32_t region;
+  bool moved;
+};
+
+struct ModelUpdate {
+  uint32_t model;
+  glm::mat4 matrix;
+  uint32_t textureId;
+};
+
+// everything the render thread needs from the main thread for one frame
+struct FrameSnapshot {
+  glm::mat4 view{1.0f};
+  glm::vec3 viewPos{0.0f};
+  // 0 while the window is minimised
+  uint32_t framebufferWidth = 0;
+  uint32_t framebufferHeight = 0;
+  std::vector<QuadUpdate> quadUpdates;
+  std::vector<ModelUpdate> modelUpdates;
+  bool gpuProfiling = false;
+};
@@ -6,50 +6,129 @@
 #include "quad.h"
 #include "vertex.h"
 #include "texture.h"
+#include "texture-set.h"
 #include "light.h"
+#include "lightmap.h"
+#include "level.h"
 #include "model.h"
+#include "culling-pipeline.h"
+#include "cluster-pipeline.h"
+#include "occlusion-pipeline.h"
+#include "profiler.h"
+#include "command-recorder.h"
 
 #include <vulkan/vulkan.hpp>
+#include <span>
 #include <string>
 #include <vector>
 
+// a split is only worth a secondary command buffer of its own past this many
+// instances
+constexpr uint32_t MIN_INSTANCES_PER_DRAW_WORK = 4096;
+
+// one slice of the main pass, recorded on its own when recording is spread
+// over the job pool
+struct DrawWork {
+  DrawKind kind;
+  uint32_t first;
+  uint32_t count;
+  // the quads in a run of the culling pass' depth buckets, picked by first
+  // and count, or the models drawn by the occlusion pass' early or late
+  // count, which ignore first and count
+  bool culled;
+  bool late = false;
+};
+
 class BulkinGraphicsPipeline {
 public:
   BulkinBuffer buffers;
+  BulkinCullingPipeline culling;
+  BulkinClusterPipeline clusters;
+  BulkinOcclusionPipeline occlusion;
+  BulkinProfiler profiler;
+  BulkinCommandRecorder recorder;
   vk::CommandPool commandPool;
   std::vector<vk::CommandBuffer> commandBuffers;
+  bool gpuCulling = true;
+  // models rejected by last frame's depth pyramid are retested after the
+  // first half of the main pass and drawn in a second half
+  bool occlusionCulling = true;
+  // lays down depth with a vertex-only pass first, so the shaded pass runs the
+  // light loop once per pixel
+  bool depthPrepass = true;
+  // runtime lit fragments march every light's ray through the level's wall
+  // grid and drop its diffuse term when a wall is in the way
+  bool gridShadows = true;
+  // replays one recording per frame slot and swapchain image instead of
+  // recording every frame. a replay is always recorded inline, so it is off
+  // in favour of parallelRecording
+  bool cachedRecording = false;
+  bool gpuProfiling = false;
+  // records the main pass on the job pool every frame, only used when the
+  // recording is not cached
+  bool parallelRecording = true;
   
-  void create(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::Format& swapchainFormat);
-  void recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex, BulkinSwapchain& swapchain, uint32_t currentFrame, BulkinQuad quad, std::vector<BulkinModel>& models);
+  void create(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::Format& swapchainFormat, vk::PipelineCache pipelineCache);
+  void recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex, BulkinSwapchain& swapchain, uint32_t currentFrame, const BulkinQuad& quad);
   void createCommandPool(vk::Device& device, QueueFamilyIndices indices);
   void createCommandBuffers(vk::Device& device);
-  void createBuffers(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::Queue& graphicsQueue, BulkinQuad quad, std::vector<BulkinTexture>& textures, std::vector<PointLight>& pointLights, std::vector<BulkinModel>& models);
+  void createCachedCommandBuffers(vk::Device& device, uint32_t imageCount);
+  void invalidateCachedCommandBuffers(vk::Device& device, uint32_t imageCount);
+  void rerecordCachedCommandBuffers();
+  vk::CommandBuffer cachedCommandBuffer(uint32_t imageIndex, BulkinSwapchain& swapchain, uint32_t currentFrame, const BulkinQuad& quad);
+  void createBuffers(vk::Device& device, BulkinAllocator& allocator, BulkinUploader& uploader, const BulkinQuad& quad, std::span<BulkinTexture> textures, BulkinTextureSet& textureSet, std::span<const PointLight> pointLights, std::span<const BulkinModel> models, const BulkinLightmap& lightmap, const WallGrid& walls);
   void createDescriptorLayout(vk::Device& device, uint32_t textureCount);
   void createDescriptorPool(vk::Device& device, uint32_t textureCount);
-  void createDescriptorSets(vk::Device& device, BulkinQuad quad, std::vector<BulkinTexture>& textures, std::vector<PointLight>& pointLights);
+  void createDescriptorSets(vk::Device& device, std::span<BulkinTexture> textures, BulkinTextureSet& textureSet, std::span<const PointLight> pointLights);
   static bool hasStencilComponent(vk::Format format);
-  void createDepthResources(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::Queue graphicsQueue, uint32_t width, uint32_t height);
-  void cleanup(vk::Device& device);
+  void createDepthResources(vk::Device& device, vk::PhysicalDevice& physicalDevice, BulkinAllocator& allocator, vk::Queue graphicsQueue, uint32_t width, uint32_t height);
+  void cleanup(vk::Device& device, BulkinAllocator& allocator);
+  static vk::ShaderModule createShaderModule(const unsigned char* code, size_t codeSize, vk::Device &device);
 private:
   vk::PipelineLayout pipelineLayout;
   vk::Pipeline pipeline;
+  vk::Pipeline depthPipeline;
   vk::DescriptorSetLayout descriptorSetLayout;
   vk::DescriptorSetLayout ssboDescriptorSetLayout;
   vk::DescriptorPool descriptorPool;
   vk::DescriptorPool ssboDescriptorPool;
   std::vector<vk::DescriptorSet> descriptorSets;
   std::vector<vk::DescriptorSet> ssboDescriptorSets;
-  bool slang = false;
+  
+  std::vector<vk::CommandBuffer> cachedCommandBuffers;
+  std::vector<bool> cachedCommandBuffersRecorded;
+  uint32_t cachedImageCount = 0;
   
   vk::Image depthImage;
-  vk::DeviceMemory depthImageMemory;
+  BulkinAllocation depthImageMemory;
   vk::ImageView depthImageView;
+  vk::Format depthFormat = vk::Format::eUndefined;
+  
+  // a single black texel when nothing was baked
+  vk::Image lightmapImage;
+  BulkinAllocation lightmapImageMemory;
+  vk::ImageView lightmapImageView;
+  vk::Sampler lightmapSampler;
+  // one texel per level cell, non-zero for walls; a single open cell without a
+  // level
+  vk::Image wallGridImage;
+  BulkinAllocation wallGridImageMemory;
+  vk::ImageView wallGridImageView;
+  vk::Sampler wallGridSampler;
+  
+  std::vector<DrawWork> drawWork;
   
   vk::Format findSupportedFormat(const std::vector<vk::Format> &candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features, vk::PhysicalDevice& physicalDevice);
   vk::Format findDepthFormat(vk::PhysicalDevice& physicalDevice);
+  void createLightmapImage(vk::Device& device, BulkinAllocator& allocator, BulkinUploader& uploader, const BulkinLightmap& lightmap);
+  void createWallGridImage(vk::Device& device, BulkinAllocator& allocator, BulkinUploader& uploader, const WallGrid& walls);
+  static void uploadImage(BulkinUploader& uploader, vk::Image image, vk::Format format, uint32_t width, uint32_t height, const void* texels, vk::DeviceSize size);
+  void buildDrawWork(uint32_t quadCount, uint32_t workers);
+  void addDrawWork(DrawKind kind, uint32_t count, uint32_t workers);
+  void recordDrawWork(vk::CommandBuffer commandBuffer, vk::Extent2D extent, uint32_t currentFrame, const DrawWork& work, bool depthOnly);
+  void recordLateModels(vk::CommandBuffer commandBuffer, vk::Extent2D extent, uint32_t currentFrame, vk::RenderingInfo renderingInfo);
+  void transitionDepthImage(vk::CommandBuffer commandBuffer, bool sampled);
   
-  static std::vector<char> readFile(const std::string& filename);
-  vk::ShaderModule createShaderModule(const std::vector<char>& code, vk::Device &device);
   void transitionImageLayout(uint32_t imageIndex,
                              vk::CommandBuffer commandBuffer,
                              BulkinSwapchain& swapchain,
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// a fixed set of worker threads pulling jobs off a shared queue, jobs catch
+// their own exceptions
+class BulkinJobPool {
+public:
+  void create(uint32_t threadCount = std::thread::hardware_concurrency());
+  void submit(std::function<void()> job);
+  void wait();
+  // calls body(i) for every i in [0, count) on the workers and returns once
+  // all of them are done. the batch lives on the caller's stack, so nothing
+  // is allocated, and only this batch is waited for rather than the whole
+  // pool. body must not throw
+  template <typename Body> void run(uint32_t count, Body &&body) {
+    Batch batch;
+    batch.count = count;
+    batch.context =
+        const_cast<void *>(static_cast<const void *>(std::addressof(body)));
+    batch.invoke = [](void *context, uint32_t index) {
+      (*static_cast<std::remove_reference_t<Body> *>(context))(index);
+    };
+    run(batch);
+  }
+  void cleanup();
+  size_t threadCount() const { return workers.size(); }
+  // index of the worker running the calling job, in [0, threadCount)
+  static uint32_t workerIndex();
+
+private:
+  struct Batch {
+    void (*invoke)(void *context, uint32_t index) = nullptr;
+    void *context = nullptr;
+    uint32_t count = 0;
+    std::atomic<uint32_t> next = 0;
+    // the rest is guarded by the pool mutex
+    uint32_t finished = 0;
+    uint32_t workers = 0;
+    Batch *following = nullptr;
+  };
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> jobs;
+  // batches still handing out indices, linked through Batch::following
+  Batch *batches = nullptr;
+  std::mutex mutex;
+  std::condition_variable available;
+  std::condition_variable idle;
+  std::condition_variable batchDone;
+  uint32_t running = 0;
+  bool stopping = false;
+
+  void run(Batch &batch);
+  void unlink(Batch &batch);
+  void work(uint32_t index);
+};
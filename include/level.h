@@ -2,29 +2,65 @@
 
 class Bulkin;
 #include "light.h"
+#include "lightmap.h"
+#include "pvs.h"
 #include <glm/glm.hpp>
 
 #include <string>
 #include <vector>
 
 class Bulkin;
+class BulkinJobPool;
+
+// solid cells of a tile level, one byte per cell row by row, for marching
+// shadow rays through the walls in the fragment shader
+struct WallGrid {
+  uint32_t width = 0, depth = 0;
+  float height = 0.0f;
+  std::vector<uint8_t> cells;
+};
 
 class BulkinLevel {
 public:
   BulkinLevel(const std::string &path, uint32_t wallTexture,
               uint32_t floorTexture, uint32_t ceilingTexture,
-              size_t maxHeight = 2);
-  void loadLevel(Bulkin &app);
+              size_t maxHeight = 2, bool greedyMeshing = true,
+              bool pvs = false, bool lightmap = true);
+  // the pvs and lightmap bakes run on jobs
+  void loadLevel(Bulkin &app, BulkinJobPool &jobs);
+  std::vector<glm::vec2> cameraPath();
+  // regions of the open cells, with visibility between them only baked when
+  // the level was loaded with the pvs enabled
+  const BulkinPvs &getPvs() const { return visibility; }
+  // static lighting of the level's quads, empty when the level was loaded
+  // with lightmaps disabled
+  const BulkinLightmap &getLightmap() const { return baked; }
+  WallGrid wallGrid() const;
 
 private:
   std::vector<std::vector<uint32_t>> walls;
   std::vector<std::vector<uint32_t>> floors;
   std::vector<std::vector<uint32_t>> ceilings;
   std::vector<PointLight> pointLights;
+  std::string path;
   size_t depth = 0, width = 0;
   glm::vec2 playerPos;
   uint32_t wallTexture = 0;
   uint32_t floorTexture = 0;
   uint32_t ceilingTexture = 0;
   size_t maxHeight = 2;
+  bool greedyMeshing = true;
+  bool pvs = false;
+  BulkinPvs visibility;
+  bool lightmap = true;
+  BulkinLightmap baked;
+  std::vector<LightmapFace> faces;
+  uint32_t firstQuad = 0;
+  uint32_t firstLight = 0;
+
+  uint32_t regionAt(size_t x, size_t z) const;
+  void addQuad(Bulkin &app, glm::vec3 position, uint32_t face,
+               uint32_t texture, glm::vec2 size, uint32_t region);
+  void bakeLightmap(BulkinJobPool &jobs);
+  void addGreedyQuads(Bulkin &app);
 };
@@ -9,7 +9,10 @@ struct PointLight {
   alignas(16) glm::vec3 ambient{0.2f};
   alignas(16) glm::vec3 diffuse{0.5f};
   alignas(16) glm::vec3 specular{1.0f};
-  float constant = 1.0f;
+  alignas(16) float constant = 1.0f;
   float linear = 0.09f;
   float quadratic = 0.032f;
+  // distance at which the light's contribution is faded out to zero, used to
+  // bin it into the light clusters it can reach
+  float radius = 8.0f;
 };
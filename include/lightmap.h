@@ -0,0 +1,80 @@
+#pragma once
+
+#include "light.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class BulkinJobPool;
+
+// lightmap texels along one cell of a face, halved until the atlas fits
+constexpr uint32_t LIGHTMAP_TEXELS_PER_CELL = 8;
+constexpr uint32_t LIGHTMAP_MAX_SIZE = 4096;
+// shadow rays per texel and light, spread over a disc of this radius around
+// the light so shadow edges come out soft
+constexpr uint32_t LIGHTMAP_SHADOW_SAMPLES = 16;
+constexpr float LIGHTMAP_LIGHT_RADIUS = 0.2f;
+
+// a level quad as the vertex shader places it: the unit quad spans x in
+// [-0.5, 0.5] and y in [0, 1] along the face's axes before it is stretched
+// to size
+struct LightmapFace {
+  glm::vec3 position;
+  uint32_t face;
+  glm::vec2 size;
+};
+
+// static lighting of a tile level baked into one atlas: every face gets its
+// own rectangle, lit by every point light with shadows traced through the
+// wall grid. only the diffuse and ambient terms are baked, which is all the
+// shader's light loop adds up
+class BulkinLightmap {
+public:
+  // loads the atlas cached at path, or bakes it on jobs and writes it there
+  // when the file is missing or was baked from different faces, walls or
+  // lights
+  void build(const std::string &path,
+             const std::vector<std::vector<uint32_t>> &walls,
+             std::vector<LightmapFace> faces,
+             const std::vector<PointLight> &lights, uint32_t firstQuad,
+             uint32_t firstLight, BulkinJobPool &jobs);
+  bool empty() const { return faces.empty(); }
+  uint32_t getWidth() const { return width; }
+  uint32_t getHeight() const { return height; }
+  // quad handle of the first face, the faces follow it in order
+  uint32_t getFirstQuad() const { return firstQuad; }
+  // index of the first baked light among the scene's point lights, the rest
+  // follow it in order
+  uint32_t getFirstLight() const { return firstLight; }
+  uint32_t getLightCount() const { return empty() ? 0 : lightCount; }
+  // atlas offset and scale of each face's texels in normalised coordinates
+  const std::vector<glm::vec4> &getRects() const { return rects; }
+  // rgba16f texels, row by row
+  const std::vector<uint64_t> &getTexels() const { return texels; }
+
+private:
+  struct Placement {
+    uint32_t x, y, width, height;
+  };
+
+  std::vector<std::vector<uint32_t>> walls;
+  std::vector<LightmapFace> faces;
+  std::vector<PointLight> lights;
+  uint32_t firstQuad = 0;
+  uint32_t firstLight = 0, lightCount = 0;
+  uint32_t width = 0, height = 0;
+  std::vector<glm::vec4> rects;
+  std::vector<uint64_t> texels;
+
+  uint64_t key() const;
+  bool load(const std::string &path, uint64_t expected);
+  void save(const std::string &path, uint64_t key) const;
+  void bake(BulkinJobPool &jobs);
+  std::vector<Placement> pack(uint32_t texelsPerCell);
+  void bakeFace(size_t index, const Placement &placement);
+  glm::vec3 light(glm::vec3 position, glm::vec3 normal) const;
+  bool blocked(glm::vec2 from, glm::vec2 to) const;
+};
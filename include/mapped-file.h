@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// read-only view of a whole file through mmap, unmapped on destruction
+class BulkinMappedFile {
+public:
+  BulkinMappedFile() = default;
+  explicit BulkinMappedFile(const std::string &path);
+  BulkinMappedFile(const BulkinMappedFile &) = delete;
+  BulkinMappedFile &operator=(const BulkinMappedFile &) = delete;
+  BulkinMappedFile(BulkinMappedFile &&other) noexcept;
+  BulkinMappedFile &operator=(BulkinMappedFile &&other) noexcept;
+  ~BulkinMappedFile();
+
+  const std::byte *data() const { return mapped; }
+  size_t size() const { return length; }
+  bool isOpen() const { return mapped != nullptr; }
+
+private:
+  const std::byte *mapped = nullptr;
+  size_t length = 0;
+
+  void unmap();
+};
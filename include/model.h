@@ -1,23 +1,31 @@
 #pragma once
 
+#include "mapped-file.h"
 #include "vertex.h"
 
 #include <vulkan/vulkan.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <memory>
+#include <span>
+
 class BulkinModel {
 public:
   BulkinModel(std::string modelPath, glm::vec3 pos, float angle, glm::vec3 rotation, float scale) : modelPath(modelPath), pos(pos), angle(angle), rotation(rotation), scale(scale) {}
   void loadModel();
-  glm::mat4 modelMatrix();
-  std::vector<uint32_t> getIndices();
-  uint32_t getIndicesSize();
-  std::vector<Vertex> getVertices();
-  uint32_t getVerticesSize();
+  static void cook(const std::string& modelPath, const std::string& cookedPath);
+  glm::mat4 modelMatrix() const;
+  std::span<const uint32_t> getIndices() const { return indices; }
+  uint32_t getIndicesSize() const { return static_cast<uint32_t>(indices.size()); }
+  std::span<const Vertex> getVertices() const { return vertices; }
+  uint32_t getVerticesSize() const { return static_cast<uint32_t>(vertices.size()); }
+  glm::vec3 getBoundsMin() const { return boundsMin; }
+  glm::vec3 getBoundsMax() const { return boundsMax; }
   void setDiffuse(uint32_t diffuse) { textureId = diffuse; }
-  uint32_t getTextureId() { return textureId; }
-  std::string getDiffusePath() { return diffusePath; }
+  void setTransform(glm::vec3 pos, float angle, glm::vec3 rotation, float scale);
+  uint32_t getTextureId() const { return textureId; }
+  const std::string& getDiffusePath() const { return diffusePath; }
 
 private:
   std::string modelPath;
@@ -28,6 +36,13 @@ private:
   glm::vec3 rotation;
   float scale;
   
-  std::vector<Vertex> vertices;
-  std::vector<uint32_t> indices;
+  // vertices and indices point straight into the mapped cooked file, which is
+  // shared between copies of the model
+  std::shared_ptr<BulkinMappedFile> cooked;
+  std::span<const Vertex> vertices;
+  std::span<const uint32_t> indices;
+  glm::vec3 boundsMin{0.0f};
+  glm::vec3 boundsMax{0.0f};
+  
+  bool mapCooked(const std::string& cookedPath);
 };
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "allocator.h"
+#include "buffer.h"
+
+#include <vulkan/vulkan.hpp>
+#include <string>
+#include <vector>
+
+// the early phase draws what last frame's depth says is visible, the late
+// phase retests the rest against this frame's
+enum class OcclusionPhase : uint32_t { Early, Late };
+
+// two phase occlusion culling of models against a hierarchical depth pyramid:
+// each level keeps the farthest depth of the 2x2 texels below it, so a
+// model's screen rectangle is tested with four fetches from the level where
+// it covers about two texels
+class BulkinOcclusionPipeline {
+public:
+  void createDescriptorLayout(vk::Device &device);
+  void create(vk::Device &device, vk::PipelineCache pipelineCache);
+  void createDescriptorSets(vk::Device &device, BulkinBuffer &buffers);
+  // the pyramid follows the depth attachment's size, so a resize lands here
+  // again
+  void createPyramid(vk::Device &device, BulkinAllocator &allocator,
+                     vk::CommandPool commandPool, vk::Queue graphicsQueue,
+                     vk::ImageView depthImageView, uint32_t width,
+                     uint32_t height);
+  void recordTest(vk::CommandBuffer commandBuffer, BulkinBuffer &buffers,
+                  uint32_t currentFrame, OcclusionPhase phase);
+  // the depth attachment has to be in depth read only layout
+  void recordPyramid(vk::CommandBuffer commandBuffer);
+  void cleanup(vk::Device &device, BulkinAllocator &allocator);
+
+private:
+  vk::PipelineLayout testPipelineLayout;
+  vk::Pipeline testPipeline;
+  vk::DescriptorSetLayout testDescriptorSetLayout;
+  vk::DescriptorPool testDescriptorPool;
+  std::vector<vk::DescriptorSet> testDescriptorSets;
+
+  vk::PipelineLayout pyramidPipelineLayout;
+  vk::Pipeline pyramidPipeline;
+  vk::DescriptorSetLayout pyramidDescriptorSetLayout;
+  vk::DescriptorPool pyramidDescriptorPool;
+  std::vector<vk::DescriptorSet> pyramidDescriptorSets;
+
+  vk::Image pyramidImage;
+  BulkinAllocation pyramidImageMemory;
+  vk::ImageView pyramidView;
+  std::vector<vk::ImageView> pyramidLevelViews;
+  std::vector<vk::Extent2D> pyramidLevelExtents;
+  vk::Sampler pyramidSampler;
+  uint32_t modelCount = 0;
+
+  void destroyPyramid(vk::Device &device, BulkinAllocator &allocator);
+  void writePyramidDescriptor(vk::Device &device, vk::DescriptorSet set);
+  static vk::Pipeline createPipeline(vk::Device &device,
+                                     vk::PipelineCache pipelineCache,
+                                     const unsigned char *code,
+                                     size_t codeSize,
+                                     vk::PipelineLayout layout);
+};
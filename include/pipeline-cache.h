@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <string>
+
+class BulkinPipelineCache {
+public:
+  vk::PipelineCache cache;
+  std::string path = "pipeline.cache";
+
+  void load(vk::Device &device, vk::PhysicalDevice &physicalDevice);
+  void save(vk::Device &device);
+  void cleanup(vk::Device &device);
+
+private:
+  // written in front of the driver's blob so a cache from another GPU or
+  // driver build is thrown away instead of handed to the driver
+  struct Header {
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t vendorID = 0;
+    uint32_t deviceID = 0;
+    uint32_t driverVersion = 0;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE] = {};
+    uint32_t reserved = 0;
+    uint64_t dataSize = 0;
+  };
+
+  Header header;
+};
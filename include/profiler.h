@@ -0,0 +1,77 @@
+#pragma once
+
+#include "constants.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <deque>
+#include <string>
+
+// in recording order. the occlusion pass is the early model test, the late
+// pass the retest and the second half of the main pass drawn after the
+// pyramid
+enum class ProfilerPass : uint32_t {
+  Culling,
+  Occlusion,
+  Clusters,
+  Main,
+  Pyramid,
+  Late,
+  Count
+};
+
+constexpr uint32_t PROFILER_PASS_COUNT =
+    static_cast<uint32_t>(ProfilerPass::Count);
+constexpr uint32_t PROFILER_STATISTIC_COUNT = 5;
+constexpr size_t PROFILER_WINDOW = 256;
+
+struct PassSample {
+  uint64_t frame = 0;
+  double milliseconds = 0.0;
+  // input assembly vertices, vertex shader invocations, clipping primitives,
+  // fragment shader invocations, compute shader invocations
+  std::array<uint64_t, PROFILER_STATISTIC_COUNT> statistics{};
+};
+
+struct PassStatistics {
+  size_t samples = 0;
+  double minMilliseconds = 0.0;
+  double avgMilliseconds = 0.0;
+  double p99Milliseconds = 0.0;
+  std::array<uint64_t, PROFILER_STATISTIC_COUNT> lastStatistics{};
+};
+
+class BulkinProfiler {
+public:
+  void create(vk::Device &device, vk::PhysicalDevice &physicalDevice);
+  void reset(vk::CommandBuffer commandBuffer, uint32_t currentFrame);
+  // a pass that executes secondaries only gets its statistics when the
+  // device can inherit queries, otherwise it is timed alone
+  void beginPass(vk::CommandBuffer commandBuffer, uint32_t currentFrame,
+                 ProfilerPass pass, bool secondaries = false);
+  void endPass(vk::CommandBuffer commandBuffer, uint32_t currentFrame,
+               ProfilerPass pass, bool secondaries = false);
+  // what the secondaries of such a pass have to declare in their inheritance
+  vk::QueryPipelineStatisticFlags inheritedStatistics() const;
+  void collect(vk::Device &device, uint32_t currentFrame);
+  PassStatistics getStatistics(ProfilerPass pass) const;
+  void writeCsv(const std::string &path) const;
+  // the queries of frames recorded while profiling was off were never reset,
+  // so collection starts over when it is switched on
+  void restart();
+  bool isSupported() const;
+  void cleanup(vk::Device &device);
+  static const char *passName(ProfilerPass pass);
+
+private:
+  std::array<vk::QueryPool, MAX_FRAMES_IN_FLIGHT> timestampPools;
+  std::array<vk::QueryPool, MAX_FRAMES_IN_FLIGHT> statisticsPools;
+  std::array<bool, MAX_FRAMES_IN_FLIGHT> submitted{};
+  std::array<std::deque<PassSample>, PROFILER_PASS_COUNT> samples;
+  bool supported = false;
+  bool pipelineStatistics = false;
+  bool inheritedQueries = false;
+  double timestampPeriod = 1.0;
+  uint64_t frameCount = 0;
+};
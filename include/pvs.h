@@ -0,0 +1,96 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+class BulkinJobPool;
+
+// open cells are grouped into square blocks of this many cells a side
+constexpr uint32_t PVS_REGION_SIZE = 4;
+// rays cast from each sample point of an open cell
+constexpr uint32_t PVS_RAY_COUNT = 256;
+// quads without a region are drawn from everywhere; must match cull.comp
+constexpr uint32_t PVS_NO_REGION = 0xffffffffu;
+
+// potentially visible set over a tile level: which regions of open cells can
+// be seen from anywhere inside each region. walls are full height, so looking
+// down on the grid is enough and a cell is visible as soon as a ray crosses
+// it. rows are stored zero-run compressed, as in the old quake vis files
+class BulkinPvs {
+public:
+  // walls[z][x] is non-zero for solid cells. the regions are always laid out,
+  // the visibility between them is only traced when baked, on jobs
+  void build(const std::vector<std::vector<uint32_t>> &walls, bool bake,
+             BulkinJobPool &jobs);
+  bool baked() const { return !rowOffsets.empty(); }
+  uint32_t regionCount() const { return regions; }
+  // region of the open cell at (x, z), PVS_NO_REGION for walls and cells
+  // outside the grid
+  uint32_t regionAt(int64_t x, int64_t z) const;
+  // region holding a world space position, cells are centred on (x, z - 0.5)
+  uint32_t regionAt(glm::vec3 position) const;
+  // in grid space cell (x, z) covers [x, x + 1) x [z, z + 1)
+  static glm::vec2 gridPosition(glm::vec3 position) {
+    return glm::vec2(position.x + 0.5f, position.z + 1.0f);
+  }
+  // amanatides-woo walk from a grid space origin, calling visit with the
+  // region of every open cell entered until the ray hits a wall or leaves the
+  // grid
+  template <typename Visit>
+  void traceRay(glm::vec2 origin, glm::vec2 direction, Visit &&visit) const;
+  // number of 32 bit words in a decompressed row
+  uint32_t rowWords() const { return (regions + 31) / 32; }
+  // writes the regions visible from region into bits, rows longer than bits
+  // are cut short
+  void decompress(uint32_t region, std::span<uint32_t> bits) const;
+  // fraction of region pairs that can see each other
+  double density() const;
+
+private:
+  size_t width = 0, depth = 0;
+  uint32_t regions = 0;
+  std::vector<uint32_t> cellRegions;
+  std::vector<uint8_t> rows;
+  std::vector<uint32_t> rowOffsets;
+  uint64_t visiblePairs = 0;
+
+  void traceRegion(uint32_t region, std::vector<uint8_t> &visible) const;
+  void compress(std::span<const uint8_t> row);
+};
+
+template <typename Visit>
+void BulkinPvs::traceRay(glm::vec2 origin, glm::vec2 direction,
+                         Visit &&visit) const {
+  constexpr float infinity = std::numeric_limits<float>::infinity();
+  auto cellX = static_cast<int64_t>(std::floor(origin.x));
+  auto cellZ = static_cast<int64_t>(std::floor(origin.y));
+  int64_t stepX = direction.x > 0.0f ? 1 : -1;
+  int64_t stepZ = direction.y > 0.0f ? 1 : -1;
+  float deltaX = direction.x != 0.0f ? std::abs(1.0f / direction.x) : infinity;
+  float deltaZ = direction.y != 0.0f ? std::abs(1.0f / direction.y) : infinity;
+  float nextX = direction.x > 0.0f
+                    ? (static_cast<float>(cellX + 1) - origin.x) * deltaX
+                    : (origin.x - static_cast<float>(cellX)) * deltaX;
+  float nextZ = direction.y > 0.0f
+                    ? (static_cast<float>(cellZ + 1) - origin.y) * deltaZ
+                    : (origin.y - static_cast<float>(cellZ)) * deltaZ;
+
+  while (true) {
+    if (nextX < nextZ) {
+      cellX += stepX;
+      nextX += deltaX;
+    } else {
+      cellZ += stepZ;
+      nextZ += deltaZ;
+    }
+    auto region = regionAt(cellX, cellZ);
+    if (region == PVS_NO_REGION)
+      return;
+    visit(region);
+  }
+}
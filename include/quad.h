@@ -1,17 +1,27 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <span>
 #include <vector>
 
+#include "pvs.h"
 #include "vertex.h"
 
 class BulkinQuad {
 public:
-  void addQuad(glm::vec3 position, float angle, glm::vec3 rotation, float scale, int faceId, uint32_t textureIndex);
-  uint32_t getInstanceCount();
-  PerInstanceData getInstanceData(size_t i);
+  // returns a handle that stays valid for the lifetime of the scene, quads are
+  // never removed or reordered
+  // region is the potentially visible set region the quad is drawn with,
+  // PVS_NO_REGION draws it from everywhere
+  uint32_t addQuad(glm::vec3 position, glm::vec2 size, int faceId, uint32_t textureIndex, uint32_t region = PVS_NO_REGION);
+  void setPosition(uint32_t quad, glm::vec3 position);
+  void setRegion(uint32_t quad, uint32_t region);
+  void setTexture(uint32_t quad, uint32_t textureIndex);
+  uint32_t getInstanceCount() const;
+  const PerInstanceData& getInstanceData(size_t i) const;
+  std::span<const PerInstanceData> getInstances() const { return instances; }
+  std::span<const uint32_t> getRegions() const { return regions; }
 private:
-  std::vector<glm::mat4> matrices;
-  std::vector<uint32_t> faceIds;
-  std::vector<uint32_t> textureIndices;
+  std::vector<PerInstanceData> instances;
+  std::vector<uint32_t> regions;
 };
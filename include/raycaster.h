@@ -0,0 +1,33 @@
+#pragma once
+
+#include "job-pool.h"
+#include "pvs.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+constexpr uint32_t RAYCAST_RAY_COUNT = 2000;
+// rays walked by each job, smaller jobs cost more in handing out than the
+// walk itself
+constexpr uint32_t RAYCAST_RAYS_PER_JOB = 250;
+
+// per frame visibility in the style of the old grid raycasters: a fan of 2d
+// rays across the horizontal extent of the view frustum walks the wall grid,
+// and the region of every open cell a ray crosses is marked visible. nothing
+// about the view is baked, unlike the pvs rows
+class BulkinRaycaster {
+public:
+  // bits gets one bit per region, regions past its end are dropped
+  void trace(const BulkinPvs &pvs, const glm::mat4 &view,
+             const glm::vec3 &viewPos, float aspect, BulkinJobPool &jobs,
+             std::span<uint32_t> bits);
+
+private:
+  std::vector<std::vector<uint32_t>> jobBits;
+
+  static void fan(const glm::mat4 &view, float aspect, float &first,
+                  float &last);
+};
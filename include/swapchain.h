@@ -3,6 +3,7 @@
 #include <vulkan/vulkan.hpp>
 #include <GLFW/glfw3.h>
 
+#include "allocator.h"
 #include "queue-family.h"
 
 class BulkinSwapchain {
@@ -12,21 +13,25 @@ public:
   std::vector<vk::ImageView> imageViews;
   vk::Extent2D extent;
   vk::Format imageFormat;
+  vk::ImageLayout finalLayout = vk::ImageLayout::ePresentSrcKHR;
   bool vsync = true;
+  bool offscreen = false;
 
   void querySwapchainSupport(vk::PhysicalDevice& physicalDevice, vk::SurfaceKHR& surface);
   void chooseSwapSurfaceFormat();
   void chooseSwapPresentMode();
-  void chooseSwapExtent(GLFWwindow* window);
-  void createSwapchain(vk::Device& device, vk::SurfaceKHR& surface, GLFWwindow *window, QueueFamilyIndices indices);
+  void chooseSwapExtent(vk::Extent2D framebufferExtent);
+  void createSwapchain(vk::Device& device, vk::SurfaceKHR& surface, vk::Extent2D framebufferExtent, QueueFamilyIndices indices);
   void createImageViews(vk::Device& device);
+  void createOffscreen(vk::Device& device, BulkinAllocator& allocator, uint32_t width, uint32_t height, uint32_t imageCount);
   bool isAdequate();
-  void recreate(vk::Device& device, vk::SurfaceKHR& surface, GLFWwindow* window, QueueFamilyIndices indices);
-  void cleanup(vk::Device& device);
+  void recreate(vk::Device& device, BulkinAllocator& allocator, vk::SurfaceKHR& surface, vk::Extent2D framebufferExtent, QueueFamilyIndices indices);
+  void cleanup(vk::Device& device, BulkinAllocator& allocator);
 private:
   vk::SurfaceFormatKHR format;
   vk::PresentModeKHR presentMode;
   vk::SurfaceCapabilitiesKHR capabilities;
   std::vector<vk::SurfaceFormatKHR> formats;
   std::vector<vk::PresentModeKHR> presentModes;
+  std::vector<BulkinAllocation> imageMemory;
 };
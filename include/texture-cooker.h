@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr uint8_t KTX2_IDENTIFIER[12] = {0xab, 'K',  'T',  'X', ' ',  '2',
+                                         '0',  0xbb, '\r', '\n', 0x1a, '\n'};
+
+// the fixed start of a KTX2 file, followed by one Ktx2Level per mip level
+struct Ktx2Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+
+struct Ktx2Level {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80);
+static_assert(sizeof(Ktx2Level) == 24);
+
+// turns decoded RGBA8 pixels into a BC1 KTX2 file with every mip level baked
+// in, mips are filtered in linear space before they are encoded
+class BulkinTextureCooker {
+public:
+  static bool cook(const unsigned char *pixels, uint32_t width,
+                   uint32_t height, const std::string &path);
+  // the BC1 data of every level, largest first
+  static std::vector<std::vector<uint8_t>>
+  encode(const unsigned char *pixels, uint32_t width, uint32_t height);
+  static bool write(const std::vector<std::vector<uint8_t>> &levels,
+                    uint32_t width, uint32_t height, const std::string &path);
+  // bytes per 4x4 block for the block compressed formats the loader accepts,
+  // 0 for anything else
+  static uint32_t blockBytes(vk::Format format);
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "allocator.h"
+#include "texture.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <span>
+#include <vector>
+
+// level tiles mostly share one size and format, so the largest group of
+// textures with the same shape becomes the layers of one array image and
+// everything else stays a loose image in the bindless array. every texture is
+// sampled through the same sampler
+class BulkinTextureSet {
+public:
+  vk::Sampler sampler;
+  vk::ImageView arrayView;
+  // bound in place of the loose textures when there are none, the bindless
+  // array cannot be empty
+  vk::ImageView firstLayerView;
+  // indices of the textures that are not part of the array, in binding order
+  std::vector<uint32_t> looseTextures;
+  // what the texture field of a quad or model holds for each texture id
+  std::vector<uint32_t> slots;
+
+  void create(vk::Device &device, vk::PhysicalDevice &physicalDevice,
+              BulkinAllocator &allocator, std::span<BulkinTexture> textures,
+              bool compressed);
+  uint32_t bindlessCount() const;
+  void cleanup(vk::Device &device, BulkinAllocator &allocator);
+
+private:
+  vk::Image arrayImage;
+  BulkinAllocation arrayMemory;
+
+  void createArrayImage(vk::Device &device, BulkinAllocator &allocator,
+                        const BulkinTexture &shape, uint32_t layers);
+  void createSampler(vk::Device &device, vk::PhysicalDevice &physicalDevice);
+};
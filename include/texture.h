@@ -1,24 +1,58 @@
 #pragma once
 
+#include "mapped-file.h"
+#include "uploader.h"
+
 #include <vulkan/vulkan.hpp>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 class BulkinTexture {
 public:
   BulkinTexture(std::string filename) : filename(filename) {}
   
   vk::ImageView imageView;
-  vk::Sampler sampler;
   
-  void load(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::CommandPool& commandPool, vk::Queue& graphicsQueue);
-  void cleanup(vk::Device& device);
+  void probe(bool compressed);
+  bool sameShape(const BulkinTexture& other) const;
+  void createImage(vk::Device& device, BulkinAllocator& allocator);
+  void useArrayLayer(vk::Image arrayImage, uint32_t layer);
+  void decode();
+  void upload(vk::PhysicalDevice& physicalDevice, BulkinUploader& uploader);
+  void cleanup(vk::Device& device, BulkinAllocator& allocator);
+  vk::Format getFormat() const { return format; }
+  uint32_t getWidth() const { return static_cast<uint32_t>(width); }
+  uint32_t getHeight() const { return static_cast<uint32_t>(height); }
+  uint32_t getMipLevels() const { return mipLevels; }
 
 private:
-  uint32_t mipLevels;
+  uint32_t mipLevels = 1;
+  int width = 0;
+  int height = 0;
+  unsigned char* pixels = nullptr;
+  vk::Format format = vk::Format::eR8G8B8A8Srgb;
   vk::Image image;
-  vk::DeviceMemory imageMemory;
+  BulkinAllocation imageMemory;
+  // members of the tile array write into their layer of the shared image and
+  // own neither the image nor a view
+  bool inArray = false;
+  uint32_t layer = 0;
   std::string filename;
-  void createImageView(vk::Device& device);
-  void createTextureSampler(vk::Device& device, vk::PhysicalDevice& physicalDevice);
-  void copyBufferToImage(vk::Buffer buffer, uint32_t width, uint32_t height, vk::Device device, vk::CommandPool commandPool, vk::Queue graphicsQueue);
-  void generateMipmaps(vk::Image image, vk::Format imageFormat, int32_t texWidth, int32_t, uint32_t mipLevels, vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::CommandPool& commandPool, vk::Queue& graphicsQueue);
+  
+  // block compressed levels, largest first, pointing into the mapped KTX2 file
+  // or into levels encoded this run
+  struct Level {
+    const std::byte* data;
+    vk::DeviceSize size;
+  };
+  std::shared_ptr<BulkinMappedFile> cooked;
+  std::vector<std::vector<uint8_t>> encoded;
+  std::vector<Level> levels;
+  
+  void loadPixels();
+  bool mapCooked(const std::string& cookedPath);
+  void copyBufferToImage(vk::CommandBuffer commandBuffer, vk::Buffer buffer, vk::DeviceSize offset, uint32_t width, uint32_t height, uint32_t mipLevel);
+  void generateMipmaps(vk::CommandBuffer commandBuffer, vk::Image image, vk::Format imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels, vk::PhysicalDevice& physicalDevice);
 };
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// hands whole values from one writer thread to one reader thread without
+// locks. the writer fills its buffer and publishes it, the reader swaps in
+// whatever was published last and skips anything it was too slow to see
+template <typename T> class BulkinTripleBuffer {
+public:
+  T &writeBuffer() { return slots[back]; }
+
+  // returns whether the reader had taken the previously published value, if
+  // not that value was dropped in favour of this one
+  bool publish() {
+    auto previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+    back = previous & INDEX;
+    return !(previous & FRESH);
+  }
+
+  // false when nothing was published since the last call
+  bool consume() {
+    if (!(middle.load(std::memory_order_acquire) & FRESH))
+      return false;
+    auto previous = middle.exchange(front, std::memory_order_acq_rel);
+    front = previous & INDEX;
+    return true;
+  }
+
+  const T &readBuffer() const { return slots[front]; }
+
+private:
+  static constexpr uint8_t INDEX = 0x3;
+  static constexpr uint8_t FRESH = 0x4;
+
+  std::array<T, 3> slots{};
+  uint8_t back = 0;
+  uint8_t front = 1;
+  std::atomic<uint8_t> middle = 2;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "allocator.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+constexpr vk::DeviceSize UPLOAD_RING_SIZE = 64 * 1024 * 1024;
+
+// collects buffer and image uploads into one command buffer backed by a
+// persistently mapped staging ring, and submits them together on flush
+class BulkinUploader {
+public:
+  void create(vk::Device &device, BulkinAllocator &allocator,
+              vk::CommandPool commandPool, vk::Queue queue,
+              vk::DeviceSize ringSize = UPLOAD_RING_SIZE);
+  vk::CommandBuffer commandBuffer();
+  vk::Buffer stagingBuffer(vk::DeviceSize offset);
+  vk::DeviceSize stagingBufferOffset(vk::DeviceSize offset);
+  vk::DeviceSize stage(const void *contents, vk::DeviceSize size,
+                       vk::DeviceSize alignment = 16);
+  void uploadBuffer(const void *contents, vk::DeviceSize size, vk::Buffer dst,
+                    vk::DeviceSize dstOffset = 0);
+  void flush();
+  void cleanup();
+
+private:
+  struct Overflow {
+    vk::Buffer buffer;
+    BulkinAllocation memory;
+  };
+
+  vk::Device device;
+  BulkinAllocator *allocator = nullptr;
+  vk::Queue queue;
+  vk::CommandBuffer batch;
+  vk::Fence fence;
+  bool recording = false;
+
+  vk::Buffer ring;
+  BulkinAllocation ringMemory;
+  char *ringMapped = nullptr;
+  vk::DeviceSize ringSize = 0;
+  vk::DeviceSize ringHead = 0;
+
+  // uploads bigger than the whole ring get a staging buffer of their own,
+  // freed with the batch that used it; offsets past ringSize refer to them
+  std::vector<Overflow> overflows;
+};
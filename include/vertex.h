@@ -10,14 +10,54 @@
 struct UniformBufferObject {
   glm::mat4 view;
   glm::mat4 proj;
-  glm::vec3 viewPos;
+  alignas(16) glm::vec3 viewPos;
+  alignas(16) glm::vec4 frustumPlanes[6];
+  alignas(16) glm::vec2 screenSize;
+  float nearPlane;
+  float farPlane;
+  // height of the level's walls for shadow rays, zero when they are off
+  float wallHeight;
+  // point lights already in the lightmap, skipped on lightmapped fragments
+  uint32_t firstBakedLight;
+  uint32_t bakedLightCount;
 };
 
+// level quads are axis-aligned faces, so the orientation is implied by the
+// face id and only the corner position, extent and texture are stored:
+// packed holds the face id in bits 0-2, the texture index in bits 3-13 and
+// the width and height in whole cells in bits 14-22 and 23-31
 struct PerInstanceData {
+  float position[3];
+  uint32_t packed;
+};
+
+constexpr uint32_t INSTANCE_FACE_BITS = 3;
+constexpr uint32_t INSTANCE_TEXTURE_BITS = 11;
+constexpr uint32_t INSTANCE_SIZE_BITS = 9;
+
+// the texture field holds a slot rather than a texture id once uploaded: an
+// index into the bindless array, or this flag plus a layer of the tile array
+constexpr uint32_t TEXTURE_ARRAY_SLOT = 1u << (INSTANCE_TEXTURE_BITS - 1);
+
+static_assert(sizeof(PerInstanceData) == 16);
+
+// models keep a full transform, with the normal matrix worked out on the host
+// instead of per vertex
+struct ModelInstanceData {
   glm::mat4 model;
-  uint32_t faceId;
+  glm::mat4 normalMatrix;
   uint32_t textureIndex;
-  glm::vec2 padding = glm::vec3(0.0f);
+};
+
+enum class DrawKind : uint32_t { Quads, Models };
+
+// visible quads are split by distance from the camera into this many draws,
+// drawn nearest first; must match cull.comp
+constexpr uint32_t CULL_DEPTH_BUCKETS = 8;
+
+struct CulledDrawCommand {
+  vk::DrawIndexedIndirectCommand commands[CULL_DEPTH_BUCKETS];
+  uint32_t drawCount = 0;
 };
 
 struct Vertex {
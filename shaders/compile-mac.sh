@@ -1,2 +1,6 @@
 /Users/matty/VulkanSDK/1.4.321.0/macOS/bin/glslc shader.vert -o vert.spv
 /Users/matty/VulkanSDK/1.4.321.0/macOS/bin/glslc shader.frag -o frag.spv
+/Users/matty/VulkanSDK/1.4.321.0/macOS/bin/glslc cull.comp -o cull.spv
+/Users/matty/VulkanSDK/1.4.321.0/macOS/bin/glslc cluster.comp -o cluster.spv
+/Users/matty/VulkanSDK/1.4.321.0/macOS/bin/glslc hiz.comp -o hiz.spv
+/Users/matty/VulkanSDK/1.4.321.0/macOS/bin/glslc occlusion.comp -o occlusion.spv
@@ -1 +0,0 @@
-/Users/matty/VulkanSDK/1.4.321.0/macOS/bin/slangc shader.slang -target spirv -profile spirv_1_4 -emit-spirv-directly -fvk-use-entrypoint-name -entry vertMain -entry fragMain -o slang.spv
@@ -1,2 +1,6 @@
 /home/matty/vulkan-sdk/1.4.321.1/x86_64/bin/glslc shader.vert -o vert.spv
 /home/matty/vulkan-sdk/1.4.321.1/x86_64/bin/glslc shader.frag -o frag.spv
+/home/matty/vulkan-sdk/1.4.321.1/x86_64/bin/glslc cull.comp -o cull.spv
+/home/matty/vulkan-sdk/1.4.321.1/x86_64/bin/glslc cluster.comp -o cluster.spv
+/home/matty/vulkan-sdk/1.4.321.1/x86_64/bin/glslc hiz.comp -o hiz.spv
+/home/matty/vulkan-sdk/1.4.321.1/x86_64/bin/glslc occlusion.comp -o occlusion.spv
@@ -2,14 +2,34 @@
 
 #extension GL_EXT_nonuniform_qualifier : require
 
+// must match constants.h
+const uvec3 CLUSTER_GRID = uvec3(16, 9, 24);
+const uint CLUSTER_COUNT = CLUSTER_GRID.x * CLUSTER_GRID.y * CLUSTER_GRID.z;
+const uint MAX_LIGHTS_PER_CLUSTER = 64;
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+  mat4 view;
+  mat4 proj;
+  vec3 viewPos;
+  vec4 frustumPlanes[6];
+  vec2 screenSize;
+  float nearPlane;
+  float farPlane;
+  float wallHeight;
+  uint firstBakedLight;
+  uint bakedLightCount;
+} ubo;
+
 struct PointLight {
   vec3 position;
   vec3 ambient;
   vec3 diffuse;
   vec3 specular;
+  float padding;
   float constant;
   float linear;
   float quadratic;
+  float radius;
 };
 
 layout(location = 0) in vec3 fragColor;
@@ -18,34 +38,128 @@ layout(location = 2) in vec2 fragTexCoord;
 layout(location = 3) flat in uint fragTextureId;
 layout(location = 4) in vec3 normal;
 layout(location = 5) in vec3 viewPos;
+layout(location = 6) in float viewDepth;
+layout(location = 7) in vec3 lightmapCoord;
 layout(location = 0) out vec4 outColor;
 
 layout(binding = 1) uniform sampler2D texSamplers[];
+// the largest group of same-shaped textures, one layer per texture
+layout(binding = 4) uniform sampler2DArray tileTextures;
+// diffuse and ambient light of the level's static lights, baked at load
+layout(binding = 5) uniform sampler2D lightmap;
+// one texel per level cell, non-zero where a wall stands
+layout(binding = 6) uniform usampler2D wallGrid;
+
+// must match vertex.h, texture ids at or above it are layers of tileTextures
+const uint TEXTURE_ARRAY_SLOT = 1024;
 
 layout(std430, set = 0, binding = 2) readonly buffer PointLights { 
   PointLight pointLights[];
 };
 
+layout(std430, set = 0, binding = 3) readonly buffer ClusterLights {
+  uint lightCounts[CLUSTER_COUNT];
+  uint lightIndices[];
+};
+
 const vec3 gamma = vec3(2.2);
 const vec3 fog_color = vec3(0.05);
 
-vec3 BlinnPhong(vec3 normal, vec3 fragPos, vec3 lightPos, vec3 lightColor);
+vec3 BlinnPhong(vec3 normal, vec3 fragPos, vec3 lightPos, vec3 lightColor, float radius, float visibility);
+bool shadowed(vec3 from, vec3 to);
 
 void main() {
   vec3 norm = normalize(normal);
 
-  vec3 color = texture(texSamplers[fragTextureId], fragTexCoord).rgb;
+  vec3 color;
+  if (fragTextureId >= TEXTURE_ARRAY_SLOT)
+    color = texture(tileTextures, vec3(fragTexCoord, float(fragTextureId - TEXTURE_ARRAY_SLOT))).rgb;
+  else
+    color = texture(texSamplers[fragTextureId], fragTexCoord).rgb;
   vec3 lighting = vec3(0.0);
 
-  for (int i = 0; i < pointLights.length(); i++)
-    lighting += BlinnPhong(norm, fragPos, pointLights[i].position, pointLights[i].diffuse);
+  // the level's static lights and their shadows are baked, every other light
+  // still goes through the loop
+  bool baked = lightmapCoord.z > 0.5;
+  if (baked)
+    lighting = texture(lightmap, lightmapCoord.xy).rgb;
+
+  // only the lights binned into this fragment's cluster can reach it
+  uvec2 tile = min(uvec2(gl_FragCoord.xy / ubo.screenSize * vec2(CLUSTER_GRID.xy)), CLUSTER_GRID.xy - 1u);
+  float slice = log(viewDepth / ubo.nearPlane) / log(ubo.farPlane / ubo.nearPlane) * float(CLUSTER_GRID.z);
+  uint depthSlice = min(uint(max(slice, 0.0)), CLUSTER_GRID.z - 1u);
+  uint cluster = tile.x + tile.y * CLUSTER_GRID.x + depthSlice * CLUSTER_GRID.x * CLUSTER_GRID.y;
+
+  uint lightCount = lightCounts[cluster];
+  for (uint i = 0; i < lightCount; i++) {
+    uint index = lightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
+    // unsigned, so indices below the baked run wrap past its end
+    if (baked && index - ubo.firstBakedLight < ubo.bakedLightCount)
+      continue;
+    PointLight light = pointLights[index];
+    // a light behind the surface or past its radius adds no diffuse anyway,
+    // so only the lights that reach the fragment are marched. the ray starts
+    // just off the surface so a wall never shadows itself
+    vec3 toLight = light.position - fragPos;
+    float visibility = 1.0;
+    if (ubo.wallHeight > 0.0 && dot(norm, toLight) > 0.0 && dot(toLight, toLight) < light.radius * light.radius &&
+        shadowed(fragPos + norm * 0.01, light.position))
+      visibility = 0.0;
+    lighting += BlinnPhong(norm, fragPos, light.position, light.diffuse, light.radius, visibility);
+  }
   color *= lighting;
 
   color = pow(color, 1/gamma);
   outColor = vec4(color, 1.0);
 }
 
-vec3 BlinnPhong(vec3 normal, vec3 fragPos, vec3 lightPos, vec3 lightColor)
+// walks the cells between the two points on the level grid, so the cost is
+// the grid distance to the light. walls fill their cells from the floor up to
+// wallHeight, so a wall cell only blocks the part of the ray below its top
+bool shadowed(vec3 from, vec3 to)
+{
+    // cell (x, z) spans x - 0.5 to x + 0.5 and z - 1 to z in world space
+    vec2 start = from.xz + vec2(0.5, 1.0);
+    vec2 delta = to.xz + vec2(0.5, 1.0) - start;
+    ivec2 cell = ivec2(floor(start));
+    ivec2 last = ivec2(floor(start + delta));
+    ivec2 stepDir = ivec2(sign(delta));
+    vec2 tDelta = vec2(delta.x != 0.0 ? abs(1.0 / delta.x) : 1e30, delta.y != 0.0 ? abs(1.0 / delta.y) : 1e30);
+    vec2 tMax = vec2(stepDir.x > 0 ? floor(start.x) + 1.0 - start.x : start.x - floor(start.x),
+                     stepDir.y > 0 ? floor(start.y) + 1.0 - start.y : start.y - floor(start.y)) * tDelta;
+    // an axis the ray does not move along is never crossed, even when the
+    // start sits right on a cell edge
+    if (stepDir.x == 0)
+        tMax.x = 1e30;
+    if (stepDir.y == 0)
+        tMax.y = 1e30;
+    ivec2 size = textureSize(wallGrid, 0);
+
+    // walks until the light's own cell has been tested. rounding at a corner
+    // can step around it, so a cell the ray only enters past its end stops
+    // the walk too
+    float tEnter = 0.0;
+    while (tEnter <= 1.0) {
+        float tExit = min(min(tMax.x, tMax.y), 1.0);
+        if (all(greaterThanEqual(cell, ivec2(0))) && all(lessThan(cell, size)) && texelFetch(wallGrid, cell, 0).r != 0u &&
+            min(mix(from.y, to.y, tEnter), mix(from.y, to.y, tExit)) < ubo.wallHeight)
+            return true;
+        if (cell == last)
+            break;
+        if (tMax.x < tMax.y) {
+            cell.x += stepDir.x;
+            tEnter = tMax.x;
+            tMax.x += tDelta.x;
+        } else {
+            cell.y += stepDir.y;
+            tEnter = tMax.y;
+            tMax.y += tDelta.y;
+        }
+    }
+    return false;
+}
+
+vec3 BlinnPhong(vec3 normal, vec3 fragPos, vec3 lightPos, vec3 lightColor, float radius, float visibility)
 {
     vec3 ambient = lightColor * 0.1;
     // diffuse
@@ -63,8 +177,12 @@ vec3 BlinnPhong(vec3 normal, vec3 fragPos, vec3 lightPos, vec3 lightColor)
     float max_distance = 1.5;
     float distance = length(lightPos - fragPos);
     float attenuation = 1.0 / distance;
+    // fade to zero at the light radius so culled lights never pop
+    float falloff = clamp(1.0 - pow(distance / radius, 4.0), 0.0, 1.0);
+    attenuation *= falloff * falloff;
     
-    diffuse *= attenuation;
+    // a shadowed light keeps its ambient term
+    diffuse *= attenuation * visibility;
     specular *= attenuation;
     ambient *= attenuation;
     
@@ -4,11 +4,20 @@ layout(set = 0, binding = 0) uniform UniformBufferObject {
   mat4 view;
   mat4 proj;
   vec3 viewPos;
+  vec4 frustumPlanes[6];
+  vec2 screenSize;
+  float nearPlane;
+  float farPlane;
 } ubo;
 
 struct PerInstanceData {
+  vec3 position;
+  uint packed;
+};
+
+struct ModelInstanceData {
   mat4 model;
-  uint faceId;
+  mat4 normalMatrix;
   uint textureId;
 };
 
@@ -16,6 +25,32 @@ layout(set = 1, binding = 0, std430) readonly buffer SSBO {
   PerInstanceData data[];
 };
 
+layout(set = 1, binding = 1, std430) readonly buffer VisibleInstances {
+  uint visibleInstances[];
+};
+
+layout(set = 1, binding = 2, std430) readonly buffer ModelInstances {
+  ModelInstanceData models[];
+};
+
+// atlas offset in xy and scale in zw of each quad's baked lighting, zero when
+// the quad is lit at runtime
+layout(set = 1, binding = 3, std430) readonly buffer LightmapRects {
+  vec4 lightmapRects[];
+};
+
+layout(push_constant) uniform PushConstants {
+  uint drawKind;
+} pc;
+
+const uint DRAW_QUADS = 0;
+
+// local x, local y and normal of the unit quad for each face id: 0 faces -z,
+// 1 faces +z, 2 faces +x, 3 faces -x, 4 is a floor and 5 a ceiling
+const vec3 faceAxisX[6] = vec3[](vec3(-1, 0, 0), vec3(1, 0, 0), vec3(0, 0, -1), vec3(0, 0, 1), vec3(1, 0, 0), vec3(1, 0, 0));
+const vec3 faceAxisY[6] = vec3[](vec3(0, 1, 0), vec3(0, 1, 0), vec3(0, 1, 0), vec3(0, 1, 0), vec3(0, 0, -1), vec3(0, 0, 1));
+const vec3 faceNormal[6] = vec3[](vec3(0, 0, -1), vec3(0, 0, 1), vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0));
+
 layout (location = 0) in vec3 inPosition;
 layout (location = 1) in vec2 inTexCoord;
 layout (location = 2) in vec3 inColor;
@@ -27,15 +62,37 @@ layout(location = 2) out vec2 fragTexCoord;
 layout(location = 3) out uint fragTextureId;
 layout(location = 4) out vec3 normal;
 layout(location = 5) out vec3 viewPos;
+layout(location = 6) out float viewDepth;
+// atlas coordinate in xy, z is 1 when the quad has baked lighting
+layout(location = 7) out vec3 lightmapCoord;
+
+// the depth prepass and the shaded pass must land on exactly the same depth
+// for the equal test
+invariant gl_Position;
 
 void main() {
-  mat4 model = data[gl_InstanceIndex].model; 
-  fragPos = vec3(model * vec4(inPosition, 1.0));
+  if (pc.drawKind == DRAW_QUADS) {
+    uint id = visibleInstances[gl_InstanceIndex];
+    PerInstanceData instance = data[id];
+    uint face = instance.packed & 0x7u;
+    vec2 size = vec2((instance.packed >> 14) & 0x1ffu, instance.packed >> 23);
+    fragPos = instance.position + faceAxisX[face] * (inPosition.x * size.x) + faceAxisY[face] * (inPosition.y * size.y);
+    fragTextureId = (instance.packed >> 3) & 0x7ffu;
+    fragTexCoord = inTexCoord * size;
+    normal = faceNormal[face];
+    vec4 rect = lightmapRects[id];
+    lightmapCoord = vec3(rect.xy + vec2(inPosition.x + 0.5, inPosition.y) * rect.zw, rect.z > 0.0 ? 1.0 : 0.0);
+  } else {
+    ModelInstanceData instance = models[gl_InstanceIndex];
+    fragPos = vec3(instance.model * vec4(inPosition, 1.0));
+    fragTextureId = instance.textureId;
+    fragTexCoord = inTexCoord;
+    normal = mat3(instance.normalMatrix) * inNormal;
+    lightmapCoord = vec3(0.0);
+  }
   fragColor = inColor;
-  fragTextureId = data[gl_InstanceIndex].textureId;
-  fragTexCoord = inTexCoord;
-  normal = mat3(transpose(inverse(model))) * inNormal; 
   viewPos = ubo.viewPos;
-  gl_Position = ubo.proj * ubo.view * vec4(fragPos, 1.0);
+  vec4 viewSpacePos = ubo.view * vec4(fragPos, 1.0);
+  viewDepth = -viewSpacePos.z;
+  gl_Position = ubo.proj * viewSpacePos;
 }
-
@@ -0,0 +1,280 @@
+#include "allocator.h"
+
+#include <algorithm>
+#include <iterator>
+
+void BulkinAllocator::create(vk::Device &device,
+                             vk::PhysicalDevice &physicalDevice,
+                             vk::DeviceSize blockSize) {
+  this->device = device;
+  this->blockSize = blockSize;
+  memoryProperties = physicalDevice.getMemoryProperties();
+}
+
+BulkinAllocation
+BulkinAllocator::allocate(const vk::MemoryRequirements &requirements,
+                          vk::MemoryPropertyFlags properties,
+                          AllocationCategory category) {
+  std::lock_guard lock(mutex);
+  auto memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+  auto poolIndex = findPool(category, memoryType);
+  auto &pool = pools[poolIndex];
+
+  BulkinAllocation allocation{};
+  allocation.pool = poolIndex;
+  allocation.size = requirements.size;
+
+  if (requirements.size > blockSize) {
+    allocation.block = createBlock(pool, requirements.size, true);
+  } else {
+    bool found = false;
+    for (uint32_t i = 0; i < pool.blocks.size() && !found; i++) {
+      auto &block = pool.blocks[i];
+      if (!block.memory || block.dedicated)
+        continue;
+      if (allocateFromBlock(pool, block, requirements, allocation.offset)) {
+        allocation.block = i;
+        found = true;
+      }
+    }
+
+    if (!found) {
+      allocation.block = createBlock(pool, blockSize, false);
+      if (!allocateFromBlock(pool, pool.blocks[allocation.block], requirements,
+                             allocation.offset))
+        throw std::runtime_error("failed to sub-allocate device memory");
+    }
+  }
+
+  auto &block = pool.blocks[allocation.block];
+  block.liveBytes += allocation.size;
+  block.liveAllocations++;
+  allocationCounts[static_cast<uint32_t>(category)]++;
+
+  allocation.memory = block.memory;
+  if (block.mapped)
+    allocation.mapped = block.mapped + allocation.offset;
+  return allocation;
+}
+
+void BulkinAllocator::free(BulkinAllocation &allocation) {
+  if (!allocation.memory)
+    return;
+
+  std::lock_guard lock(mutex);
+  auto &pool = pools[allocation.pool];
+  auto &block = pool.blocks[allocation.block];
+  block.liveBytes -= allocation.size;
+  block.liveAllocations--;
+  allocationCounts[static_cast<uint32_t>(pool.category)]--;
+
+  if (block.dedicated) {
+    releaseBlock(block);
+  } else if (pool.linear) {
+    if (block.liveAllocations == 0)
+      block.head = 0;
+  } else {
+    auto offset = allocation.offset;
+    auto size = allocation.size;
+
+    // merge with the free ranges directly after and before this one
+    auto next = block.freeRanges.lower_bound(offset);
+    if (next != block.freeRanges.end() && offset + size == next->first) {
+      size += next->second;
+      next = block.freeRanges.erase(next);
+    }
+
+    auto merged = false;
+    if (next != block.freeRanges.begin()) {
+      auto previous = std::prev(next);
+      if (previous->first + previous->second == offset) {
+        previous->second += size;
+        merged = true;
+      }
+    }
+    if (!merged)
+      block.freeRanges[offset] = size;
+  }
+
+  allocation = BulkinAllocation{};
+}
+
+bool BulkinAllocator::supports(vk::MemoryPropertyFlags properties) const {
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+    if ((memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+        properties)
+      return true;
+  }
+  return false;
+}
+
+AllocatorStatistics
+BulkinAllocator::getStatistics(AllocationCategory category) {
+  std::lock_guard lock(mutex);
+  AllocatorStatistics statistics{};
+  vk::DeviceSize freeBytes = 0;
+  vk::DeviceSize largestFree = 0;
+
+  for (const auto &pool : pools) {
+    if (pool.category != category)
+      continue;
+
+    for (const auto &block : pool.blocks) {
+      if (!block.memory)
+        continue;
+
+      statistics.blockBytes += block.size;
+      statistics.liveBytes += block.liveBytes;
+      statistics.blockCount++;
+      if (block.dedicated)
+        continue;
+
+      if (pool.linear) {
+        freeBytes += block.size - block.head;
+        largestFree = std::max(largestFree, block.size - block.head);
+      } else {
+        for (const auto &[offset, size] : block.freeRanges) {
+          freeBytes += size;
+          largestFree = std::max(largestFree, size);
+        }
+      }
+    }
+  }
+
+  statistics.allocationCount =
+      allocationCounts[static_cast<uint32_t>(category)];
+  if (freeBytes > 0)
+    statistics.fragmentation = 1.0 - static_cast<double>(largestFree) /
+                                         static_cast<double>(freeBytes);
+  return statistics;
+}
+
+void BulkinAllocator::cleanup() {
+  for (auto &pool : pools) {
+    for (auto &block : pool.blocks) {
+      if (block.memory)
+        releaseBlock(block);
+    }
+  }
+  pools.clear();
+  allocationCounts = {};
+}
+
+const char *BulkinAllocator::categoryName(AllocationCategory category) {
+  switch (category) {
+  case AllocationCategory::Staging:
+    return "staging";
+  case AllocationCategory::Buffer:
+    return "buffer";
+  case AllocationCategory::Texture:
+    return "texture";
+  case AllocationCategory::Attachment:
+    return "attachment";
+  default:
+    return "unknown";
+  }
+}
+
+uint32_t BulkinAllocator::findMemoryType(uint32_t typeFilter,
+                                         vk::MemoryPropertyFlags properties) {
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+    if ((typeFilter & (1 << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("failed to find suitable memory type!");
+}
+
+uint32_t BulkinAllocator::findPool(AllocationCategory category,
+                                   uint32_t memoryType) {
+  for (uint32_t i = 0; i < pools.size(); i++) {
+    if (pools[i].category == category && pools[i].memoryType == memoryType)
+      return i;
+  }
+
+  Pool pool{};
+  pool.category = category;
+  pool.memoryType = memoryType;
+  pool.linear = category == AllocationCategory::Staging;
+  pools.push_back(std::move(pool));
+  return static_cast<uint32_t>(pools.size() - 1);
+}
+
+uint32_t BulkinAllocator::createBlock(Pool &pool, vk::DeviceSize size,
+                                      bool dedicated) {
+  vk::MemoryAllocateInfo allocInfo{};
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = pool.memoryType;
+
+  Block block{};
+  block.memory = device.allocateMemory(allocInfo);
+  block.size = size;
+  block.dedicated = dedicated;
+  if (dedicated)
+    block.head = size;
+  else if (!pool.linear)
+    block.freeRanges[0] = size;
+
+  // host visible blocks stay mapped for their whole lifetime, allocations
+  // just point into the mapping
+  if (memoryProperties.memoryTypes[pool.memoryType].propertyFlags &
+      vk::MemoryPropertyFlagBits::eHostVisible)
+    block.mapped =
+        static_cast<char *>(device.mapMemory(block.memory, 0, vk::WholeSize));
+
+  // reuse the slot of a released dedicated block so the indices held by live
+  // allocations stay valid
+  for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+    if (!pool.blocks[i].memory) {
+      pool.blocks[i] = std::move(block);
+      return i;
+    }
+  }
+  pool.blocks.push_back(std::move(block));
+  return static_cast<uint32_t>(pool.blocks.size() - 1);
+}
+
+bool BulkinAllocator::allocateFromBlock(
+    Pool &pool, Block &block, const vk::MemoryRequirements &requirements,
+    vk::DeviceSize &offset) {
+  auto alignment = std::max<vk::DeviceSize>(requirements.alignment, 1);
+
+  if (pool.linear) {
+    auto aligned = (block.head + alignment - 1) / alignment * alignment;
+    if (aligned + requirements.size > block.size)
+      return false;
+    offset = aligned;
+    block.head = aligned + requirements.size;
+    return true;
+  }
+
+  for (auto it = block.freeRanges.begin(); it != block.freeRanges.end();
+       it++) {
+    auto [rangeOffset, rangeSize] = *it;
+    auto aligned = (rangeOffset + alignment - 1) / alignment * alignment;
+    auto end = aligned + requirements.size;
+    if (end > rangeOffset + rangeSize)
+      continue;
+
+    // whatever is left in front of and behind the allocation stays free
+    block.freeRanges.erase(it);
+    if (aligned > rangeOffset)
+      block.freeRanges[rangeOffset] = aligned - rangeOffset;
+    if (end < rangeOffset + rangeSize)
+      block.freeRanges[end] = rangeOffset + rangeSize - end;
+    offset = aligned;
+    return true;
+  }
+
+  return false;
+}
+
+void BulkinAllocator::releaseBlock(Block &block) {
+  if (block.mapped)
+    device.unmapMemory(block.memory);
+  device.free(block.memory);
+  block = Block{};
+}
@@ -7,40 +7,12 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-uint32_t BulkinBuffer::findMemoryType(uint32_t typeFilter,
-                                      vk::MemoryPropertyFlags properties,
-                                      vk::PhysicalDevice device) {
-  vk::PhysicalDeviceMemoryProperties memProperties =
-      device.getMemoryProperties();
-
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-    if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags &
-                                    properties) == properties) {
-      return i;
-    }
-  }
-
-  throw std::runtime_error("failed to find suitable memory type!");
-}
-
-void BulkinBuffer::copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer,
-                              vk::DeviceSize size, vk::CommandPool &commandPool,
-                              vk::Device &device, vk::Queue &queue) {
-  auto commandBuffer = beginSingleTimeCommands(device, commandPool);
-
-  vk::BufferCopy region{};
-  region.size = size;
-  commandBuffer.copyBuffer(srcBuffer, dstBuffer, region);
-
-  endSingleTimeCommands(commandBuffer, device, queue, commandPool);
-}
-
-void BulkinBuffer::createBuffer(vk::Device &device,
-                                vk::PhysicalDevice &physicalDevice, size_t size,
-                                vk::BufferUsageFlags usage,
+void BulkinBuffer::createBuffer(vk::Device &device, BulkinAllocator &allocator,
+                                size_t size, vk::BufferUsageFlags usage,
                                 vk::MemoryPropertyFlags properties,
                                 vk::Buffer &buffer,
-                                vk::DeviceMemory &bufferMemory) {
+                                BulkinAllocation &bufferMemory,
+                                AllocationCategory category) {
   vk::BufferCreateInfo bufferInfo{};
   bufferInfo.size = size;
   bufferInfo.usage = usage;
@@ -51,234 +23,588 @@ void BulkinBuffer::createBuffer(vk::Device &device,
   vk::MemoryRequirements memRequirments =
       device.getBufferMemoryRequirements(buffer);
 
-  vk::MemoryAllocateInfo allocInfo{};
-  allocInfo.allocationSize = memRequirments.size;
-  allocInfo.memoryTypeIndex =
-      findMemoryType(memRequirments.memoryTypeBits, properties, physicalDevice);
-
-  bufferMemory = device.allocateMemory(allocInfo);
-  device.bindBufferMemory(buffer, bufferMemory, 0);
+  bufferMemory = allocator.allocate(memRequirments, properties, category);
+  device.bindBufferMemory(buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
-void BulkinBuffer::createBuffers(vk::Device &device,
-                                 vk::PhysicalDevice &physicalDevice,
-                                 vk::CommandPool &commandPool,
-                                 vk::Queue &graphicsQueue, BulkinQuad quad,
-                                 std::vector<PointLight> &pointLights,
-                                 std::vector<BulkinModel> &models) {
+void BulkinBuffer::createBuffers(vk::Device &device, BulkinAllocator &allocator,
+                                 BulkinUploader &uploader,
+                                 const BulkinQuad &quad,
+                                 std::span<const uint32_t> textureSlots,
+                                 std::span<const PointLight> pointLights,
+                                 std::span<const BulkinModel> models,
+                                 const BulkinLightmap &lightmap) {
   if (quad.getInstanceCount() > 0) {
-    createVertexBuffer(device, physicalDevice, commandPool, graphicsQueue,
-                       sizeof(quadVertices[0]) * quadVertices.size(),
-                       quadVertices, quadVertexBuffer, vertexBufferMemory);
-    createIndexBuffer(device, physicalDevice, commandPool, graphicsQueue,
-                      sizeof(quadIndices[0]) * quadIndices.size(), quadIndices,
-                      quadIndexBuffer, indexBufferMemory);
-
-    createPointLightBuffer(device, physicalDevice, commandPool, graphicsQueue,
-                           pointLights);
-  }
-  createSSBOBuffer(device, physicalDevice, commandPool, graphicsQueue, quad,
-                   models);
-  createUniformBuffers(device, physicalDevice);
-
-  modelVertexBuffers.resize(models.size());
-  modelVertexBuffersMemory.resize(models.size());
-  modelIndexBuffers.resize(models.size());
-  modelIndexBuffersMemory.resize(models.size());
-  for (size_t i = 0; i < models.size(); i++) {
-    createVertexBuffer(device, physicalDevice, commandPool, graphicsQueue,
-                       sizeof(Vertex) * models[i].getVerticesSize(),
-                       models[i].getVertices(), modelVertexBuffers[i],
-                       modelVertexBuffersMemory[i]);
-    createIndexBuffer(device, physicalDevice, commandPool, graphicsQueue,
-                      sizeof(uint32_t) * models[i].getIndicesSize(),
-                      models[i].getIndices(), modelIndexBuffers[i],
-                      modelIndexBuffersMemory[i]);
+    createDeviceLocalBuffer(device, allocator, uploader,
+                            sizeof(quadVertices[0]) * quadVertices.size(),
+                            quadVertices.data(),
+                            vk::BufferUsageFlagBits::eVertexBuffer,
+                            quadVertexBuffer, vertexBufferMemory);
+    createDeviceLocalBuffer(device, allocator, uploader,
+                            sizeof(quadIndices[0]) * quadIndices.size(),
+                            quadIndices.data(),
+                            vk::BufferUsageFlagBits::eIndexBuffer,
+                            quadIndexBuffer, indexBufferMemory);
+
+    createPointLightBuffer(device, allocator, uploader, pointLights);
   }
+  createSSBOBuffer(device, allocator, quad, textureSlots, models);
+  createCullingBuffers(device, allocator, uploader, quad);
+  createLightmapBuffers(device, allocator, quad, lightmap);
+  createUniformBuffers(device, allocator);
+  createClusterBuffers(device, allocator);
+  createModelBuffers(device, allocator, uploader, models);
+  uploader.flush();
 }
 
-void BulkinBuffer::createVertexBuffer(
-    vk::Device &device, vk::PhysicalDevice &physicalDevice,
-    vk::CommandPool &commandPool, vk::Queue &graphicsQueue, vk::DeviceSize size,
-    std::vector<Vertex> vertices, vk::Buffer &buffer,
-    vk::DeviceMemory &bufferMemory) {
-  vk::Buffer stagingBuffer;
-  vk::DeviceMemory stagingBufferMemory;
-
-  createBuffer(device, physicalDevice, size,
-               vk::BufferUsageFlagBits::eTransferSrc,
-               vk::MemoryPropertyFlagBits::eHostVisible |
-                   vk::MemoryPropertyFlagBits::eHostCoherent,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data = device.mapMemory(stagingBufferMemory, 0, size);
-  memcpy(data, vertices.data(), size);
-  device.unmapMemory(stagingBufferMemory);
-
-  createBuffer(device, physicalDevice, size,
-               vk::BufferUsageFlagBits::eTransferDst |
-                   vk::BufferUsageFlagBits::eVertexBuffer,
-               vk::MemoryPropertyFlagBits::eDeviceLocal, buffer, bufferMemory);
+void BulkinBuffer::createModelBuffers(vk::Device &device,
+                                      BulkinAllocator &allocator,
+                                      BulkinUploader &uploader,
+                                      std::span<const BulkinModel> models) {
+  modelDrawCount = static_cast<uint32_t>(models.size());
+  if (modelDrawCount == 0)
+    return;
+
+  // every model mesh lives in one shared vertex/index arena and is addressed
+  // by its offsets, so all of them go out in a single indirect draw
+  std::vector<vk::DrawIndexedIndirectCommand> drawCommands(modelDrawCount);
+  modelRanges.resize(modelDrawCount);
+  uint32_t vertexCount = 0;
+  uint32_t indexCount = 0;
+
+  for (uint32_t i = 0; i < modelDrawCount; i++) {
+    auto &range = modelRanges[i];
+    range.firstIndex = indexCount;
+    range.indexCount = models[i].getIndicesSize();
+    range.vertexOffset = static_cast<int32_t>(vertexCount);
+    vertexCount += models[i].getVerticesSize();
+    indexCount += range.indexCount;
+
+    drawCommands[i].indexCount = range.indexCount;
+    drawCommands[i].instanceCount = 1;
+    drawCommands[i].firstIndex = range.firstIndex;
+    drawCommands[i].vertexOffset = range.vertexOffset;
+    drawCommands[i].firstInstance = i;
+  }
 
-  copyBuffer(stagingBuffer, buffer, size, commandPool, device, graphicsQueue);
-  device.destroy(stagingBuffer);
-  device.free(stagingBufferMemory);
+  createBuffer(device, allocator, sizeof(Vertex) * vertexCount,
+               vk::BufferUsageFlagBits::eVertexBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, modelVertexBuffer,
+               modelVertexBufferMemory);
+  createBuffer(device, allocator, sizeof(uint32_t) * indexCount,
+               vk::BufferUsageFlagBits::eIndexBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, modelIndexBuffer,
+               modelIndexBufferMemory);
+
+  // the meshes are read straight out of their mapped cooked files into the
+  // staging ring, each at its place in the arena
+  for (uint32_t i = 0; i < modelDrawCount; i++) {
+    auto vertices = models[i].getVertices();
+    auto indices = models[i].getIndices();
+    uploader.uploadBuffer(vertices.data(), vertices.size_bytes(),
+                          modelVertexBuffer,
+                          sizeof(Vertex) * modelRanges[i].vertexOffset);
+    uploader.uploadBuffer(indices.data(), indices.size_bytes(),
+                          modelIndexBuffer,
+                          sizeof(uint32_t) * modelRanges[i].firstIndex);
+  }
+  createDeviceLocalBuffer(
+      device, allocator, uploader,
+      sizeof(vk::DrawIndexedIndirectCommand) * drawCommands.size(),
+      drawCommands.data(),
+      vk::BufferUsageFlagBits::eIndirectBuffer |
+          vk::BufferUsageFlagBits::eStorageBuffer,
+      modelDrawCommandBuffer, modelDrawCommandBufferMemory);
+  createOcclusionBuffers(device, allocator, uploader, models);
 }
 
-void BulkinBuffer::createIndexBuffer(
-    vk::Device &device, vk::PhysicalDevice &physicalDevice,
-    vk::CommandPool &commandPool, vk::Queue &graphicsQueue, vk::DeviceSize size,
-    std::vector<uint32_t> indices, vk::Buffer &buffer,
-    vk::DeviceMemory &bufferMemory) {
-  vk::Buffer stagingBuffer;
-  vk::DeviceMemory stagingBufferMemory;
-
-  createBuffer(device, physicalDevice, size,
-               vk::BufferUsageFlagBits::eTransferSrc,
-               vk::MemoryPropertyFlagBits::eHostVisible |
-                   vk::MemoryPropertyFlagBits::eHostCoherent,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data = device.mapMemory(stagingBufferMemory, 0, size);
-  memcpy(data, indices.data(), size);
-  device.unmapMemory(stagingBufferMemory);
-
-  createBuffer(device, physicalDevice, size,
-               vk::BufferUsageFlagBits::eTransferDst |
-                   vk::BufferUsageFlagBits::eIndexBuffer,
-               vk::MemoryPropertyFlagBits::eDeviceLocal, buffer, bufferMemory);
+void BulkinBuffer::createOcclusionBuffers(vk::Device &device,
+                                          BulkinAllocator &allocator,
+                                          BulkinUploader &uploader,
+                                          std::span<const BulkinModel> models) {
+  // a sphere around the mesh's box, the culling pass scales it by the largest
+  // axis of the model matrix
+  std::vector<glm::vec4> bounds(models.size());
+  for (size_t i = 0; i < models.size(); i++) {
+    auto vertices = models[i].getVertices();
+    if (vertices.empty())
+      continue;
+    glm::vec3 low = vertices[0].pos, high = vertices[0].pos;
+    for (const auto &vertex : vertices) {
+      low = glm::min(low, vertex.pos);
+      high = glm::max(high, vertex.pos);
+    }
+    bounds[i] = glm::vec4((low + high) * 0.5f, glm::length(high - low) * 0.5f);
+  }
+  createDeviceLocalBuffer(device, allocator, uploader,
+                          sizeof(glm::vec4) * bounds.size(), bounds.data(),
+                          vk::BufferUsageFlagBits::eStorageBuffer,
+                          modelBoundsBuffer, modelBoundsBufferMemory);
+
+  auto drawsSize = sizeof(vk::DrawIndexedIndirectCommand) * models.size();
+  modelDrawCountBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  modelDrawCountBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  earlyModelDrawBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  earlyModelDrawBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  lateModelDrawBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  lateModelDrawBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  modelRetestBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  modelRetestBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
-  copyBuffer(stagingBuffer, buffer, size, commandPool, device, graphicsQueue);
-  device.destroy(stagingBuffer);
-  device.free(stagingBufferMemory);
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    createBuffer(device, allocator, 2 * sizeof(uint32_t),
+                 vk::BufferUsageFlagBits::eStorageBuffer |
+                     vk::BufferUsageFlagBits::eIndirectBuffer |
+                     vk::BufferUsageFlagBits::eTransferDst,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal,
+                 modelDrawCountBuffers[i], modelDrawCountBuffersMemory[i]);
+    createBuffer(device, allocator, drawsSize,
+                 vk::BufferUsageFlagBits::eStorageBuffer |
+                     vk::BufferUsageFlagBits::eIndirectBuffer,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal,
+                 earlyModelDrawBuffers[i], earlyModelDrawBuffersMemory[i]);
+    createBuffer(device, allocator, drawsSize,
+                 vk::BufferUsageFlagBits::eStorageBuffer |
+                     vk::BufferUsageFlagBits::eIndirectBuffer,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal,
+                 lateModelDrawBuffers[i], lateModelDrawBuffersMemory[i]);
+    createBuffer(device, allocator, sizeof(uint32_t) * models.size(),
+                 vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal,
+                 modelRetestBuffers[i], modelRetestBuffersMemory[i]);
+  }
 }
 
 void BulkinBuffer::createUniformBuffers(vk::Device &device,
-                                        vk::PhysicalDevice &physicalDevice) {
+                                        BulkinAllocator &allocator) {
   vk::DeviceSize size = sizeof(UniformBufferObject);
   uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
   uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-  uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
 
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    createBuffer(device, physicalDevice, size,
+    createBuffer(device, allocator, size,
                  vk::BufferUsageFlagBits::eUniformBuffer,
                  vk::MemoryPropertyFlagBits::eHostVisible |
                      vk::MemoryPropertyFlagBits::eHostCoherent,
                  uniformBuffers[i], uniformBuffersMemory[i]);
-    uniformBuffersMapped[i] =
-        device.mapMemory(uniformBuffersMemory[i], 0, size);
   }
 }
 
 void BulkinBuffer::createPointLightBuffer(
-    vk::Device &device, vk::PhysicalDevice &physicalDevice,
-    vk::CommandPool &commandPool, vk::Queue &graphicsQueue,
-    std::vector<PointLight> &pointLights) {
-  vk::Buffer stagingBuffer;
-  vk::DeviceMemory stagingBufferMemory;
-  vk::DeviceSize pointLightBufferSize =
-      sizeof(pointLights[0]) * pointLights.size();
-
-  createBuffer(device, physicalDevice, pointLightBufferSize,
-               vk::BufferUsageFlagBits::eTransferSrc,
-               vk::MemoryPropertyFlagBits::eHostVisible |
-                   vk::MemoryPropertyFlagBits::eHostCoherent,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data = device.mapMemory(stagingBufferMemory, 0, pointLightBufferSize);
-  memcpy(data, pointLights.data(), pointLightBufferSize);
-  device.unmapMemory(stagingBufferMemory);
-
-  createBuffer(device, physicalDevice, pointLightBufferSize,
-               vk::BufferUsageFlagBits::eTransferDst |
-                   vk::BufferUsageFlagBits::eStorageBuffer,
-               vk::MemoryPropertyFlagBits::eDeviceLocal, pointLightBuffer,
-               pointLightBufferMemory);
-
-  copyBuffer(stagingBuffer, pointLightBuffer, pointLightBufferSize, commandPool,
-             device, graphicsQueue);
-  device.destroy(stagingBuffer);
-  device.free(stagingBufferMemory);
+    vk::Device &device, BulkinAllocator &allocator,
+    BulkinUploader &uploader, std::span<const PointLight> pointLights) {
+  createDeviceLocalBuffer(device, allocator, uploader,
+                          sizeof(pointLights[0]) * pointLights.size(),
+                          pointLights.data(),
+                          vk::BufferUsageFlagBits::eStorageBuffer,
+                          pointLightBuffer, pointLightBufferMemory);
 }
 
 void BulkinBuffer::createSSBOBuffer(vk::Device &device,
-                                    vk::PhysicalDevice &physicalDevice,
-                                    vk::CommandPool &commandPool,
-                                    vk::Queue &graphicsQueue, BulkinQuad quad,
-                                    std::vector<BulkinModel> &models) {
+                                    BulkinAllocator &allocator,
+                                    const BulkinQuad &quad,
+                                    std::span<const uint32_t> textureSlots,
+                                    std::span<const BulkinModel> models) {
   if (quad.getInstanceCount() == 0)
     std::runtime_error("no quads drawn");
-  vk::Buffer stagingBuffer;
-  vk::DeviceMemory stagingBufferMemory;
+
+  this->textureSlots.assign(textureSlots.begin(), textureSlots.end());
+
+  auto instances = quad.getInstances();
+  quadInstances.resize(instances.size());
+  for (size_t i = 0; i < instances.size(); i++)
+    quadInstances[i] = remapQuad(instances[i]);
+
+  createInstanceBuffers(device, allocator,
+                        sizeof(PerInstanceData) * quadInstances.size(),
+                        quadInstances.data(), ssboBuffers, ssboBuffersMemory);
+
+  // always at least one entry so the descriptor has something to point at
+  // when the scene has no models
+  modelInstances.assign(std::max<size_t>(models.size(), 1),
+                        ModelInstanceData{});
+  for (size_t i = 0; i < models.size(); i++)
+    modelInstances[i] =
+        modelInstance(models[i].modelMatrix(), models[i].getTextureId());
+
+  createInstanceBuffers(device, allocator,
+                        sizeof(ModelInstanceData) * modelInstances.size(),
+                        modelInstances.data(), modelInstanceBuffers,
+                        modelInstanceBuffersMemory);
+}
+
+void BulkinBuffer::createInstanceBuffers(
+    vk::Device &device, BulkinAllocator &allocator, vk::DeviceSize size,
+    const void *contents, std::vector<vk::Buffer> &buffers,
+    std::vector<BulkinAllocation> &buffersMemory) {
+  // instances are read every frame, so they go into device local memory when
+  // it can be mapped and into plain host memory otherwise
+  vk::MemoryPropertyFlags properties =
+      vk::MemoryPropertyFlagBits::eHostVisible |
+      vk::MemoryPropertyFlagBits::eHostCoherent;
+  if (allocator.supports(properties | vk::MemoryPropertyFlagBits::eDeviceLocal))
+    properties |= vk::MemoryPropertyFlagBits::eDeviceLocal;
+
+  buffers.resize(MAX_FRAMES_IN_FLIGHT);
+  buffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    createBuffer(device, allocator, size,
+                 vk::BufferUsageFlagBits::eStorageBuffer, properties,
+                 buffers[i], buffersMemory[i]);
+    memcpy(buffersMemory[i].mapped, contents, size);
+  }
+}
+
+PerInstanceData BulkinBuffer::remapQuad(PerInstanceData instance) {
+  // the shaders see texture slots, not the ids handed out by addTexture
+  constexpr uint32_t textureMask = ((1u << INSTANCE_TEXTURE_BITS) - 1)
+                                   << INSTANCE_FACE_BITS;
+  auto textureId = (instance.packed & textureMask) >> INSTANCE_FACE_BITS;
+  if (textureId >= textureSlots.size())
+    throw std::runtime_error("quad texture was never added");
+  instance.packed = (instance.packed & ~textureMask) |
+                    (textureSlots[textureId] << INSTANCE_FACE_BITS);
+  return instance;
+}
+
+ModelInstanceData BulkinBuffer::modelInstance(const glm::mat4 &matrix,
+                                              uint32_t textureId) {
+  if (textureId >= textureSlots.size())
+    throw std::runtime_error("model texture was never added");
+
+  ModelInstanceData instance{};
+  instance.model = matrix;
+  instance.normalMatrix =
+      glm::mat4(glm::transpose(glm::inverse(glm::mat3(matrix))));
+  instance.textureIndex = textureSlots[textureId];
+  return instance;
+}
+
+void BulkinBuffer::updateQuad(uint32_t quad, const PerInstanceData &instance,
+                              uint32_t region, bool moved) {
+  if (quad >= quadInstances.size())
+    throw std::runtime_error("invalid quad handle");
+
+  quadInstances[quad] = remapQuad(instance);
+  // a region past the bits the culling pass reads is drawn from everywhere
+  quadRegions[quad] = region / 32 < visibleRegionWords ? region : PVS_NO_REGION;
+  if (moved)
+    lightmapRects[quad] = glm::vec4(0.0f);
+  for (auto &ranges : dirtyQuads)
+    markDirty(ranges, quad);
+}
+
+void BulkinBuffer::updateModel(uint32_t model, const glm::mat4 &matrix,
+                               uint32_t textureId) {
+  if (model >= modelDrawCount)
+    throw std::runtime_error("invalid model handle");
+
+  modelInstances[model] = modelInstance(matrix, textureId);
+  for (auto &ranges : dirtyModels)
+    markDirty(ranges, model);
+}
+
+void BulkinBuffer::flushInstanceUpdates(uint32_t currentFrame) {
+  // called once the frame's fence has signalled, so nothing reads this frame's
+  // buffers while they are written
+  auto &quads = dirtyQuads[currentFrame];
+  auto &models = dirtyModels[currentFrame];
+  copyDirty(quads, quadInstances.data(), ssboBuffersMemory[currentFrame].mapped,
+            sizeof(PerInstanceData));
+  // a moved quad can change region and lose its lightmap rectangle, so both
+  // follow the same ranges
+  copyDirty(quads, quadRegions.data(),
+            quadRegionBuffersMemory[currentFrame].mapped, sizeof(uint32_t));
+  copyDirty(quads, lightmapRects.data(),
+            lightmapRectBuffersMemory[currentFrame].mapped, sizeof(glm::vec4));
+  copyDirty(models, modelInstances.data(),
+            modelInstanceBuffersMemory[currentFrame].mapped,
+            sizeof(ModelInstanceData));
+  // clear keeps the capacity, so steady state updates do not allocate
+  quads.clear();
+  models.clear();
+}
+
+void BulkinBuffer::markDirty(std::vector<DirtyRange> &ranges, uint32_t index) {
+  // updates tend to come in runs over neighbouring handles, so they usually
+  // grow the last range instead of adding one
+  if (!ranges.empty()) {
+    auto &last = ranges.back();
+    if (index + 1 >= last.begin && index <= last.end) {
+      last.begin = std::min(last.begin, index);
+      last.end = std::max(last.end, index + 1);
+      return;
+    }
+  }
+  ranges.push_back({index, index + 1});
+}
+
+void BulkinBuffer::copyDirty(const std::vector<DirtyRange> &ranges,
+                             const void *source, void *destination,
+                             size_t stride) {
+  for (const auto &range : ranges) {
+    memcpy(static_cast<char *>(destination) + range.begin * stride,
+           static_cast<const char *>(source) + range.begin * stride,
+           (range.end - range.begin) * stride);
+  }
+}
+
+void BulkinBuffer::createClusterBuffers(vk::Device &device,
+                                        BulkinAllocator &allocator) {
+  // a light count per cluster followed by a fixed-size index list per
+  // cluster, rewritten every frame by the cluster pass
   vk::DeviceSize size =
-      sizeof(PerInstanceData) * (quad.getInstanceCount() + models.size());
-
-  createBuffer(device, physicalDevice, size,
-               vk::BufferUsageFlagBits::eTransferSrc,
-               vk::MemoryPropertyFlagBits::eHostVisible |
-                   vk::MemoryPropertyFlagBits::eHostCoherent,
-               stagingBuffer, stagingBufferMemory);
-
-  std::vector<PerInstanceData> perInstanceData;
-  perInstanceData.resize(quad.getInstanceCount() + models.size());
-  for (size_t i = 0; i < quad.getInstanceCount(); i++) {
-    perInstanceData[i] = quad.getInstanceData(i);
+      sizeof(uint32_t) * CLUSTER_COUNT * (1 + MAX_LIGHTS_PER_CLUSTER);
+  clusterLightBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  clusterLightBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+  clusterOverflowBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  clusterOverflowBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    createBuffer(device, allocator, size,
+                 vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal,
+                 clusterLightBuffers[i], clusterLightBuffersMemory[i]);
+    createBuffer(device, allocator, sizeof(ClusterOverflow),
+                 vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 clusterOverflowBuffers[i], clusterOverflowBuffersMemory[i]);
+    memset(clusterOverflowBuffersMemory[i].mapped, 0,
+           sizeof(ClusterOverflow));
+  }
+}
+
+void BulkinBuffer::createCullingBuffers(vk::Device &device,
+                                        BulkinAllocator &allocator,
+                                        BulkinUploader &uploader,
+                                        const BulkinQuad &quad) {
+  auto instanceCount = quad.getInstanceCount();
+
+  // the visible list starts out as the identity so the non-culled path
+  // indexes straight into the instance SSBO. the culling pass packs the
+  // depth buckets back to back into it and sets each draw's first instance,
+  // the slots hold every quad's place in its bucket in between
+  std::vector<uint32_t> identity(std::max(instanceCount, 1u), 0);
+  for (uint32_t i = 0; i < instanceCount; i++)
+    identity[i] = i;
+
+  CulledDrawCommand drawCommand{};
+  for (uint32_t bucket = 0; bucket < CULL_DEPTH_BUCKETS; bucket++)
+    drawCommand.commands[bucket].indexCount =
+        static_cast<uint32_t>(quadIndices.size());
+
+  visibleBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  visibleBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  cullSlotBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  cullSlotBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  drawCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  drawCommandBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    createDeviceLocalBuffer(
+        device, allocator, uploader,
+        sizeof(uint32_t) * identity.size(), identity.data(),
+        vk::BufferUsageFlagBits::eStorageBuffer, visibleBuffers[i],
+        visibleBuffersMemory[i]);
+    createBuffer(device, allocator, sizeof(uint32_t) * identity.size(),
+                 vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal, cullSlotBuffers[i],
+                 cullSlotBuffersMemory[i]);
+    createDeviceLocalBuffer(device, allocator, uploader,
+                            sizeof(CulledDrawCommand), &drawCommand,
+                            vk::BufferUsageFlagBits::eStorageBuffer |
+                                vk::BufferUsageFlagBits::eIndirectBuffer,
+                            drawCommandBuffers[i], drawCommandBuffersMemory[i]);
+  }
+
+  // the region bits cover every region a quad refers to and start out all
+  // set, which draws everything until a camera region is known
+  auto regions = quad.getRegions();
+  uint32_t regionCount = 0;
+  for (auto region : regions) {
+    if (region != PVS_NO_REGION)
+      regionCount = std::max(regionCount, region + 1);
   }
-  for (size_t i = quad.getInstanceCount();
-       i < quad.getInstanceCount() + models.size(); i++) {
-    perInstanceData[i] = PerInstanceData{
-        .model = models[i - quad.getInstanceCount()].modelMatrix(),
-        .faceId = 0,
-        .textureIndex = models[i - quad.getInstanceCount()].getTextureId()};
+  visibleRegionWords = std::max((regionCount + 31) / 32, 1u);
+
+  // moved quads are retagged, so the regions are streamed like the instances
+  quadRegions.assign(regions.begin(), regions.end());
+  if (quadRegions.empty())
+    quadRegions.push_back(PVS_NO_REGION);
+  createInstanceBuffers(device, allocator,
+                        sizeof(uint32_t) * quadRegions.size(),
+                        quadRegions.data(), quadRegionBuffers,
+                        quadRegionBuffersMemory);
+
+  visibleRegionBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  visibleRegionBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    createBuffer(device, allocator, sizeof(uint32_t) * visibleRegionWords,
+                 vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 visibleRegionBuffers[i], visibleRegionBuffersMemory[i]);
+    auto bits = visibleRegions(static_cast<uint32_t>(i));
+    std::fill(bits.begin(), bits.end(), ~0u);
   }
+}
 
-  void *data = device.mapMemory(stagingBufferMemory, 0, size);
-  memcpy(data, perInstanceData.data(), size);
-  device.unmapMemory(stagingBufferMemory);
+void BulkinBuffer::createLightmapBuffers(vk::Device &device,
+                                         BulkinAllocator &allocator,
+                                         const BulkinQuad &quad,
+                                         const BulkinLightmap &lightmap) {
+  // the baked faces are a run of quads, every other quad keeps a zero
+  // rectangle and with it only the light loop
+  lightmapRects.assign(std::max(quad.getInstanceCount(), 1u),
+                       glm::vec4(0.0f));
+  const auto &baked = lightmap.getRects();
+  if (!lightmap.empty() &&
+      lightmap.getFirstQuad() + baked.size() > quad.getInstanceCount())
+    throw std::runtime_error("lightmap faces past the last quad");
+  std::copy(baked.begin(), baked.end(),
+            lightmapRects.begin() + lightmap.getFirstQuad());
+  firstBakedLight = lightmap.getFirstLight();
+  bakedLightCount = lightmap.getLightCount();
+
+  // moved quads drop their rectangle, so they are streamed like the instances
+  createInstanceBuffers(device, allocator,
+                        sizeof(glm::vec4) * lightmapRects.size(),
+                        lightmapRects.data(), lightmapRectBuffers,
+                        lightmapRectBuffersMemory);
+}
 
-  createBuffer(device, physicalDevice, size,
-               vk::BufferUsageFlagBits::eTransferDst |
-                   vk::BufferUsageFlagBits::eStorageBuffer,
-               vk::MemoryPropertyFlagBits::eDeviceLocal, ssboBuffer,
-               ssboBufferMemory);
+std::span<uint32_t> BulkinBuffer::visibleRegions(uint32_t currentFrame) {
+  return {static_cast<uint32_t *>(
+              visibleRegionBuffersMemory[currentFrame].mapped),
+          visibleRegionWords};
+}
 
-  copyBuffer(stagingBuffer, ssboBuffer, size, commandPool, device,
-             graphicsQueue);
-  device.destroy(stagingBuffer);
-  device.free(stagingBufferMemory);
+ClusterOverflow BulkinBuffer::takeClusterOverflow(uint32_t currentFrame) {
+  auto mapped = clusterOverflowBuffersMemory[currentFrame].mapped;
+  ClusterOverflow overflow;
+  memcpy(&overflow, mapped, sizeof(overflow));
+  memset(mapped, 0, sizeof(overflow));
+  return overflow;
+}
+
+void BulkinBuffer::createDeviceLocalBuffer(
+    vk::Device &device, BulkinAllocator &allocator,
+    BulkinUploader &uploader, vk::DeviceSize size, const void *contents,
+    vk::BufferUsageFlags usage, vk::Buffer &buffer,
+    BulkinAllocation &bufferMemory) {
+  createBuffer(device, allocator, size,
+               usage | vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, buffer, bufferMemory);
+
+  // the copy is only recorded here, it reaches the GPU with the rest of the
+  // batch when the uploader is flushed
+  if (contents)
+    uploader.uploadBuffer(contents, size, buffer);
+  else
+    uploader.commandBuffer().fillBuffer(buffer, 0, vk::WholeSize, 0);
+}
+
+void BulkinBuffer::extractFrustumPlanes(const glm::mat4 &viewProj,
+                                        glm::vec4 (&planes)[6]) {
+  glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0],
+                 viewProj[3][0]);
+  glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1],
+                 viewProj[3][1]);
+  glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2],
+                 viewProj[3][2]);
+  glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3],
+                 viewProj[3][3]);
+
+  planes[0] = row3 + row0;
+  planes[1] = row3 - row0;
+  planes[2] = row3 + row1;
+  planes[3] = row3 - row1;
+  planes[4] = row3 + row2;
+  planes[5] = row3 - row2;
+
+  for (auto &plane : planes)
+    plane /= glm::length(glm::vec3(plane));
 }
 
 void BulkinBuffer::updateUniformBuffer(uint32_t currentImage, float width,
-                                       float height, BulkinCamera &camera) {
+                                       float height, const glm::mat4 &view,
+                                       const glm::vec3 &viewPos) {
+  constexpr float nearPlane = 0.1f;
+  constexpr float farPlane = 100.0f;
+
   UniformBufferObject ubo{};
-  ubo.view = camera.getView();
-  ubo.proj =
-      glm::perspective(glm::radians(45.0f), width / height, 0.1f, 100.0f);
+  ubo.view = view;
+  ubo.proj = glm::perspective(glm::radians(FIELD_OF_VIEW), width / height,
+                              nearPlane, farPlane);
   ubo.proj[1][1] *= -1;
-  ubo.viewPos = camera.getPosition();
-  memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+  ubo.viewPos = viewPos;
+  extractFrustumPlanes(ubo.proj * ubo.view, ubo.frustumPlanes);
+  ubo.screenSize = glm::vec2(width, height);
+  ubo.nearPlane = nearPlane;
+  ubo.farPlane = farPlane;
+  ubo.wallHeight = wallHeight;
+  ubo.firstBakedLight = firstBakedLight;
+  ubo.bakedLightCount = bakedLightCount;
+  memcpy(uniformBuffersMemory[currentImage].mapped, &ubo, sizeof(ubo));
 }
 
-void BulkinBuffer::cleanup(vk::Device &device) {
-  for (size_t i = 0; i < modelVertexBuffers.size(); i++) {
-    device.destroy(modelVertexBuffers[i]);
-    device.destroy(modelIndexBuffers[i]);
-    device.free(modelVertexBuffersMemory[i]);
-    device.free(modelIndexBuffersMemory[i]);
-  }
+void BulkinBuffer::cleanup(vk::Device &device, BulkinAllocator &allocator) {
+  device.destroy(modelVertexBuffer);
+  allocator.free(modelVertexBufferMemory);
+  device.destroy(modelIndexBuffer);
+  allocator.free(modelIndexBufferMemory);
+  device.destroy(modelDrawCommandBuffer);
+  allocator.free(modelDrawCommandBufferMemory);
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
     device.destroy(uniformBuffers[i]);
-    device.free(uniformBuffersMemory[i]);
+    allocator.free(uniformBuffersMemory[i]);
+    device.destroy(visibleBuffers[i]);
+    allocator.free(visibleBuffersMemory[i]);
+    device.destroy(cullSlotBuffers[i]);
+    allocator.free(cullSlotBuffersMemory[i]);
+    device.destroy(drawCommandBuffers[i]);
+    allocator.free(drawCommandBuffersMemory[i]);
+    device.destroy(clusterLightBuffers[i]);
+    allocator.free(clusterLightBuffersMemory[i]);
+    device.destroy(clusterOverflowBuffers[i]);
+    allocator.free(clusterOverflowBuffersMemory[i]);
+    device.destroy(visibleRegionBuffers[i]);
+    allocator.free(visibleRegionBuffersMemory[i]);
+    device.destroy(quadRegionBuffers[i]);
+    allocator.free(quadRegionBuffersMemory[i]);
+    device.destroy(lightmapRectBuffers[i]);
+    allocator.free(lightmapRectBuffersMemory[i]);
+  }
+  if (modelDrawCount > 0) {
+    device.destroy(modelBoundsBuffer);
+    allocator.free(modelBoundsBufferMemory);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      device.destroy(modelDrawCountBuffers[i]);
+      allocator.free(modelDrawCountBuffersMemory[i]);
+      device.destroy(earlyModelDrawBuffers[i]);
+      allocator.free(earlyModelDrawBuffersMemory[i]);
+      device.destroy(lateModelDrawBuffers[i]);
+      allocator.free(lateModelDrawBuffersMemory[i]);
+      device.destroy(modelRetestBuffers[i]);
+      allocator.free(modelRetestBuffersMemory[i]);
+    }
   }
   device.destroy(pointLightBuffer);
-  device.free(pointLightBufferMemory);
-  device.destroy(ssboBuffer);
-  device.free(ssboBufferMemory);
+  allocator.free(pointLightBufferMemory);
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    device.destroy(ssboBuffers[i]);
+    allocator.free(ssboBuffersMemory[i]);
+    device.destroy(modelInstanceBuffers[i]);
+    allocator.free(modelInstanceBuffersMemory[i]);
+  }
   device.destroy(quadVertexBuffer);
-  device.free(vertexBufferMemory);
+  allocator.free(vertexBufferMemory);
   device.destroy(quadIndexBuffer);
-  device.free(indexBufferMemory);
+  allocator.free(indexBufferMemory);
 }
 
 vk::CommandBuffer
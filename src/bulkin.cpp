@@ -1,7 +1,11 @@
 #include "bulkin.h"
 
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <glm/gtc/constants.hpp>
 #include <print>
+#include <thread>
 
 void Bulkin::run() {
   initWindow();
@@ -10,6 +14,92 @@ void Bulkin::run() {
   cleanup();
 }
 
+BenchmarkResult Bulkin::runBenchmark(uint32_t frameCount, uint32_t width,
+                                     uint32_t height) {
+  headless = true;
+  offscreenExtent = vk::Extent2D(width, height);
+  initVulkan();
+
+  std::vector<glm::vec2> path;
+  if (currentLevel)
+    path = currentLevel->cameraPath();
+  const float eyeHeight = camera.getPosition().y;
+
+  std::vector<double> frameTimes;
+  frameTimes.reserve(frameCount);
+  for (uint32_t frame = 0; frame < frameCount; frame++) {
+    updateBenchmarkCamera(path, eyeHeight, frame, frameCount);
+    publishSnapshot();
+    auto start = std::chrono::steady_clock::now();
+    drawOffscreenFrame();
+    auto end = std::chrono::steady_clock::now();
+    frameTimes.push_back(
+        std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  device.device.waitIdle();
+
+  BenchmarkResult result{};
+  result.frames = frameCount;
+  if (!frameTimes.empty()) {
+    double total = 0.0;
+    for (auto time : frameTimes)
+      total += time;
+    result.avgMilliseconds = total / static_cast<double>(frameTimes.size());
+    result.minMilliseconds =
+        *std::min_element(frameTimes.begin(), frameTimes.end());
+    result.maxMilliseconds =
+        *std::max_element(frameTimes.begin(), frameTimes.end());
+    auto p99 = frameTimes.begin() + (frameTimes.size() - 1) * 99 / 100;
+    std::nth_element(frameTimes.begin(), p99, frameTimes.end());
+    result.p99Milliseconds = *p99;
+  }
+
+  std::println("benchmark: {} frames at {}x{}", result.frames, width, height);
+  std::println("  avg {} ms, min {} ms, p99 {} ms, max {} ms",
+               result.avgMilliseconds, result.minMilliseconds,
+               result.p99Milliseconds, result.maxMilliseconds);
+  for (uint32_t category = 0; category < ALLOCATION_CATEGORY_COUNT;
+       category++) {
+    auto statistics =
+        getMemoryStatistics(static_cast<AllocationCategory>(category));
+    if (statistics.blockCount == 0)
+      continue;
+    std::println("  {} memory {} KiB live in {} allocations, {} KiB in {} "
+                 "blocks, {:.1f}% fragmented",
+                 BulkinAllocator::categoryName(
+                     static_cast<AllocationCategory>(category)),
+                 statistics.liveBytes / 1024, statistics.allocationCount,
+                 statistics.blockBytes / 1024, statistics.blockCount,
+                 100.0 * statistics.fragmentation);
+  }
+
+  cleanup();
+  return result;
+}
+
+void Bulkin::updateBenchmarkCamera(const std::vector<glm::vec2> &path,
+                                   float eyeHeight, uint32_t frame,
+                                   uint32_t frameCount) {
+  if (path.size() < 2) {
+    // no level to walk through, orbit the origin instead
+    float angle = glm::two_pi<float>() * static_cast<float>(frame) /
+                  static_cast<float>(frameCount);
+    glm::vec3 pos(3.0f * std::cos(angle), eyeHeight, 3.0f * std::sin(angle));
+    camera.setPose(pos, glm::vec3(0.0f, eyeHeight, 0.0f));
+    return;
+  }
+
+  float t = static_cast<float>(frame) / static_cast<float>(frameCount) *
+            static_cast<float>(path.size() - 1);
+  size_t segment = std::min(static_cast<size_t>(t), path.size() - 2);
+  auto from = path[segment];
+  auto to = path[segment + 1];
+  auto pos = glm::mix(from, to, t - static_cast<float>(segment));
+  auto target = pos + (to - from);
+  camera.setPose(glm::vec3(pos.x, eyeHeight, pos.y),
+                 glm::vec3(target.x, eyeHeight, target.y));
+}
+
 void Bulkin::initWindow() {
   glfwInit();
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -58,33 +148,94 @@ void Bulkin::key_callback(GLFWwindow *window, int key, int scancode, int action,
 
 void Bulkin::initVulkan() {
   createInstance();
-  device.createSurface(instance, window);
-  device.pickPhysicalDevice(instance);
-  device.createLogicalDevice();
-  device.createSwapchain(window);
-  device.createGraphicsPipeline(quad, textures, pointLights, models);
+  if (headless) {
+    device.headless = true;
+    device.pickPhysicalDevice(instance);
+    device.createLogicalDevice();
+    device.createOffscreenTargets(offscreenExtent.width,
+                                  offscreenExtent.height);
+  } else {
+    device.createSurface(instance, window);
+    device.pickPhysicalDevice(instance);
+    device.createLogicalDevice();
+    device.createSwapchain(window);
+  }
+  // quads outside a level keep the dynamic lighting, and without a level
+  // nothing casts shadows
+  device.createGraphicsPipeline(
+      quad, textures, pointLights, models,
+      currentLevel ? currentLevel->getLightmap() : BulkinLightmap(),
+      currentLevel ? currentLevel->wallGrid() : WallGrid());
+  sceneUploaded = true;
+  visibleRegionsFrom.fill(PVS_NO_REGION);
   createSyncObjects();
 }
 
 void Bulkin::mainLoop() {
-  while (!glfwWindowShouldClose(window)) {
-    tick(deltaTime);
-    if (showFrametime)
-      currentTime = glfwGetTime();
-    drawFrame();
-    if (showFrametime)
-      std::println("{} milliseconds", (glfwGetTime() - currentTime) * 1000);
-    glfwPollEvents();
+  // input and the camera stay on this thread, which glfw requires, while the
+  // render thread waits on fences and acquires images on its own
+  publishSnapshot();
+  stopRendering = false;
+  std::thread renderThread(&Bulkin::renderLoop, this);
+
+  while (!glfwWindowShouldClose(window) && !renderFailed) {
+    glfwWaitEventsTimeout(1.0 / SIMULATION_RATE);
+    update();
+    tick(static_cast<float>(deltaTime), renderedFrames.exchange(0));
   }
 
-  device.device.waitIdle();
+  stopRendering = true;
+  renderThread.join();
+  if (renderError)
+    std::rethrow_exception(renderError);
+}
+
+void Bulkin::renderLoop() {
+  try {
+    while (!stopRendering) {
+      if (showFrametime)
+        currentTime = glfwGetTime();
+      drawFrame();
+      renderedFrames++;
+      if (showFrametime)
+        std::println("{} milliseconds", (glfwGetTime() - currentTime) * 1000);
+      if (showFrametime && device.graphicsPipeline.gpuProfiling) {
+        for (uint32_t pass = 0; pass < PROFILER_PASS_COUNT; pass++) {
+          auto statistics = getPassStatistics(static_cast<ProfilerPass>(pass));
+          std::println(
+              "  {} gpu {} ms (min {} p99 {})",
+              BulkinProfiler::passName(static_cast<ProfilerPass>(pass)),
+              statistics.avgMilliseconds, statistics.minMilliseconds,
+              statistics.p99Milliseconds);
+        }
+      }
+    }
+    device.device.waitIdle();
+  } catch (...) {
+    renderError = std::current_exception();
+    renderFailed = true;
+  }
 }
 
 void Bulkin::drawFrame() {
+  if (swapchainStale) {
+    consumeSnapshot();
+    recreateSwapchain();
+    if (swapchainStale) {
+      std::this_thread::sleep_for(
+          std::chrono::duration<double>(1.0 / SIMULATION_RATE));
+      return;
+    }
+  }
+
   if (device.device.waitForFences(1, &drawFences[currentFrame], vk::True,
                                   UINT64_MAX) != vk::Result::eSuccess)
     throw std::runtime_error("failed to wait for fence");
 
+  if (device.graphicsPipeline.gpuProfiling)
+    device.graphicsPipeline.profiler.collect(device.device, currentFrame);
+  reportClusterOverflow();
+
   uint32_t imageIndex;
   auto result = device.device.acquireNextImageKHR(
       device.swapchain.swapchain, UINT64_MAX,
@@ -92,6 +243,7 @@ void Bulkin::drawFrame() {
 
   if (result == vk::Result::eErrorOutOfDateKHR) {
     recreateSwapchain();
+    return;
   } else if (result != vk::Result::eSuccess &&
              result != vk::Result::eSuboptimalKHR) {
     throw std::runtime_error("failed to acquire next image");
@@ -101,12 +253,9 @@ void Bulkin::drawFrame() {
       vk::Result::eSuccess)
     throw std::runtime_error("failed to reset fence");
 
-  update();
+  prepareFrame();
 
-  device.graphicsPipeline.commandBuffers[currentFrame].reset();
-  device.graphicsPipeline.recordCommandBuffer(
-      device.graphicsPipeline.commandBuffers[currentFrame], imageIndex,
-      device.swapchain, currentFrame, quad, models);
+  auto commandBuffer = frameCommandBuffer(imageIndex);
 
   vk::SubmitInfo submitInfo{};
 
@@ -119,8 +268,7 @@ void Bulkin::drawFrame() {
   submitInfo.pWaitDstStageMask = waitStages;
 
   submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers =
-      &device.graphicsPipeline.commandBuffers[currentFrame];
+  submitInfo.pCommandBuffers = &commandBuffer;
 
   vk::Semaphore signalSemaphores[] = {renderFinishedSemaphores[imageIndex]};
   submitInfo.signalSemaphoreCount = 1;
@@ -142,8 +290,8 @@ void Bulkin::drawFrame() {
   result = device.presentQueue.presentKHR(presentInfo);
 
   if (result == vk::Result::eErrorOutOfDateKHR ||
-      result == vk::Result::eSuboptimalKHR || framebufferResized) {
-    framebufferResized = false;
+      result == vk::Result::eSuboptimalKHR ||
+      framebufferResized.exchange(false)) {
     recreateSwapchain();
   } else if (result != vk::Result::eSuccess) {
     throw std::runtime_error("failed to present graphics queue");
@@ -152,16 +300,164 @@ void Bulkin::drawFrame() {
   currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
+void Bulkin::drawOffscreenFrame() {
+  if (device.device.waitForFences(1, &drawFences[currentFrame], vk::True,
+                                  UINT64_MAX) != vk::Result::eSuccess)
+    throw std::runtime_error("failed to wait for fence");
+
+  if (device.graphicsPipeline.gpuProfiling)
+    device.graphicsPipeline.profiler.collect(device.device, currentFrame);
+  reportClusterOverflow();
+
+  if (device.device.resetFences(1, &drawFences[currentFrame]) !=
+      vk::Result::eSuccess)
+    throw std::runtime_error("failed to reset fence");
+
+  prepareFrame();
+
+  // offscreen targets are created one per frame in flight
+  auto commandBuffer = frameCommandBuffer(currentFrame);
+
+  vk::SubmitInfo submitInfo{};
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+
+  if (device.graphicsQueue.submit(1, &submitInfo, drawFences[currentFrame]) !=
+      vk::Result::eSuccess)
+    throw std::runtime_error("failed to submit graphics queue");
+
+  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+}
+
+vk::CommandBuffer Bulkin::frameCommandBuffer(uint32_t imageIndex) {
+  if (device.graphicsPipeline.cachedRecording)
+    return device.graphicsPipeline.cachedCommandBuffer(
+        imageIndex, device.swapchain, currentFrame, quad);
+
+  auto commandBuffer = device.graphicsPipeline.commandBuffers[currentFrame];
+  commandBuffer.reset();
+  device.graphicsPipeline.recordCommandBuffer(commandBuffer, imageIndex,
+                                              device.swapchain, currentFrame,
+                                              quad);
+  return commandBuffer;
+}
+
 void Bulkin::update() {
   const double newTimeStamp = glfwGetTime();
   deltaTime = newTimeStamp - timeStamp;
   timeStamp = newTimeStamp;
   camera.update(deltaTime, mouseState.pos);
   updatePushConstants();
+  publishSnapshot();
+}
 
+void Bulkin::publishSnapshot() {
+  auto &snapshot = snapshots.writeBuffer();
+  snapshot.view = camera.getView();
+  snapshot.viewPos = camera.getPosition();
+  if (window) {
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    snapshot.framebufferWidth = static_cast<uint32_t>(width);
+    snapshot.framebufferHeight = static_cast<uint32_t>(height);
+  }
+  snapshot.quadUpdates.assign(pendingQuadUpdates.begin(),
+                              pendingQuadUpdates.end());
+  snapshot.modelUpdates.assign(pendingModelUpdates.begin(),
+                               pendingModelUpdates.end());
+  snapshot.gpuProfiling = gpuProfiling;
+
+  // the renderer took the previous snapshot, so the updates it carried are
+  // applied and only the ones added since still have to be resent
+  if (snapshots.publish()) {
+    pendingQuadUpdates.erase(pendingQuadUpdates.begin(),
+                             pendingQuadUpdates.begin() +
+                                 static_cast<ptrdiff_t>(publishedQuadUpdates));
+    pendingModelUpdates.erase(
+        pendingModelUpdates.begin(),
+        pendingModelUpdates.begin() +
+            static_cast<ptrdiff_t>(publishedModelUpdates));
+  }
+  publishedQuadUpdates = pendingQuadUpdates.size();
+  publishedModelUpdates = pendingModelUpdates.size();
+}
+
+void Bulkin::consumeSnapshot() {
+  if (!snapshots.consume())
+    return;
+
+  // updates are whole values in the order they were made, so applying one
+  // again after a resend leaves the same result
+  const auto &snapshot = snapshots.readBuffer();
+  auto &buffers = device.graphicsPipeline.buffers;
+  for (const auto &update : snapshot.quadUpdates)
+    buffers.updateQuad(update.quad, update.instance, update.region,
+                       update.moved);
+  for (const auto &update : snapshot.modelUpdates)
+    buffers.updateModel(update.model, update.matrix, update.textureId);
+
+  // the queries are part of the recorded commands, so cached recordings made
+  // with the old setting are thrown away
+  auto &pipeline = device.graphicsPipeline;
+  auto profiling = snapshot.gpuProfiling && pipeline.profiler.isSupported();
+  if (profiling != pipeline.gpuProfiling) {
+    pipeline.gpuProfiling = profiling;
+    pipeline.profiler.restart();
+    if (pipeline.cachedRecording)
+      pipeline.rerecordCachedCommandBuffers();
+  }
+}
+
+void Bulkin::reportClusterOverflow() {
+  // only a new worst case is reported, a crowded spot would otherwise print
+  // every frame
+  auto overflow =
+      device.graphicsPipeline.buffers.takeClusterOverflow(currentFrame);
+  if (overflow.mostLights <= reportedClusterLights)
+    return;
+  reportedClusterLights = overflow.mostLights;
+  std::println("{} clusters dropped lights, the fullest is reached by {} and "
+               "keeps {}",
+               overflow.clusters, overflow.mostLights, MAX_LIGHTS_PER_CLUSTER);
+}
+
+void Bulkin::prepareFrame() {
+  consumeSnapshot();
+  const auto &snapshot = snapshots.readBuffer();
   device.graphicsPipeline.buffers.updateUniformBuffer(
       currentFrame, static_cast<float>(device.swapchain.extent.width),
-      static_cast<float>(device.swapchain.extent.height), camera);
+      static_cast<float>(device.swapchain.extent.height), snapshot.view,
+      snapshot.viewPos);
+  device.graphicsPipeline.buffers.flushInstanceUpdates(currentFrame);
+  updateVisibleRegions(snapshot);
+}
+
+void Bulkin::updateVisibleRegions(const FrameSnapshot &snapshot) {
+  // without a level no quad has a region and the bits stay all set
+  if (!currentLevel)
+    return;
+  const auto &pvs = currentLevel->getPvs();
+  auto region = pvs.regionAt(snapshot.viewPos);
+  auto bits = device.graphicsPipeline.buffers.visibleRegions(currentFrame);
+
+  // the raycast follows the view every frame while a baked row only changes
+  // when the camera crosses into another region. from inside a wall or off
+  // the grid everything is drawn
+  if (region != PVS_NO_REGION && raycastVisibility) {
+    raycaster.trace(pvs, snapshot.view, snapshot.viewPos,
+                    static_cast<float>(device.swapchain.extent.width) /
+                        static_cast<float>(device.swapchain.extent.height),
+                    device.jobs, bits);
+    visibleRegionsFrom[currentFrame] = PVS_NO_REGION;
+  } else if (region != PVS_NO_REGION && pvs.baked()) {
+    if (region == visibleRegionsFrom[currentFrame])
+      return;
+    pvs.decompress(region, bits);
+    visibleRegionsFrom[currentFrame] = region;
+  } else {
+    std::fill(bits.begin(), bits.end(), ~0u);
+    visibleRegionsFrom[currentFrame] = PVS_NO_REGION;
+  }
 }
 
 void Bulkin::updatePushConstants() {
@@ -187,11 +483,13 @@ void Bulkin::cleanup() {
     device.device.destroy(renderFinishedSemaphores[i]);
   }
   for (size_t i = 0; i < textures.size(); i++)
-    textures[i].cleanup(device.device);
+    textures[i].cleanup(device.device, device.allocator);
   device.cleanup(instance);
   instance.destroy();
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  if (!headless) {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+  }
 }
 
 void Bulkin::createInstance() {
@@ -206,9 +504,10 @@ void Bulkin::createInstance() {
   createInfo.pApplicationInfo = &appInfo;
 
   uint32_t glfwExtensionCount = 0;
-  const char **glfwExtensions;
+  const char **glfwExtensions = nullptr;
 
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  if (!headless)
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
   std::vector<const char *> requiredExtensions;
 
@@ -249,9 +548,9 @@ void Bulkin::createSyncObjects() {
   }
 }
 
-void Bulkin::addQuad(glm::vec3 position, float angle, glm::vec3 rotation,
-                     float scale, int shadingId, uint32_t textureId) {
-  quad.addQuad(position, angle, rotation, scale, shadingId, textureId);
+uint32_t Bulkin::addQuad(glm::vec3 position, int faceId, uint32_t textureId,
+                         glm::vec2 size, uint32_t region) {
+  return quad.addQuad(position, size, faceId, textureId, region);
 }
 
 void Bulkin::setPlayerPos(glm::vec2 pos) { camera.setPlayerPos(pos); }
@@ -276,8 +575,9 @@ vk::ImageView Bulkin::createImageView(vk::Device &device, vk::Image image,
 void Bulkin::createImage(uint32_t width, uint32_t height, vk::Format format,
                          vk::ImageTiling tiling, vk::ImageUsageFlags usage,
                          vk::MemoryPropertyFlags properties, vk::Device &device,
-                         vk::PhysicalDevice &physicalDevice, vk::Image &image,
-                         vk::DeviceMemory &imageMemory, uint32_t mipLevels) {
+                         BulkinAllocator &allocator, vk::Image &image,
+                         BulkinAllocation &imageMemory, uint32_t mipLevels,
+                         AllocationCategory category) {
   vk::ImageCreateInfo imageInfo{};
   imageInfo.imageType = vk::ImageType::e2D;
   imageInfo.extent.width = static_cast<uint32_t>(width);
@@ -297,13 +597,8 @@ void Bulkin::createImage(uint32_t width, uint32_t height, vk::Format format,
   vk::MemoryRequirements memRequirements =
       device.getImageMemoryRequirements(image);
 
-  vk::MemoryAllocateInfo allocInfo{};
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = BulkinBuffer::findMemoryType(
-      memRequirements.memoryTypeBits, properties, physicalDevice);
-
-  imageMemory = device.allocateMemory(allocInfo);
-  device.bindImageMemory(image, imageMemory, 0);
+  imageMemory = allocator.allocate(memRequirements, properties, category);
+  device.bindImageMemory(image, imageMemory.memory, imageMemory.offset);
 }
 
 void Bulkin::transitionImageLayout(vk::Device device,
@@ -314,7 +609,16 @@ void Bulkin::transitionImageLayout(vk::Device device,
                                    uint32_t mipLevels) {
   auto commandBuffer =
       BulkinBuffer::beginSingleTimeCommands(device, commandPool);
+  transitionImageLayout(commandBuffer, format, oldLayout, newLayout, image,
+                        mipLevels);
+  BulkinBuffer::endSingleTimeCommands(commandBuffer, device, graphicsQueue,
+                                      commandPool);
+}
 
+void Bulkin::transitionImageLayout(vk::CommandBuffer commandBuffer,
+                                   vk::Format format, vk::ImageLayout oldLayout,
+                                   vk::ImageLayout newLayout, vk::Image &image,
+                                   uint32_t mipLevels, uint32_t arrayLayer) {
   vk::ImageMemoryBarrier barrier{};
   barrier.oldLayout = oldLayout;
   barrier.newLayout = newLayout;
@@ -332,7 +636,7 @@ void Bulkin::transitionImageLayout(vk::Device device,
   }
   barrier.subresourceRange.baseMipLevel = 0;
   barrier.subresourceRange.levelCount = mipLevels;
-  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.baseArrayLayer = arrayLayer;
   barrier.subresourceRange.layerCount = 1;
 
   vk::PipelineStageFlags sourceStage;
@@ -366,17 +670,28 @@ void Bulkin::transitionImageLayout(vk::Device device,
 
   commandBuffer.pipelineBarrier(sourceStage, destinationStage, {}, 0, nullptr,
                                 0, nullptr, 1, &barrier);
-
-  BulkinBuffer::endSingleTimeCommands(commandBuffer, device, graphicsQueue,
-                                      commandPool);
 }
 
 void Bulkin::recreateSwapchain() {
-  device.swapchain.recreate(device.device, device.surface, window,
-                            device.findQueueFamilies(device.physicalDevice));
+  // a minimised window has no framebuffer, the old swapchain is kept until the
+  // main thread reports a size again
+  const auto &snapshot = snapshots.readBuffer();
+  swapchainStale =
+      snapshot.framebufferWidth == 0 || snapshot.framebufferHeight == 0;
+  if (swapchainStale)
+    return;
+
+  device.swapchain.recreate(
+      device.device, device.allocator, device.surface,
+      vk::Extent2D(snapshot.framebufferWidth, snapshot.framebufferHeight),
+      device.findQueueFamilies(device.physicalDevice));
   device.graphicsPipeline.createDepthResources(
-      device.device, device.physicalDevice, device.graphicsQueue,
-      device.swapchain.extent.width, device.swapchain.extent.height);
+      device.device, device.physicalDevice, device.allocator,
+      device.graphicsQueue, device.swapchain.extent.width,
+      device.swapchain.extent.height);
+  if (device.graphicsPipeline.cachedRecording)
+    device.graphicsPipeline.invalidateCachedCommandBuffers(
+        device.device, static_cast<uint32_t>(device.swapchain.images.size()));
 }
 
 uint32_t Bulkin::addTexture(std::string filename) {
@@ -388,11 +703,13 @@ uint32_t Bulkin::addTexture(std::string filename) {
   return static_cast<uint32_t>(textures.size()) - 1;
 }
 
-void Bulkin::addPointLight(PointLight &light) { pointLights.push_back(light); }
+uint32_t Bulkin::addPointLight(PointLight &light) {
+  pointLights.push_back(light);
+  return static_cast<uint32_t>(pointLights.size() - 1);
+}
 
-bool Bulkin::tick(float deltaTime, bool frameRendered) {
-  if (frameRendered)
-    numFrames++;
+bool Bulkin::tick(float deltaTime, uint32_t framesRendered) {
+  numFrames += framesRendered;
   accumTime += deltaTime;
   if (accumTime > avgInterval) {
     currentFPS = static_cast<float>(numFrames / accumTime);
@@ -407,35 +724,89 @@ bool Bulkin::tick(float deltaTime, bool frameRendered) {
   return false;
 }
 
-void Bulkin::addModel(std::string modelPath, glm::vec3 pos, float angle,
-                      glm::vec3 rotation, float scale) {
+uint32_t Bulkin::addModel(std::string modelPath, glm::vec3 pos, float angle,
+                          glm::vec3 rotation, float scale) {
   BulkinModel model(modelPath, pos, angle, rotation, scale);
   model.loadModel();
   auto diffusePath = model.getDiffusePath();
   auto diffuse = addTexture(diffusePath);
   model.setDiffuse(diffuse);
-  models.push_back(model);
+  models.push_back(std::move(model));
+  return static_cast<uint32_t>(models.size() - 1);
+}
+
+void Bulkin::moveQuad(uint32_t quad, glm::vec3 position) {
+  this->quad.setPosition(quad, position);
+  // a level quad takes on the region it was moved into, or none when that is
+  // a wall or off the grid, so it is never culled with the region it left
+  if (this->quad.getRegions()[quad] != PVS_NO_REGION) {
+    this->quad.setRegion(quad, currentLevel
+                                   ? currentLevel->getPvs().regionAt(position)
+                                   : PVS_NO_REGION);
+  }
+  if (sceneUploaded)
+    pendingQuadUpdates.push_back({quad, this->quad.getInstanceData(quad),
+                                  this->quad.getRegions()[quad], true});
+}
+
+void Bulkin::setQuadTexture(uint32_t quad, uint32_t textureId) {
+  this->quad.setTexture(quad, textureId);
+  if (sceneUploaded)
+    pendingQuadUpdates.push_back({quad, this->quad.getInstanceData(quad),
+                                  this->quad.getRegions()[quad], false});
+}
+
+void Bulkin::moveModel(uint32_t model, glm::vec3 pos, float angle,
+                       glm::vec3 rotation, float scale) {
+  if (model >= models.size())
+    throw std::runtime_error("invalid model handle");
+  models[model].setTransform(pos, angle, rotation, scale);
+  if (sceneUploaded)
+    pendingModelUpdates.push_back(
+        {model, models[model].modelMatrix(), models[model].getTextureId()});
+}
+
+void Bulkin::setModelTexture(uint32_t model, uint32_t textureId) {
+  if (model >= models.size())
+    throw std::runtime_error("invalid model handle");
+  models[model].setDiffuse(textureId);
+  if (sceneUploaded)
+    pendingModelUpdates.push_back(
+        {model, models[model].modelMatrix(), models[model].getTextureId()});
 }
 
 void Bulkin::loadLevel(const std::string &path, uint32_t wallTexture,
                        uint32_t floorTexture, uint32_t ceilingTexture,
-                       size_t maxHeight) {
+                       size_t maxHeight, bool greedyMeshing, bool pvs,
+                       bool lightmap) {
   auto newLevel = std::make_unique<BulkinLevel>(
-      BulkinLevel(path, wallTexture, floorTexture, ceilingTexture, maxHeight));
+      BulkinLevel(path, wallTexture, floorTexture, ceilingTexture, maxHeight,
+                  greedyMeshing, pvs, lightmap));
   currentLevel = std::move(newLevel);
-  currentLevel->loadLevel(*this);
+  // the bakes share the device's workers rather than starting their own
+  device.jobs.create();
+  currentLevel->loadLevel(*this, device.jobs);
 }
 void Bulkin::addCube(size_t x, size_t z, size_t texture) {
-  addQuad(glm::vec3(0.0f + x, 0.0f, 0.0f + z), 0.0f, glm::vec3(1.0f), 1.0f, 0,
-          texture);
-  addQuad(glm::vec3(0.5f + x, 0.0f, -0.5f + z), 90.0f,
-          glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, 0, texture);
-  addQuad(glm::vec3(-0.5f + x, 0.0f, -0.5f + z), 270.0f,
-          glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, 0, texture);
-  addQuad(glm::vec3(0.0f + x, 0.0f, -1.0f + z), 180.0f,
-          glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, 0, texture);
-  addQuad(glm::vec3(x, 0.0f, -1.0f + z), 90.0f, glm::vec3(1.0f, 0.0f, 0.0f),
-          1.0f, 0, texture);
-  addQuad(glm::vec3(x, 1.0f, z), 270.0f, glm::vec3(1.0f, 0.0f, 0.0f), 1.0f, 0,
-          texture);
+  auto textureId = static_cast<uint32_t>(texture);
+  addQuad(glm::vec3(0.0f + x, 0.0f, 0.0f + z), 1, textureId);
+  addQuad(glm::vec3(0.5f + x, 0.0f, -0.5f + z), 2, textureId);
+  addQuad(glm::vec3(-0.5f + x, 0.0f, -0.5f + z), 3, textureId);
+  addQuad(glm::vec3(0.0f + x, 0.0f, -1.0f + z), 0, textureId);
+  addQuad(glm::vec3(x, 0.0f, -1.0f + z), 5, textureId);
+  addQuad(glm::vec3(x, 1.0f, z), 4, textureId);
+}
+
+void Bulkin::setGpuProfiling(bool enabled) { gpuProfiling = enabled; }
+
+PassStatistics Bulkin::getPassStatistics(ProfilerPass pass) {
+  return device.graphicsPipeline.profiler.getStatistics(pass);
+}
+
+AllocatorStatistics Bulkin::getMemoryStatistics(AllocationCategory category) {
+  return device.allocator.getStatistics(category);
+}
+
+void Bulkin::writeProfileCsv(const std::string &path) {
+  device.graphicsPipeline.profiler.writeCsv(path);
 }
@@ -62,6 +62,11 @@ void BulkinCamera::setPlayerPos(glm::vec2 pos) {
   cameraPos = glm::vec3(pos.x, playerHeight, pos.y);
 }
 
+void BulkinCamera::setPose(const glm::vec3 &pos, const glm::vec3 &target) {
+  cameraPos = pos;
+  cameraOrientation = glm::quat_cast(glm::lookAt(pos, target, worldUp));
+}
+
 void BulkinCamera::setPosition(const glm::vec3 &pos) { cameraPos = pos; }
 
 void BulkinCamera::setUpVector(glm::vec3 up) {
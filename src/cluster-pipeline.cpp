@@ -0,0 +1,164 @@
+#include "cluster-pipeline.h"
+#include "cluster-shader.h"
+#include "constants.h"
+#include "graphics-pipeline.h"
+#include "vertex.h"
+
+constexpr uint32_t CLUSTER_WORKGROUP_SIZE = 64;
+
+void BulkinClusterPipeline::create(vk::Device &device,
+                                   vk::PipelineCache pipelineCache) {
+  auto shaderModule = BulkinGraphicsPipeline::createShaderModule(
+      shaders_cluster_spv, shaders_cluster_spv_len, device);
+
+  vk::PipelineShaderStageCreateInfo stageInfo{};
+  stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+  stageInfo.module = shaderModule;
+  stageInfo.pName = "main";
+
+  vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+
+  pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+  vk::ComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.stage = stageInfo;
+  pipelineInfo.layout = pipelineLayout;
+
+  auto [result, computePipeline] =
+      device.createComputePipeline(pipelineCache, pipelineInfo);
+  if (result != vk::Result::eSuccess)
+    throw std::runtime_error("cannot create cluster pipeline");
+
+  pipeline = computePipeline;
+
+  device.destroy(shaderModule);
+}
+
+void BulkinClusterPipeline::createDescriptorLayout(vk::Device &device) {
+  std::array<vk::DescriptorSetLayoutBinding, 4> bindings{};
+
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+  for (uint32_t i = 1; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+  }
+
+  vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  descriptorSetLayout = device.createDescriptorSetLayout(layoutInfo);
+}
+
+void BulkinClusterPipeline::createDescriptorSets(vk::Device &device,
+                                                 BulkinBuffer &buffers) {
+  std::array<vk::DescriptorPoolSize, 2> poolSizes;
+  poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
+  poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  poolSizes[1].type = vk::DescriptorType::eStorageBuffer;
+  poolSizes[1].descriptorCount =
+      3 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+  vk::DescriptorPoolCreateInfo poolInfo{};
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+  descriptorPool = device.createDescriptorPool(poolInfo);
+
+  std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
+                                               descriptorSetLayout);
+  vk::DescriptorSetAllocateInfo allocInfo{};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  allocInfo.pSetLayouts = layouts.data();
+
+  descriptorSets = device.allocateDescriptorSets(allocInfo);
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vk::DescriptorBufferInfo uniformBufferInfo{};
+    uniformBufferInfo.buffer = buffers.uniformBuffers[i];
+    uniformBufferInfo.offset = 0;
+    uniformBufferInfo.range = sizeof(UniformBufferObject);
+
+    vk::DescriptorBufferInfo pointLightBufferInfo{};
+    pointLightBufferInfo.buffer = buffers.pointLightBuffer;
+    pointLightBufferInfo.offset = 0;
+    pointLightBufferInfo.range = vk::WholeSize;
+
+    vk::DescriptorBufferInfo clusterBufferInfo{};
+    clusterBufferInfo.buffer = buffers.clusterLightBuffers[i];
+    clusterBufferInfo.offset = 0;
+    clusterBufferInfo.range = vk::WholeSize;
+
+    vk::DescriptorBufferInfo overflowBufferInfo{};
+    overflowBufferInfo.buffer = buffers.clusterOverflowBuffers[i];
+    overflowBufferInfo.offset = 0;
+    overflowBufferInfo.range = sizeof(ClusterOverflow);
+
+    std::array<vk::DescriptorBufferInfo *, 4> bufferInfos = {
+        &uniformBufferInfo, &pointLightBufferInfo, &clusterBufferInfo,
+        &overflowBufferInfo};
+    std::array<vk::WriteDescriptorSet, 4> descriptorWrites{};
+
+    for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+      descriptorWrites[j].dstSet = descriptorSets[i];
+      descriptorWrites[j].dstBinding = j;
+      descriptorWrites[j].dstArrayElement = 0;
+      descriptorWrites[j].descriptorType =
+          j == 0 ? vk::DescriptorType::eUniformBuffer
+                 : vk::DescriptorType::eStorageBuffer;
+      descriptorWrites[j].descriptorCount = 1;
+      descriptorWrites[j].pBufferInfo = bufferInfos[j];
+    }
+
+    device.updateDescriptorSets(
+        static_cast<uint32_t>(descriptorWrites.size()),
+        descriptorWrites.data(), 0, nullptr);
+  }
+}
+
+void BulkinClusterPipeline::record(vk::CommandBuffer commandBuffer,
+                                   uint32_t currentFrame) {
+  // one invocation per cluster, the light lists are rebuilt from scratch and
+  // the host clears the overflow counts, so nothing needs clearing here
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                   pipelineLayout, 0, 1,
+                                   &descriptorSets[currentFrame], 0, nullptr);
+  commandBuffer.dispatch(
+      (CLUSTER_COUNT + CLUSTER_WORKGROUP_SIZE - 1) / CLUSTER_WORKGROUP_SIZE, 1,
+      1);
+
+  // the overflow counts are read on the host after the frame's fence
+  std::array<vk::MemoryBarrier2, 2> clusterBarriers{};
+  clusterBarriers[0].srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  clusterBarriers[0].srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite;
+  clusterBarriers[0].dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader;
+  clusterBarriers[0].dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead;
+  clusterBarriers[1].srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  clusterBarriers[1].srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite;
+  clusterBarriers[1].dstStageMask = vk::PipelineStageFlagBits2::eHost;
+  clusterBarriers[1].dstAccessMask = vk::AccessFlagBits2::eHostRead;
+
+  vk::DependencyInfo clusterDependency{};
+  clusterDependency.memoryBarrierCount =
+      static_cast<uint32_t>(clusterBarriers.size());
+  clusterDependency.pMemoryBarriers = clusterBarriers.data();
+  commandBuffer.pipelineBarrier2(clusterDependency);
+}
+
+void BulkinClusterPipeline::cleanup(vk::Device &device) {
+  device.destroy(descriptorPool);
+  device.destroy(descriptorSetLayout);
+  device.destroy(pipelineLayout);
+  device.destroy(pipeline);
+}
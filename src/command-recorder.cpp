@@ -0,0 +1,60 @@
+#include "command-recorder.h"
+
+void BulkinCommandRecorder::create(vk::Device &device, uint32_t queueFamily,
+                                   BulkinJobPool &jobs) {
+  this->device = device;
+  this->jobs = &jobs;
+
+  vk::CommandPoolCreateInfo poolInfo{};
+  poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+  poolInfo.queueFamilyIndex = queueFamily;
+
+  for (auto &framePools : pools) {
+    framePools.resize(jobs.threadCount());
+    for (auto &workerPool : framePools)
+      workerPool.pool = device.createCommandPool(poolInfo);
+  }
+}
+
+void BulkinCommandRecorder::reset(uint32_t currentFrame, uint32_t workCount) {
+  for (auto &workerPool : pools[currentFrame]) {
+    device.resetCommandPool(workerPool.pool);
+    workerPool.used = 0;
+  }
+  recorded.assign(workCount, vk::CommandBuffer{});
+  error = nullptr;
+}
+
+vk::CommandBuffer BulkinCommandRecorder::begin(
+    uint32_t currentFrame,
+    const vk::CommandBufferInheritanceInfo &inheritance) {
+  // only this worker touches its pool, so nothing here needs a lock
+  auto &workerPool = pools[currentFrame][BulkinJobPool::workerIndex()];
+  if (workerPool.used == workerPool.buffers.size()) {
+    vk::CommandBufferAllocateInfo allocInfo{};
+    allocInfo.commandPool = workerPool.pool;
+    allocInfo.level = vk::CommandBufferLevel::eSecondary;
+    allocInfo.commandBufferCount = 1;
+    workerPool.buffers.push_back(device.allocateCommandBuffers(allocInfo)[0]);
+  }
+  auto commandBuffer = workerPool.buffers[workerPool.used++];
+
+  vk::CommandBufferBeginInfo beginInfo{};
+  beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                    vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+  beginInfo.pInheritanceInfo = &inheritance;
+  commandBuffer.begin(beginInfo);
+  return commandBuffer;
+}
+
+uint32_t BulkinCommandRecorder::workerCount() const {
+  return static_cast<uint32_t>(pools[0].size());
+}
+
+void BulkinCommandRecorder::cleanup(vk::Device &device) {
+  for (auto &framePools : pools) {
+    for (auto &workerPool : framePools)
+      device.destroy(workerPool.pool);
+    framePools.clear();
+  }
+}
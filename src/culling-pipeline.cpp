@@ -0,0 +1,243 @@
+#include "culling-pipeline.h"
+#include "constants.h"
+#include "cull-shader.h"
+#include "graphics-pipeline.h"
+#include "vertex.h"
+
+constexpr uint32_t CULLING_WORKGROUP_SIZE = 64;
+
+// the count phase tests every quad and sizes the depth buckets, the place
+// phase writes the visible quads into the buckets' runs of the shared list
+enum class CullingPhase : uint32_t { Count, Place };
+
+struct CullingPushConstants {
+  uint32_t instanceCount;
+  CullingPhase phase;
+};
+
+void BulkinCullingPipeline::create(vk::Device &device,
+                                   vk::PipelineCache pipelineCache) {
+  auto shaderModule = BulkinGraphicsPipeline::createShaderModule(
+      shaders_cull_spv, shaders_cull_spv_len, device);
+
+  vk::PipelineShaderStageCreateInfo stageInfo{};
+  stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+  stageInfo.module = shaderModule;
+  stageInfo.pName = "main";
+
+  vk::PushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(CullingPushConstants);
+
+  vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+  vk::ComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.stage = stageInfo;
+  pipelineInfo.layout = pipelineLayout;
+
+  auto [result, computePipeline] =
+      device.createComputePipeline(pipelineCache, pipelineInfo);
+  if (result != vk::Result::eSuccess)
+    throw std::runtime_error("cannot create culling pipeline");
+
+  pipeline = computePipeline;
+
+  device.destroy(shaderModule);
+}
+
+void BulkinCullingPipeline::createDescriptorLayout(vk::Device &device) {
+  std::array<vk::DescriptorSetLayoutBinding, 7> bindings{};
+
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+  for (uint32_t i = 1; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+  }
+
+  vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  descriptorSetLayout = device.createDescriptorSetLayout(layoutInfo);
+}
+
+void BulkinCullingPipeline::createDescriptorSets(vk::Device &device,
+                                                 BulkinBuffer &buffers) {
+  std::array<vk::DescriptorPoolSize, 2> poolSizes;
+  poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
+  poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  poolSizes[1].type = vk::DescriptorType::eStorageBuffer;
+  poolSizes[1].descriptorCount =
+      6 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+  vk::DescriptorPoolCreateInfo poolInfo{};
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+  descriptorPool = device.createDescriptorPool(poolInfo);
+
+  std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
+                                               descriptorSetLayout);
+  vk::DescriptorSetAllocateInfo allocInfo{};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  allocInfo.pSetLayouts = layouts.data();
+
+  descriptorSets = device.allocateDescriptorSets(allocInfo);
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vk::DescriptorBufferInfo uniformBufferInfo{};
+    uniformBufferInfo.buffer = buffers.uniformBuffers[i];
+    uniformBufferInfo.offset = 0;
+    uniformBufferInfo.range = sizeof(UniformBufferObject);
+
+    vk::DescriptorBufferInfo ssboBufferInfo{};
+    ssboBufferInfo.buffer = buffers.ssboBuffers[i];
+    ssboBufferInfo.offset = 0;
+    ssboBufferInfo.range = vk::WholeSize;
+
+    vk::DescriptorBufferInfo visibleBufferInfo{};
+    visibleBufferInfo.buffer = buffers.visibleBuffers[i];
+    visibleBufferInfo.offset = 0;
+    visibleBufferInfo.range = vk::WholeSize;
+
+    vk::DescriptorBufferInfo drawCommandBufferInfo{};
+    drawCommandBufferInfo.buffer = buffers.drawCommandBuffers[i];
+    drawCommandBufferInfo.offset = 0;
+    drawCommandBufferInfo.range = sizeof(CulledDrawCommand);
+
+    vk::DescriptorBufferInfo quadRegionBufferInfo{};
+    quadRegionBufferInfo.buffer = buffers.quadRegionBuffers[i];
+    quadRegionBufferInfo.offset = 0;
+    quadRegionBufferInfo.range = vk::WholeSize;
+
+    vk::DescriptorBufferInfo visibleRegionBufferInfo{};
+    visibleRegionBufferInfo.buffer = buffers.visibleRegionBuffers[i];
+    visibleRegionBufferInfo.offset = 0;
+    visibleRegionBufferInfo.range = vk::WholeSize;
+
+    vk::DescriptorBufferInfo cullSlotBufferInfo{};
+    cullSlotBufferInfo.buffer = buffers.cullSlotBuffers[i];
+    cullSlotBufferInfo.offset = 0;
+    cullSlotBufferInfo.range = vk::WholeSize;
+
+    std::array<vk::DescriptorBufferInfo *, 7> bufferInfos = {
+        &uniformBufferInfo,    &ssboBufferInfo,
+        &visibleBufferInfo,    &drawCommandBufferInfo,
+        &quadRegionBufferInfo, &visibleRegionBufferInfo,
+        &cullSlotBufferInfo};
+    std::array<vk::WriteDescriptorSet, 7> descriptorWrites{};
+
+    for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+      descriptorWrites[j].dstSet = descriptorSets[i];
+      descriptorWrites[j].dstBinding = j;
+      descriptorWrites[j].dstArrayElement = 0;
+      descriptorWrites[j].descriptorType =
+          j == 0 ? vk::DescriptorType::eUniformBuffer
+                 : vk::DescriptorType::eStorageBuffer;
+      descriptorWrites[j].descriptorCount = 1;
+      descriptorWrites[j].pBufferInfo = bufferInfos[j];
+    }
+
+    device.updateDescriptorSets(
+        static_cast<uint32_t>(descriptorWrites.size()),
+        descriptorWrites.data(), 0, nullptr);
+  }
+}
+
+void BulkinCullingPipeline::record(vk::CommandBuffer commandBuffer,
+                                   BulkinBuffer &buffers,
+                                   uint32_t currentFrame,
+                                   uint32_t instanceCount) {
+  auto drawCommandBuffer = buffers.drawCommandBuffers[currentFrame];
+
+  // reset every bucket's instance count and the draw count. the place phase
+  // rewrites the first instances and the rest of the commands is static
+  for (uint32_t bucket = 0; bucket < CULL_DEPTH_BUCKETS; bucket++)
+    commandBuffer.fillBuffer(
+        drawCommandBuffer,
+        sizeof(vk::DrawIndexedIndirectCommand) * bucket +
+            offsetof(vk::DrawIndexedIndirectCommand, instanceCount),
+        sizeof(uint32_t), 0);
+  commandBuffer.fillBuffer(drawCommandBuffer,
+                           offsetof(CulledDrawCommand, drawCount),
+                           sizeof(uint32_t), 0);
+
+  vk::MemoryBarrier2 clearBarrier{};
+  clearBarrier.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+  clearBarrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+  clearBarrier.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  clearBarrier.dstAccessMask =
+      vk::AccessFlagBits2::eShaderStorageRead |
+      vk::AccessFlagBits2::eShaderStorageWrite;
+
+  vk::DependencyInfo clearDependency{};
+  clearDependency.memoryBarrierCount = 1;
+  clearDependency.pMemoryBarriers = &clearBarrier;
+  commandBuffer.pipelineBarrier2(clearDependency);
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                   pipelineLayout, 0, 1,
+                                   &descriptorSets[currentFrame], 0, nullptr);
+  auto groupCount =
+      (instanceCount + CULLING_WORKGROUP_SIZE - 1) / CULLING_WORKGROUP_SIZE;
+  CullingPushConstants pushConstants{instanceCount, CullingPhase::Count};
+  commandBuffer.pushConstants(pipelineLayout,
+                              vk::ShaderStageFlagBits::eCompute, 0,
+                              sizeof(CullingPushConstants), &pushConstants);
+  commandBuffer.dispatch(groupCount, 1, 1);
+
+  // the place phase needs every bucket's final count
+  vk::MemoryBarrier2 countBarrier{};
+  countBarrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  countBarrier.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite;
+  countBarrier.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  countBarrier.dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+                               vk::AccessFlagBits2::eShaderStorageWrite;
+
+  vk::DependencyInfo countDependency{};
+  countDependency.memoryBarrierCount = 1;
+  countDependency.pMemoryBarriers = &countBarrier;
+  commandBuffer.pipelineBarrier2(countDependency);
+
+  pushConstants.phase = CullingPhase::Place;
+  commandBuffer.pushConstants(pipelineLayout,
+                              vk::ShaderStageFlagBits::eCompute, 0,
+                              sizeof(CullingPushConstants), &pushConstants);
+  commandBuffer.dispatch(groupCount, 1, 1);
+
+  vk::MemoryBarrier2 cullBarrier{};
+  cullBarrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  cullBarrier.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite;
+  cullBarrier.dstStageMask = vk::PipelineStageFlagBits2::eDrawIndirect |
+                             vk::PipelineStageFlagBits2::eVertexShader;
+  cullBarrier.dstAccessMask = vk::AccessFlagBits2::eIndirectCommandRead |
+                              vk::AccessFlagBits2::eShaderStorageRead;
+
+  vk::DependencyInfo cullDependency{};
+  cullDependency.memoryBarrierCount = 1;
+  cullDependency.pMemoryBarriers = &cullBarrier;
+  commandBuffer.pipelineBarrier2(cullDependency);
+}
+
+void BulkinCullingPipeline::cleanup(vk::Device &device) {
+  device.destroy(descriptorPool);
+  device.destroy(descriptorSetLayout);
+  device.destroy(pipelineLayout);
+  device.destroy(pipeline);
+}
@@ -1,5 +1,7 @@
 #include "device.h"
+#include "constants.h"
 
+#include <future>
 #include <set>
 
 #ifdef __APPLE__
@@ -23,10 +25,15 @@ QueueFamilyIndices BulkinDevice::findQueueFamilies(vk::PhysicalDevice &device) {
       indices.graphicsFamily = i;
     }
 
-    auto presentSupport = device.getSurfaceSupportKHR(i, surface);
+    if (headless) {
+      // nothing is presented, the graphics queue stands in for present
+      indices.presentFamily = indices.graphicsFamily;
+    } else {
+      auto presentSupport = device.getSurfaceSupportKHR(i, surface);
 
-    if (presentSupport)
-      indices.presentFamily = i;
+      if (presentSupport)
+        indices.presentFamily = i;
+    }
 
     if (indices.isComplete())
       break;
@@ -58,8 +65,8 @@ bool BulkinDevice::isDeviceSuitable(vk::PhysicalDevice &physicalDevice) {
 
   bool extensionsSupported = checkDeviceExtensionSupport(physicalDevice);
 
-  bool swapchainAdequate = false;
-  if (extensionsSupported) {
+  bool swapchainAdequate = headless;
+  if (extensionsSupported && !headless) {
     BulkinSwapchain swapchain;
     swapchain.querySwapchainSupport(physicalDevice, surface);
     swapchainAdequate = swapchain.isAdequate();
@@ -69,7 +76,7 @@ bool BulkinDevice::isDeviceSuitable(vk::PhysicalDevice &physicalDevice) {
   
   vk::PhysicalDeviceFeatures supportedFeatures = physicalDevice.getFeatures();
   
-  return indices.isComplete() && extensionsSupported && swapchainAdequate && supportedFeatures.samplerAnisotropy;
+  return indices.isComplete() && extensionsSupported && swapchainAdequate && supportedFeatures.samplerAnisotropy && supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
 }
 
 bool BulkinDevice::checkDeviceExtensionSupport(
@@ -77,7 +84,7 @@ bool BulkinDevice::checkDeviceExtensionSupport(
   auto availableExtensions =
       physicalDevice.enumerateDeviceExtensionProperties();
 
-  for (const auto &extension : requiredExtensions) {
+  for (const auto &extension : enabledExtensions()) {
     bool extensionFound = false;
 
     for (const auto &ext : availableExtensions) {
@@ -95,6 +102,16 @@ bool BulkinDevice::checkDeviceExtensionSupport(
   return true;
 }
 
+std::vector<const char *> BulkinDevice::enabledExtensions() {
+  std::vector<const char *> extensions;
+  for (const auto &extension : requiredExtensions) {
+    if (headless && strcmp(extension, vk::KHRSwapchainExtensionName) == 0)
+      continue;
+    extensions.push_back(extension);
+  }
+  return extensions;
+}
+
 void BulkinDevice::createLogicalDevice() {
   auto indices = findQueueFamilies(physicalDevice);
 
@@ -113,8 +130,17 @@ void BulkinDevice::createLogicalDevice() {
 
   vk::PhysicalDeviceFeatures2 deviceFeatures;
   deviceFeatures.features.samplerAnisotropy = true;
+  deviceFeatures.features.multiDrawIndirect = true;
+  deviceFeatures.features.drawIndirectFirstInstance = true;
+  deviceFeatures.features.pipelineStatisticsQuery =
+      physicalDevice.getFeatures().pipelineStatisticsQuery;
+  deviceFeatures.features.inheritedQueries =
+      physicalDevice.getFeatures().inheritedQueries;
+  textureCompression = physicalDevice.getFeatures().textureCompressionBC;
+  deviceFeatures.features.textureCompressionBC = textureCompression;
   vk::PhysicalDeviceVulkan12Features vulkan12Features;
   vulkan12Features.runtimeDescriptorArray = true;
+  vulkan12Features.drawIndirectCount = true;
   vk::PhysicalDeviceVulkan13Features vulkan13Features;
   vulkan13Features.dynamicRendering = true;
   vulkan13Features.synchronization2 = true;
@@ -138,20 +164,28 @@ void BulkinDevice::createLogicalDevice() {
   createInfo.queueCreateInfoCount =
       static_cast<uint32_t>(queueCreateInfos.size());
 
-  createInfo.enabledExtensionCount =
-      static_cast<uint32_t>(requiredExtensions.size());
-  createInfo.ppEnabledExtensionNames = requiredExtensions.data();
+  auto extensions = enabledExtensions();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
   createInfo.enabledLayerCount = 0;
 
   device = physicalDevice.createDevice(createInfo);
 
   device.getQueue(indices.graphicsFamily.value(), 0, &graphicsQueue);
   device.getQueue(indices.presentFamily.value(), 0, &presentQueue);
+
+  allocator.create(device, physicalDevice);
 }
 
 void BulkinDevice::cleanup(vk::Instance &instance) {
-  graphicsPipeline.cleanup(device);
-  swapchain.cleanup(device);
+  jobs.cleanup();
+  pipelineCache.save(device);
+  pipelineCache.cleanup(device);
+  uploader.cleanup();
+  graphicsPipeline.cleanup(device, allocator);
+  swapchain.cleanup(device, allocator);
+  textureSet.cleanup(device, allocator);
+  allocator.cleanup();
   device.destroy();
   instance.destroy(surface);
 }
@@ -166,18 +200,99 @@ void BulkinDevice::createSurface(vk::Instance &instance, GLFWwindow *window) {
 }
 
 void BulkinDevice::createSwapchain(GLFWwindow *window) {
-  swapchain.createSwapchain(device, surface, window,
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  swapchain.createSwapchain(device, surface,
+                            vk::Extent2D(static_cast<uint32_t>(width),
+                                         static_cast<uint32_t>(height)),
                             findQueueFamilies(physicalDevice));
   swapchain.createImageViews(device);
 }
 
-void BulkinDevice::createGraphicsPipeline(BulkinQuad quad, std::vector<BulkinTexture>& textures, std::vector<PointLight>& pointLights, std::vector<BulkinModel>& models) {
-  graphicsPipeline.createDescriptorLayout(device, static_cast<uint32_t>(textures.size()));
-  graphicsPipeline.create(device, physicalDevice, swapchain.imageFormat);
+void BulkinDevice::createOffscreenTargets(uint32_t width, uint32_t height) {
+  swapchain.createOffscreen(device, allocator, width, height,
+                            MAX_FRAMES_IN_FLIGHT);
+}
+
+void BulkinDevice::createGraphicsPipeline(const BulkinQuad& quad, std::span<BulkinTexture> textures, std::span<const PointLight> pointLights, std::span<const BulkinModel> models, const BulkinLightmap& lightmap, const WallGrid& walls) {
+  // images are created from the texture headers up front, so the workers only
+  // decode and the main thread only uploads
+  jobs.create();
+  textureSet.create(device, physicalDevice, allocator, textures, textureCompression);
+  decodeTextures(textures);
+  pipelineCache.load(device, physicalDevice);
+  graphicsPipeline.createDescriptorLayout(device, textureSet.bindlessCount());
+  if (graphicsPipeline.gpuCulling)
+    graphicsPipeline.culling.createDescriptorLayout(device);
+  // without models there is nothing for the depth pyramid to reject
+  if (models.empty())
+    graphicsPipeline.occlusionCulling = false;
+  if (graphicsPipeline.occlusionCulling)
+    graphicsPipeline.occlusion.createDescriptorLayout(device);
+  graphicsPipeline.clusters.createDescriptorLayout(device);
+  
+  // pipelines only need the descriptor layouts, so compile them on a worker
+  // while textures and buffers are uploaded on this thread
+  auto pipelines = std::async(std::launch::async, [this]() {
+    graphicsPipeline.create(device, physicalDevice, swapchain.imageFormat, pipelineCache.cache);
+    if (graphicsPipeline.gpuCulling)
+      graphicsPipeline.culling.create(device, pipelineCache.cache);
+    if (graphicsPipeline.occlusionCulling)
+      graphicsPipeline.occlusion.create(device, pipelineCache.cache);
+    graphicsPipeline.clusters.create(device, pipelineCache.cache);
+  });
+  
+  graphicsPipeline.profiler.create(device, physicalDevice);
   graphicsPipeline.createCommandPool(device, findQueueFamilies(physicalDevice));
-  graphicsPipeline.createDepthResources(device, physicalDevice, graphicsQueue, swapchain.extent.width, swapchain.extent.height);
-  for (auto& texture : textures)
-    texture.load(device, physicalDevice, graphicsPipeline.commandPool, graphicsQueue);
-  graphicsPipeline.createBuffers(device, physicalDevice, graphicsQueue, quad, textures, pointLights, models);
+  graphicsPipeline.recorder.create(device, findQueueFamilies(physicalDevice).graphicsFamily.value(), jobs);
+  uploader.create(device, allocator, graphicsPipeline.commandPool, graphicsQueue);
+  graphicsPipeline.createDepthResources(device, physicalDevice, allocator, graphicsQueue, swapchain.extent.width, swapchain.extent.height);
+  uploadTextures(textures);
+  graphicsPipeline.createBuffers(device, allocator, uploader, quad, textures, textureSet, pointLights, models, lightmap, walls);
+  pipelines.get();
   graphicsPipeline.createCommandBuffers(device);
+  if (graphicsPipeline.cachedRecording)
+    graphicsPipeline.createCachedCommandBuffers(device, static_cast<uint32_t>(swapchain.images.size()));
+}
+
+void BulkinDevice::decodeTextures(std::span<BulkinTexture> textures) {
+  decodedTextures.clear();
+  decodeError = nullptr;
+  for (size_t i = 0; i < textures.size(); i++) {
+    jobs.submit([this, textures, i]() {
+      try {
+        textures[i].decode();
+      } catch (...) {
+        std::lock_guard lock(decodedMutex);
+        if (!decodeError)
+          decodeError = std::current_exception();
+      }
+      {
+        std::lock_guard lock(decodedMutex);
+        decodedTextures.push_back(i);
+      }
+      decodedReady.notify_one();
+    });
+  }
+}
+
+void BulkinDevice::uploadTextures(std::span<BulkinTexture> textures) {
+  // each texture goes into the upload batch as soon as its decode finishes,
+  // and the ring flushes whenever it fills up, so the GPU copies run while the
+  // workers are still decoding
+  for (size_t uploaded = 0; uploaded < textures.size(); uploaded++) {
+    size_t index;
+    {
+      std::unique_lock lock(decodedMutex);
+      decodedReady.wait(lock, [this]() { return !decodedTextures.empty(); });
+      index = decodedTextures.front();
+      decodedTextures.pop_front();
+      if (decodeError)
+        continue;
+    }
+    textures[index].upload(physicalDevice, uploader);
+  }
+  
+  if (decodeError)
+    std::rethrow_exception(decodeError);
 }
@@ -5,52 +5,27 @@
 #include "vert-shader.h"
 #include "bulkin.h"
 
-#include <fstream>
+#include <algorithm>
 
-void BulkinGraphicsPipeline::create(vk::Device &device, vk::PhysicalDevice& physicalDevice, vk::Format& swapchainFormat) {
+void BulkinGraphicsPipeline::create(vk::Device &device, vk::PhysicalDevice& physicalDevice, vk::Format& swapchainFormat, vk::PipelineCache pipelineCache) {
   vk::PipelineShaderStageCreateInfo fragShaderStageInfo{};
   vk::PipelineShaderStageCreateInfo vertShaderStageInfo{};
   
   std::vector<vk::ShaderModule> modules;
   
-  if (slang) {
-    auto slangShaderCode = readFile("shaders/slang.spv");
-
-    auto slangModule = createShaderModule(slangShaderCode, device);
-    modules.push_back(slangModule);
-    
-    vertShaderStageInfo.stage = vk::ShaderStageFlagBits::eVertex;
-    vertShaderStageInfo.module = slangModule;
-    vertShaderStageInfo.pName = "vertMain";
-    
-    
-    fragShaderStageInfo.stage = vk::ShaderStageFlagBits::eFragment;
-    fragShaderStageInfo.module = slangModule;
-    fragShaderStageInfo.pName = "fragMain";
-  } else {
-    std::vector<char> vertShaderCode;
-    std::vector<char> fragShaderCode;
-    
-    for (size_t i = 0; i < shaders_vert_spv_len; i++)
-      vertShaderCode.push_back(shaders_vert_spv[i]);
-    
-    for (size_t i = 0; i < shaders_frag_spv_len; i++)
-      fragShaderCode.push_back(shaders_frag_spv[i]);
-    
-    auto vertModule = createShaderModule(vertShaderCode, device);
-    auto fragModule = createShaderModule(fragShaderCode, device);
-    
-    modules.push_back(vertModule);
-    modules.push_back(fragModule);
-    
-    vertShaderStageInfo.stage = vk::ShaderStageFlagBits::eVertex;
-    vertShaderStageInfo.module = vertModule;
-    vertShaderStageInfo.pName = "main";
-    
-    fragShaderStageInfo.stage = vk::ShaderStageFlagBits::eFragment;
-    fragShaderStageInfo.module = fragModule;
-    fragShaderStageInfo.pName = "main";
-  }
+  auto vertModule = createShaderModule(shaders_vert_spv, shaders_vert_spv_len, device);
+  auto fragModule = createShaderModule(shaders_frag_spv, shaders_frag_spv_len, device);
+  
+  modules.push_back(vertModule);
+  modules.push_back(fragModule);
+  
+  vertShaderStageInfo.stage = vk::ShaderStageFlagBits::eVertex;
+  vertShaderStageInfo.module = vertModule;
+  vertShaderStageInfo.pName = "main";
+  
+  fragShaderStageInfo.stage = vk::ShaderStageFlagBits::eFragment;
+  fragShaderStageInfo.module = fragModule;
+  fragShaderStageInfo.pName = "main";
   
   vk::PipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
   
@@ -113,12 +88,19 @@ void BulkinGraphicsPipeline::create(vk::Device &device, vk::PhysicalDevice& phys
   vk::DescriptorSetLayout descriptorSetLayouts[] = {descriptorSetLayout, ssboDescriptorSetLayout};
   pipelineLayoutInfo.setLayoutCount = 2;
   pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
+  
+  vk::PushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(DrawKind);
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
   
   vk::PipelineDepthStencilStateCreateInfo depthStencil{};
   depthStencil.depthTestEnable = vk::True;
-  depthStencil.depthWriteEnable = vk::True;
-  depthStencil.depthCompareOp = vk::CompareOp::eLess;
+  // after a prepass only the nearest fragment of each pixel gets shaded
+  depthStencil.depthWriteEnable = depthPrepass ? vk::False : vk::True;
+  depthStencil.depthCompareOp = depthPrepass ? vk::CompareOp::eEqual : vk::CompareOp::eLess;
   depthStencil.depthBoundsTestEnable = vk::False;
   depthStencil.stencilTestEnable = vk::False;
   
@@ -145,51 +127,68 @@ void BulkinGraphicsPipeline::create(vk::Device &device, vk::PhysicalDevice& phys
   pipelineInfo.layout = pipelineLayout;
   pipelineInfo.renderPass = nullptr;
   
-  auto [result, graphicsPipeline] = device.createGraphicsPipeline(nullptr, pipelineInfo);
+  auto [result, graphicsPipeline] = device.createGraphicsPipeline(pipelineCache, pipelineInfo);
   if (result != vk::Result::eSuccess)
     throw std::runtime_error("cannot create graphics pipeline");
     
   pipeline = graphicsPipeline;
   
+  if (depthPrepass) {
+    // same vertex stage and layout, no fragment stage and no colour writes
+    depthStencil.depthWriteEnable = vk::True;
+    depthStencil.depthCompareOp = vk::CompareOp::eLess;
+    colorBlendAttachment.colorWriteMask = {};
+    pipelineInfo.stageCount = 1;
+    pipelineInfo.pStages = &vertShaderStageInfo;
+    
+    auto [depthResult, prepassPipeline] = device.createGraphicsPipeline(pipelineCache, pipelineInfo);
+    if (depthResult != vk::Result::eSuccess)
+      throw std::runtime_error("cannot create depth prepass pipeline");
+    
+    depthPipeline = prepassPipeline;
+  }
+  
   for (auto shaderModule : modules)
     device.destroy(shaderModule);
 }
 
-std::vector<char> BulkinGraphicsPipeline::readFile(const std::string &filename) {
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
-  
-  if (!file.is_open())
-    throw std::runtime_error("failed to open file");
-  
-  size_t fileSize = (size_t) file.tellg();
-  std::vector<char> buffer(fileSize);
-  
-  file.seekg(0);
-  file.read(buffer.data(), fileSize);
-  
-  file.close();
-  return buffer;
-}
-
-vk::ShaderModule BulkinGraphicsPipeline::createShaderModule(const std::vector<char> &code, vk::Device& device) {
+vk::ShaderModule BulkinGraphicsPipeline::createShaderModule(const unsigned char* code, size_t codeSize, vk::Device& device) {
+  // the embedded arrays are emitted with alignas(4) so SPIR-V is read in place
   vk::ShaderModuleCreateInfo createInfo{};
-  createInfo.codeSize = code.size();
-  createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  createInfo.codeSize = codeSize;
+  createInfo.pCode = reinterpret_cast<const uint32_t*>(code);
   return device.createShaderModule(createInfo);
 }
 
-void BulkinGraphicsPipeline::cleanup(vk::Device &device) {
-  buffers.cleanup(device);
+void BulkinGraphicsPipeline::cleanup(vk::Device &device, BulkinAllocator &allocator) {
+  buffers.cleanup(device, allocator);
+  if (gpuCulling)
+    culling.cleanup(device);
+  if (occlusionCulling)
+    occlusion.cleanup(device, allocator);
+  clusters.cleanup(device);
+  profiler.cleanup(device);
   device.destroy(descriptorPool);
   device.destroy(descriptorSetLayout);
   device.destroy(ssboDescriptorSetLayout);
   device.destroy(ssboDescriptorPool);
   device.destroy(commandPool);
+  recorder.cleanup(device);
   device.destroy(pipelineLayout);
   device.destroy(pipeline);
+  if (depthPrepass)
+    device.destroy(depthPipeline);
   device.destroy(depthImage);
   device.destroy(depthImageView);
-  device.free(depthImageMemory);
+  allocator.free(depthImageMemory);
+  device.destroy(lightmapSampler);
+  device.destroy(lightmapImageView);
+  device.destroy(lightmapImage);
+  allocator.free(lightmapImageMemory);
+  device.destroy(wallGridSampler);
+  device.destroy(wallGridImageView);
+  device.destroy(wallGridImage);
+  allocator.free(wallGridImageMemory);
 }
 
 void BulkinGraphicsPipeline::createCommandPool(vk::Device &device, QueueFamilyIndices indices) {
@@ -210,10 +209,70 @@ void BulkinGraphicsPipeline::createCommandBuffers(vk::Device &device) {
   commandBuffers = device.allocateCommandBuffers(allocInfo);
 }
 
-void BulkinGraphicsPipeline::recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex, BulkinSwapchain& swapchain, uint32_t currentFrame, BulkinQuad quad, std::vector<BulkinModel>& models) {
+void BulkinGraphicsPipeline::createCachedCommandBuffers(vk::Device &device, uint32_t imageCount) {
+  cachedImageCount = imageCount;
+  vk::CommandBufferAllocateInfo allocInfo{};
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = vk::CommandBufferLevel::ePrimary;
+  allocInfo.commandBufferCount = imageCount * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  
+  cachedCommandBuffers = device.allocateCommandBuffers(allocInfo);
+  cachedCommandBuffersRecorded.assign(cachedCommandBuffers.size(), false);
+}
+
+void BulkinGraphicsPipeline::invalidateCachedCommandBuffers(vk::Device &device, uint32_t imageCount) {
+  if (!cachedCommandBuffers.empty())
+    device.freeCommandBuffers(commandPool, cachedCommandBuffers);
+  createCachedCommandBuffers(device, imageCount);
+}
+
+void BulkinGraphicsPipeline::rerecordCachedCommandBuffers() {
+  // each one is rerecorded when its frame slot next comes round, after the
+  // slot's fence, so none of them is still pending by then
+  cachedCommandBuffersRecorded.assign(cachedCommandBuffersRecorded.size(), false);
+}
+
+vk::CommandBuffer BulkinGraphicsPipeline::cachedCommandBuffer(uint32_t imageIndex, BulkinSwapchain &swapchain, uint32_t currentFrame, const BulkinQuad &quad) {
+  // the recording only depends on the frame slot (descriptor sets, culling
+  // buffers) and the swapchain image, so each pair is recorded once and then
+  // replayed until the swapchain or pipeline changes
+  size_t index = currentFrame * cachedImageCount + imageIndex;
+  if (!cachedCommandBuffersRecorded[index]) {
+    recordCommandBuffer(cachedCommandBuffers[index], imageIndex, swapchain, currentFrame, quad);
+    cachedCommandBuffersRecorded[index] = true;
+  }
+  return cachedCommandBuffers[index];
+}
+
+void BulkinGraphicsPipeline::recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex, BulkinSwapchain& swapchain, uint32_t currentFrame, const BulkinQuad& quad) {
   vk::CommandBufferBeginInfo beginInfo{};
   commandBuffer.begin(beginInfo);
   
+  if (gpuProfiling)
+    profiler.reset(commandBuffer, currentFrame);
+  
+  if (gpuCulling) {
+    if (gpuProfiling)
+      profiler.beginPass(commandBuffer, currentFrame, ProfilerPass::Culling);
+    culling.record(commandBuffer, buffers, currentFrame, quad.getInstanceCount());
+    if (gpuProfiling)
+      profiler.endPass(commandBuffer, currentFrame, ProfilerPass::Culling);
+  }
+  
+  if (occlusionCulling) {
+    if (gpuProfiling)
+      profiler.beginPass(commandBuffer, currentFrame, ProfilerPass::Occlusion);
+    occlusion.recordTest(commandBuffer, buffers, currentFrame, OcclusionPhase::Early);
+    if (gpuProfiling)
+      profiler.endPass(commandBuffer, currentFrame, ProfilerPass::Occlusion);
+  }
+  
+  if (gpuProfiling)
+    profiler.beginPass(commandBuffer, currentFrame, ProfilerPass::Clusters);
+  clusters.record(commandBuffer, currentFrame);
+  if (gpuProfiling)
+    profiler.endPass(commandBuffer, currentFrame, ProfilerPass::Clusters);
+  
   transitionImageLayout(imageIndex,
                         commandBuffer,
                         swapchain,
@@ -237,7 +296,8 @@ void BulkinGraphicsPipeline::recordCommandBuffer(vk::CommandBuffer commandBuffer
   depthAttachmentInfo.imageView = depthImageView;
   depthAttachmentInfo.imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
   depthAttachmentInfo.loadOp = vk::AttachmentLoadOp::eClear;
-  depthAttachmentInfo.storeOp = vk::AttachmentStoreOp::eDontCare;
+  // the depth pyramid is built from the first half of the pass
+  depthAttachmentInfo.storeOp = occlusionCulling ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
   depthAttachmentInfo.clearValue = clearDepth;
   
   vk::RenderingInfo renderingInfo{};
@@ -248,36 +308,61 @@ void BulkinGraphicsPipeline::recordCommandBuffer(vk::CommandBuffer commandBuffer
   renderingInfo.pColorAttachments = &attachmentInfo;
   renderingInfo.pDepthAttachment = &depthAttachmentInfo;
   
-  commandBuffer.beginRendering(renderingInfo);
-  
-  commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
-  commandBuffer.setViewport(0, vk::Viewport(0.0f, 0.0f, static_cast<float>(swapchain.extent.width), static_cast<float>(swapchain.extent.height), 0.0f, 1.0f));
-  commandBuffer.setScissor(0, vk::Rect2D(vk::Offset2D(0, 0), swapchain.extent));
+  // cached recordings are replayed long after the frame's pools were reset,
+  // so they always record inline
+  auto parallel = parallelRecording && !cachedRecording && recorder.workerCount() > 1;
+  buildDrawWork(quad.getInstanceCount(), parallel ? recorder.workerCount() : 1);
+  parallel = parallel && drawWork.size() > 1;
+  uint32_t passes = depthPrepass ? 2 : 1;
+  if (parallel)
+    renderingInfo.flags = vk::RenderingFlagBits::eContentsSecondaryCommandBuffers;
   
-  vk::Buffer vertexBuffers[] = {buffers.quadVertexBuffer};
-  vk::DeviceSize offsets[] = {0};
-  commandBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
-  commandBuffer.bindIndexBuffer(buffers.quadIndexBuffer, 0, vk::IndexType::eUint32);
+  if (gpuProfiling)
+    profiler.beginPass(commandBuffer, currentFrame, ProfilerPass::Main, parallel);
   
-  vk::DescriptorSet descriptorSet[] = {descriptorSets[currentFrame], ssboDescriptorSets[currentFrame]};
-  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 2, descriptorSet, 0, nullptr);
-
-  commandBuffer.drawIndexed(static_cast<uint32_t>(quadIndices.size()), quad.getInstanceCount(), 0, 0, 0);
+  commandBuffer.beginRendering(renderingInfo);
   
-  for (size_t i = 0; i < models.size(); i++) {
-    vk::Buffer modelVertexBuffers[] = {buffers.modelVertexBuffers[i]};
-    commandBuffer.bindVertexBuffers(0, 1, modelVertexBuffers, offsets);
-    commandBuffer.bindIndexBuffer(buffers.modelIndexBuffers[i], 0, vk::IndexType::eUint32);
-    commandBuffer.drawIndexed(models[i].getIndicesSize(), 1, 0, 0, quad.getInstanceCount());
+  if (parallel) {
+    vk::CommandBufferInheritanceRenderingInfo inheritanceRenderingInfo{};
+    inheritanceRenderingInfo.colorAttachmentCount = 1;
+    inheritanceRenderingInfo.pColorAttachmentFormats = &swapchain.imageFormat;
+    inheritanceRenderingInfo.depthAttachmentFormat = depthFormat;
+    inheritanceRenderingInfo.rasterizationSamples = vk::SampleCountFlagBits::e1;
+    vk::CommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.pNext = &inheritanceRenderingInfo;
+    // the main pass' statistics query stays active while they run
+    if (gpuProfiling)
+      inheritanceInfo.pipelineStatistics = profiler.inheritedStatistics();
+    
+    // with the prepass every piece is recorded twice, and all of the depth
+    // only copies come first
+    auto extent = swapchain.extent;
+    auto count = static_cast<uint32_t>(drawWork.size());
+    auto secondaries = recorder.record(currentFrame, count * passes, inheritanceInfo, [this, extent, currentFrame, count](vk::CommandBuffer secondary, uint32_t i) {
+      recordDrawWork(secondary, extent, currentFrame, drawWork[i % count], depthPrepass && i < count);
+    });
+    commandBuffer.executeCommands(static_cast<uint32_t>(secondaries.size()), secondaries.data());
+  } else {
+    for (uint32_t pass = 0; pass < passes; pass++) {
+      for (const auto& work : drawWork)
+        recordDrawWork(commandBuffer, swapchain.extent, currentFrame, work, depthPrepass && pass == 0);
+    }
   }
   
   commandBuffer.endRendering();
   
+  // statistics queries cannot nest, so the late half gets passes of its own
+  if (gpuProfiling)
+    profiler.endPass(commandBuffer, currentFrame, ProfilerPass::Main, parallel);
+  
+  if (occlusionCulling)
+    recordLateModels(commandBuffer, swapchain.extent, currentFrame, renderingInfo);
+  
   transitionImageLayout(imageIndex,
                         commandBuffer,
                         swapchain,
                         vk::ImageLayout::eColorAttachmentOptimal,
-                        vk::ImageLayout::ePresentSrcKHR,
+                        swapchain.finalLayout,
                         vk::AccessFlagBits2::eColorAttachmentWrite,
                         {},
                         vk::PipelineStageFlagBits2::eColorAttachmentOutput,
@@ -286,6 +371,140 @@ void BulkinGraphicsPipeline::recordCommandBuffer(vk::CommandBuffer commandBuffer
   commandBuffer.end();
 }
 
+void BulkinGraphicsPipeline::buildDrawWork(uint32_t quadCount, uint32_t workers) {
+  // the work list keeps its capacity between frames
+  drawWork.clear();
+  if (gpuCulling) {
+    // every bucket is a single indirect draw however many quads land in it,
+    // so the buckets are shared out between the workers as they are
+    auto slices = std::min(workers, CULL_DEPTH_BUCKETS);
+    for (uint32_t slice = 0; slice < slices; slice++) {
+      auto first = slice * CULL_DEPTH_BUCKETS / slices;
+      auto last = (slice + 1) * CULL_DEPTH_BUCKETS / slices;
+      drawWork.push_back({DrawKind::Quads, first, last - first, true});
+    }
+  } else {
+    addDrawWork(DrawKind::Quads, quadCount, workers);
+  }
+  if (occlusionCulling)
+    drawWork.push_back({DrawKind::Models, 0, 0, true});
+  else
+    addDrawWork(DrawKind::Models, buffers.modelDrawCount, workers);
+}
+
+void BulkinGraphicsPipeline::addDrawWork(DrawKind kind, uint32_t count, uint32_t workers) {
+  if (count == 0)
+    return;
+  
+  auto chunks = std::clamp(count / MIN_INSTANCES_PER_DRAW_WORK, 1u, workers);
+  auto chunkSize = (count + chunks - 1) / chunks;
+  for (uint32_t first = 0; first < count; first += chunkSize)
+    drawWork.push_back({kind, first, std::min(chunkSize, count - first), false});
+}
+
+void BulkinGraphicsPipeline::recordDrawWork(vk::CommandBuffer commandBuffer, vk::Extent2D extent, uint32_t currentFrame, const DrawWork& work, bool depthOnly) {
+  // secondaries inherit none of this, so every piece binds its own state
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, depthOnly ? depthPipeline : pipeline);
+  commandBuffer.setViewport(0, vk::Viewport(0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f));
+  commandBuffer.setScissor(0, vk::Rect2D(vk::Offset2D(0, 0), extent));
+  
+  vk::DescriptorSet descriptorSet[] = {descriptorSets[currentFrame], ssboDescriptorSets[currentFrame]};
+  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 2, descriptorSet, 0, nullptr);
+  commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(DrawKind), &work.kind);
+  
+  vk::DeviceSize offsets[] = {0};
+  if (work.kind == DrawKind::Quads) {
+    vk::Buffer vertexBuffers[] = {buffers.quadVertexBuffer};
+    commandBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
+    commandBuffer.bindIndexBuffer(buffers.quadIndexBuffer, 0, vk::IndexType::eUint32);
+    // the draw count is counted from the first bucket of the run, so a run
+    // may draw a few empty buckets past the last full one but never skips one
+    if (work.culled)
+      commandBuffer.drawIndexedIndirectCount(buffers.drawCommandBuffers[currentFrame], sizeof(vk::DrawIndexedIndirectCommand) * work.first, buffers.drawCommandBuffers[currentFrame], offsetof(CulledDrawCommand, drawCount), work.count, sizeof(vk::DrawIndexedIndirectCommand));
+    else
+      commandBuffer.drawIndexed(static_cast<uint32_t>(quadIndices.size()), work.count, 0, 0, work.first);
+  } else {
+    vk::Buffer modelVertexBuffers[] = {buffers.modelVertexBuffer};
+    commandBuffer.bindVertexBuffers(0, 1, modelVertexBuffers, offsets);
+    commandBuffer.bindIndexBuffer(buffers.modelIndexBuffer, 0, vk::IndexType::eUint32);
+    if (work.culled) {
+      auto drawBuffer = work.late ? buffers.lateModelDrawBuffers[currentFrame] : buffers.earlyModelDrawBuffers[currentFrame];
+      commandBuffer.drawIndexedIndirectCount(drawBuffer, 0, buffers.modelDrawCountBuffers[currentFrame], work.late ? sizeof(uint32_t) : 0, buffers.modelDrawCount, sizeof(vk::DrawIndexedIndirectCommand));
+    } else {
+      commandBuffer.drawIndexedIndirect(buffers.modelDrawCommandBuffer, sizeof(vk::DrawIndexedIndirectCommand) * work.first, work.count, sizeof(vk::DrawIndexedIndirectCommand));
+    }
+  }
+}
+
+void BulkinGraphicsPipeline::recordLateModels(vk::CommandBuffer commandBuffer, vk::Extent2D extent, uint32_t currentFrame, vk::RenderingInfo renderingInfo) {
+  // the pyramid is rebuilt from everything drawn so far, the models the early
+  // test rejected are retested against it and the ones that show up now are
+  // drawn on top. the late models never reach the pyramid, which only makes
+  // next frame's early test more conservative
+  transitionDepthImage(commandBuffer, true);
+  if (gpuProfiling)
+    profiler.beginPass(commandBuffer, currentFrame, ProfilerPass::Pyramid);
+  occlusion.recordPyramid(commandBuffer);
+  if (gpuProfiling) {
+    profiler.endPass(commandBuffer, currentFrame, ProfilerPass::Pyramid);
+    profiler.beginPass(commandBuffer, currentFrame, ProfilerPass::Late);
+  }
+  occlusion.recordTest(commandBuffer, buffers, currentFrame, OcclusionPhase::Late);
+  transitionDepthImage(commandBuffer, false);
+  
+  auto colorAttachment = *renderingInfo.pColorAttachments;
+  auto depthAttachment = *renderingInfo.pDepthAttachment;
+  colorAttachment.loadOp = vk::AttachmentLoadOp::eLoad;
+  depthAttachment.loadOp = vk::AttachmentLoadOp::eLoad;
+  renderingInfo.flags = {};
+  renderingInfo.pColorAttachments = &colorAttachment;
+  renderingInfo.pDepthAttachment = &depthAttachment;
+  
+  DrawWork late{DrawKind::Models, 0, 0, true, true};
+  commandBuffer.beginRendering(renderingInfo);
+  if (depthPrepass)
+    recordDrawWork(commandBuffer, extent, currentFrame, late, true);
+  recordDrawWork(commandBuffer, extent, currentFrame, late, false);
+  commandBuffer.endRendering();
+  if (gpuProfiling)
+    profiler.endPass(commandBuffer, currentFrame, ProfilerPass::Late);
+}
+
+void BulkinGraphicsPipeline::transitionDepthImage(vk::CommandBuffer commandBuffer, bool sampled) {
+  vk::ImageMemoryBarrier2 barrier{};
+  if (sampled) {
+    barrier.srcStageMask = vk::PipelineStageFlagBits2::eLateFragmentTests;
+    barrier.srcAccessMask = vk::AccessFlagBits2::eDepthStencilAttachmentWrite;
+    barrier.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+    barrier.dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead;
+    barrier.oldLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    barrier.newLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+  } else {
+    barrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+    barrier.srcAccessMask = {};
+    barrier.dstStageMask = vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests;
+    barrier.dstAccessMask = vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite;
+    barrier.oldLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+    barrier.newLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+  }
+  barrier.srcQueueFamilyIndex = vk::QueueFamilyIgnored;
+  barrier.dstQueueFamilyIndex = vk::QueueFamilyIgnored;
+  barrier.image = depthImage;
+  barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eDepth;
+  if (hasStencilComponent(depthFormat))
+    barrier.subresourceRange.aspectMask |= vk::ImageAspectFlagBits::eStencil;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+  
+  vk::DependencyInfo dependencyInfo{};
+  dependencyInfo.imageMemoryBarrierCount = 1;
+  dependencyInfo.pImageMemoryBarriers = &barrier;
+  
+  commandBuffer.pipelineBarrier2(dependencyInfo);
+}
+
 void BulkinGraphicsPipeline::transitionImageLayout(uint32_t imageIndex,
                                                    vk::CommandBuffer commandBuffer,
                                                    BulkinSwapchain& swapchain,
@@ -319,10 +538,77 @@ void BulkinGraphicsPipeline::transitionImageLayout(uint32_t imageIndex,
   commandBuffer.pipelineBarrier2(dependencyInfo);
 }
 
-void BulkinGraphicsPipeline::createBuffers(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::Queue& graphicsQueue, BulkinQuad quad, std::vector<BulkinTexture>& textures, std::vector<PointLight>& pointLights, std::vector<BulkinModel>& models) {
-  buffers.createBuffers(device, physicalDevice, commandPool, graphicsQueue, quad, pointLights, models);
-  createDescriptorPool(device, static_cast<uint32_t>(textures.size()));
-  createDescriptorSets(device, quad, textures, pointLights);
+void BulkinGraphicsPipeline::createBuffers(vk::Device& device, BulkinAllocator& allocator, BulkinUploader& uploader, const BulkinQuad& quad, std::span<BulkinTexture> textures, BulkinTextureSet& textureSet, std::span<const PointLight> pointLights, std::span<const BulkinModel> models, const BulkinLightmap& lightmap, const WallGrid& walls) {
+  // recorded into the uploader's batch, which the buffers flush
+  createLightmapImage(device, allocator, uploader, lightmap);
+  createWallGridImage(device, allocator, uploader, walls);
+  buffers.wallHeight = gridShadows && !walls.cells.empty() ? walls.height : 0.0f;
+  buffers.createBuffers(device, allocator, uploader, quad, textureSet.slots, pointLights, models, lightmap);
+  createDescriptorPool(device, textureSet.bindlessCount());
+  createDescriptorSets(device, textures, textureSet, pointLights);
+  if (gpuCulling)
+    culling.createDescriptorSets(device, buffers);
+  if (occlusionCulling)
+    occlusion.createDescriptorSets(device, buffers);
+  clusters.createDescriptorSets(device, buffers);
+}
+
+void BulkinGraphicsPipeline::createLightmapImage(vk::Device& device, BulkinAllocator& allocator, BulkinUploader& uploader, const BulkinLightmap& lightmap) {
+  constexpr auto format = vk::Format::eR16G16B16A16Sfloat;
+  std::vector<uint64_t> blank(1, 0);
+  const auto& texels = lightmap.empty() ? blank : lightmap.getTexels();
+  uint32_t width = lightmap.empty() ? 1 : lightmap.getWidth();
+  uint32_t height = lightmap.empty() ? 1 : lightmap.getHeight();
+  
+  Bulkin::createImage(width, height, format, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal, device, allocator, lightmapImage, lightmapImageMemory, 1);
+  uploadImage(uploader, lightmapImage, format, width, height, texels.data(), sizeof(uint64_t) * texels.size());
+  lightmapImageView = Bulkin::createImageView(device, lightmapImage, format, vk::ImageAspectFlagBits::eColor, 1);
+  
+  // every face has a border of its own edge texels, so bilinear filtering
+  // never reaches the next rectangle
+  vk::SamplerCreateInfo samplerInfo{};
+  samplerInfo.magFilter = vk::Filter::eLinear;
+  samplerInfo.minFilter = vk::Filter::eLinear;
+  samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+  lightmapSampler = device.createSampler(samplerInfo);
+}
+
+void BulkinGraphicsPipeline::createWallGridImage(vk::Device& device, BulkinAllocator& allocator, BulkinUploader& uploader, const WallGrid& walls) {
+  constexpr auto format = vk::Format::eR8Uint;
+  std::vector<uint8_t> open(1, 0);
+  const auto& cells = walls.cells.empty() ? open : walls.cells;
+  uint32_t width = walls.cells.empty() ? 1 : walls.width;
+  uint32_t height = walls.cells.empty() ? 1 : walls.depth;
+  
+  Bulkin::createImage(width, height, format, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal, device, allocator, wallGridImage, wallGridImageMemory, 1);
+  uploadImage(uploader, wallGridImage, format, width, height, cells.data(), cells.size());
+  wallGridImageView = Bulkin::createImageView(device, wallGridImage, format, vk::ImageAspectFlagBits::eColor, 1);
+  
+  // only ever read with texelFetch
+  vk::SamplerCreateInfo samplerInfo{};
+  samplerInfo.magFilter = vk::Filter::eNearest;
+  samplerInfo.minFilter = vk::Filter::eNearest;
+  samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+  wallGridSampler = device.createSampler(samplerInfo);
+}
+
+void BulkinGraphicsPipeline::uploadImage(BulkinUploader& uploader, vk::Image image, vk::Format format, uint32_t width, uint32_t height, const void* texels, vk::DeviceSize size) {
+  auto stagingOffset = uploader.stage(texels, size);
+  auto commandBuffer = uploader.commandBuffer();
+  Bulkin::transitionImageLayout(commandBuffer, format, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, image, 1);
+  vk::BufferImageCopy region{};
+  region.bufferOffset = uploader.stagingBufferOffset(stagingOffset);
+  region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = vk::Extent3D{width, height, 1};
+  commandBuffer.copyBufferToImage(uploader.stagingBuffer(stagingOffset), image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+  Bulkin::transitionImageLayout(commandBuffer, format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, image, 1);
 }
 
 void BulkinGraphicsPipeline::createDescriptorLayout(vk::Device& device, uint32_t textureCount) {
@@ -330,7 +616,7 @@ void BulkinGraphicsPipeline::createDescriptorLayout(vk::Device& device, uint32_t
   uboLayoutBinding.binding = 0;
   uboLayoutBinding.descriptorType = vk::DescriptorType::eUniformBuffer;
   uboLayoutBinding.descriptorCount = 1;
-  uboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  uboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
   
   vk::DescriptorSetLayoutBinding samplerLayoutBinding{};
   samplerLayoutBinding.binding = 1;
@@ -345,7 +631,34 @@ void BulkinGraphicsPipeline::createDescriptorLayout(vk::Device& device, uint32_t
   pointLightBinding.descriptorCount = 1;
   pointLightBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
   
-  std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {uboLayoutBinding, samplerLayoutBinding, pointLightBinding};
+  vk::DescriptorSetLayoutBinding clusterLightBinding{};
+  clusterLightBinding.binding = 3;
+  clusterLightBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+  clusterLightBinding.descriptorCount = 1;
+  clusterLightBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+  
+  vk::DescriptorSetLayoutBinding tileArrayBinding{};
+  tileArrayBinding.binding = 4;
+  tileArrayBinding.descriptorCount = 1;
+  tileArrayBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  tileArrayBinding.pImmutableSamplers = nullptr;
+  tileArrayBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+  
+  vk::DescriptorSetLayoutBinding lightmapBinding{};
+  lightmapBinding.binding = 5;
+  lightmapBinding.descriptorCount = 1;
+  lightmapBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  lightmapBinding.pImmutableSamplers = nullptr;
+  lightmapBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+  
+  vk::DescriptorSetLayoutBinding wallGridBinding{};
+  wallGridBinding.binding = 6;
+  wallGridBinding.descriptorCount = 1;
+  wallGridBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  wallGridBinding.pImmutableSamplers = nullptr;
+  wallGridBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+  
+  std::array<vk::DescriptorSetLayoutBinding, 7> bindings = {uboLayoutBinding, samplerLayoutBinding, pointLightBinding, clusterLightBinding, tileArrayBinding, lightmapBinding, wallGridBinding};
   vk::DescriptorSetLayoutCreateInfo layoutInfo{};
   layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
   layoutInfo.pBindings = bindings.data();
@@ -358,9 +671,28 @@ void BulkinGraphicsPipeline::createDescriptorLayout(vk::Device& device, uint32_t
   ssboLayoutBinding.descriptorCount = 1;
   ssboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
   
+  vk::DescriptorSetLayoutBinding visibleLayoutBinding{};
+  visibleLayoutBinding.binding = 1;
+  visibleLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+  visibleLayoutBinding.descriptorCount = 1;
+  visibleLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  
+  vk::DescriptorSetLayoutBinding modelInstanceLayoutBinding{};
+  modelInstanceLayoutBinding.binding = 2;
+  modelInstanceLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+  modelInstanceLayoutBinding.descriptorCount = 1;
+  modelInstanceLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  
+  vk::DescriptorSetLayoutBinding lightmapRectLayoutBinding{};
+  lightmapRectLayoutBinding.binding = 3;
+  lightmapRectLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+  lightmapRectLayoutBinding.descriptorCount = 1;
+  lightmapRectLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  
+  std::array<vk::DescriptorSetLayoutBinding, 4> ssboBindings = {ssboLayoutBinding, visibleLayoutBinding, modelInstanceLayoutBinding, lightmapRectLayoutBinding};
   vk::DescriptorSetLayoutCreateInfo ssboLayoutInfo{};
-  ssboLayoutInfo.bindingCount = 1;
-  ssboLayoutInfo.pBindings = &ssboLayoutBinding;
+  ssboLayoutInfo.bindingCount = static_cast<uint32_t>(ssboBindings.size());
+  ssboLayoutInfo.pBindings = ssboBindings.data();
   
   ssboDescriptorSetLayout = device.createDescriptorSetLayout(ssboLayoutInfo);
 }
@@ -370,9 +702,9 @@ void BulkinGraphicsPipeline::createDescriptorPool(vk::Device &device, uint32_t t
   poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
   poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
   poolSizes[1].type = vk::DescriptorType::eCombinedImageSampler;
-  poolSizes[1].descriptorCount = textureCount * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  poolSizes[1].descriptorCount = (textureCount + 3) * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
   poolSizes[2].type = vk::DescriptorType::eStorageBuffer;
-  poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  poolSizes[2].descriptorCount = 2 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
   
   vk::DescriptorPoolCreateInfo poolInfo{};
   poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
@@ -383,7 +715,7 @@ void BulkinGraphicsPipeline::createDescriptorPool(vk::Device &device, uint32_t t
   
   vk::DescriptorPoolSize ssboPoolSize;
   ssboPoolSize.type = vk::DescriptorType::eStorageBuffer;
-  ssboPoolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  ssboPoolSize.descriptorCount = 4 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
     
   vk::DescriptorPoolCreateInfo ssboPoolInfo{};
   ssboPoolInfo.poolSizeCount = 1;
@@ -393,7 +725,7 @@ void BulkinGraphicsPipeline::createDescriptorPool(vk::Device &device, uint32_t t
   ssboDescriptorPool = device.createDescriptorPool(ssboPoolInfo);
 }
 
-void BulkinGraphicsPipeline::createDescriptorSets(vk::Device &device, BulkinQuad quad, std::vector<BulkinTexture>& textures, std::vector<PointLight>& pointLights) {
+void BulkinGraphicsPipeline::createDescriptorSets(vk::Device &device, std::span<BulkinTexture> textures, BulkinTextureSet& textureSet, std::span<const PointLight> pointLights) {
   std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
   vk::DescriptorSetAllocateInfo allocInfo{};
   allocInfo.descriptorPool = descriptorPool;
@@ -418,27 +750,64 @@ void BulkinGraphicsPipeline::createDescriptorSets(vk::Device &device, BulkinQuad
     uniformBufferInfo.offset = 0;
     uniformBufferInfo.range = sizeof(UniformBufferObject);
     
+    // every tile in the array shares one descriptor, only the loose textures
+    // take a bindless slot
     std::vector<vk::DescriptorImageInfo> imageInfos{};
-    imageInfos.resize(textures.size());
-    for (size_t i = 0; i < textures.size(); i++) {
+    imageInfos.resize(textureSet.bindlessCount());
+    for (size_t i = 0; i < imageInfos.size(); i++) {
       vk::DescriptorImageInfo imageInfo{};
       imageInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-      imageInfo.imageView = textures[i].imageView;
-      imageInfo.sampler = textures[i].sampler;
+      imageInfo.imageView = textureSet.looseTextures.empty() ? textureSet.firstLayerView : textures[textureSet.looseTextures[i]].imageView;
+      imageInfo.sampler = textureSet.sampler;
       imageInfos[i] = imageInfo;
     }
     
+    vk::DescriptorImageInfo tileArrayInfo{};
+    tileArrayInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    tileArrayInfo.imageView = textureSet.arrayView;
+    tileArrayInfo.sampler = textureSet.sampler;
+    
+    vk::DescriptorImageInfo lightmapInfo{};
+    lightmapInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    lightmapInfo.imageView = lightmapImageView;
+    lightmapInfo.sampler = lightmapSampler;
+    
+    vk::DescriptorImageInfo wallGridInfo{};
+    wallGridInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    wallGridInfo.imageView = wallGridImageView;
+    wallGridInfo.sampler = wallGridSampler;
+    
     vk::DescriptorBufferInfo pointLightBufferInfo{};
     pointLightBufferInfo.buffer = buffers.pointLightBuffer;
     pointLightBufferInfo.offset = 0;
-    pointLightBufferInfo.range = sizeof(pointLights[0]) * pointLights.size();
+    pointLightBufferInfo.range = pointLights.size_bytes();
     
     vk::DescriptorBufferInfo ssboBufferInfo{};
-    ssboBufferInfo.buffer = buffers.ssboBuffer;
+    ssboBufferInfo.buffer = buffers.ssboBuffers[i];
     ssboBufferInfo.offset = 0;
-    ssboBufferInfo.range = sizeof(PerInstanceData) * quad.getInstanceCount();
+    ssboBufferInfo.range = vk::WholeSize;
+    
+    vk::DescriptorBufferInfo visibleBufferInfo{};
+    visibleBufferInfo.buffer = buffers.visibleBuffers[i];
+    visibleBufferInfo.offset = 0;
+    visibleBufferInfo.range = vk::WholeSize;
+    
+    vk::DescriptorBufferInfo clusterLightBufferInfo{};
+    clusterLightBufferInfo.buffer = buffers.clusterLightBuffers[i];
+    clusterLightBufferInfo.offset = 0;
+    clusterLightBufferInfo.range = vk::WholeSize;
     
-    std::array<vk::WriteDescriptorSet, 4> descriptorWrites{};
+    vk::DescriptorBufferInfo modelInstanceBufferInfo{};
+    modelInstanceBufferInfo.buffer = buffers.modelInstanceBuffers[i];
+    modelInstanceBufferInfo.offset = 0;
+    modelInstanceBufferInfo.range = vk::WholeSize;
+    
+    vk::DescriptorBufferInfo lightmapRectBufferInfo{};
+    lightmapRectBufferInfo.buffer = buffers.lightmapRectBuffers[i];
+    lightmapRectBufferInfo.offset = 0;
+    lightmapRectBufferInfo.range = vk::WholeSize;
+    
+    std::array<vk::WriteDescriptorSet, 11> descriptorWrites{};
     
     descriptorWrites[0].dstSet = descriptorSets[i];
     descriptorWrites[0].dstBinding = 0;
@@ -468,25 +837,84 @@ void BulkinGraphicsPipeline::createDescriptorSets(vk::Device &device, BulkinQuad
     descriptorWrites[3].descriptorCount = 1;
     descriptorWrites[3].pBufferInfo = &ssboBufferInfo;
     
+    descriptorWrites[4].dstSet = ssboDescriptorSets[i];
+    descriptorWrites[4].dstBinding = 1;
+    descriptorWrites[4].dstArrayElement = 0;
+    descriptorWrites[4].descriptorType = vk::DescriptorType::eStorageBuffer;
+    descriptorWrites[4].descriptorCount = 1;
+    descriptorWrites[4].pBufferInfo = &visibleBufferInfo;
+    
+    descriptorWrites[5].dstSet = ssboDescriptorSets[i];
+    descriptorWrites[5].dstBinding = 2;
+    descriptorWrites[5].dstArrayElement = 0;
+    descriptorWrites[5].descriptorType = vk::DescriptorType::eStorageBuffer;
+    descriptorWrites[5].descriptorCount = 1;
+    descriptorWrites[5].pBufferInfo = &modelInstanceBufferInfo;
+    
+    descriptorWrites[6].dstSet = descriptorSets[i];
+    descriptorWrites[6].dstBinding = 3;
+    descriptorWrites[6].dstArrayElement = 0;
+    descriptorWrites[6].descriptorType = vk::DescriptorType::eStorageBuffer;
+    descriptorWrites[6].descriptorCount = 1;
+    descriptorWrites[6].pBufferInfo = &clusterLightBufferInfo;
+    
+    descriptorWrites[7].dstSet = descriptorSets[i];
+    descriptorWrites[7].dstBinding = 4;
+    descriptorWrites[7].dstArrayElement = 0;
+    descriptorWrites[7].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    descriptorWrites[7].descriptorCount = 1;
+    descriptorWrites[7].pImageInfo = &tileArrayInfo;
+    
+    descriptorWrites[8].dstSet = descriptorSets[i];
+    descriptorWrites[8].dstBinding = 5;
+    descriptorWrites[8].dstArrayElement = 0;
+    descriptorWrites[8].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    descriptorWrites[8].descriptorCount = 1;
+    descriptorWrites[8].pImageInfo = &lightmapInfo;
+    
+    descriptorWrites[9].dstSet = ssboDescriptorSets[i];
+    descriptorWrites[9].dstBinding = 3;
+    descriptorWrites[9].dstArrayElement = 0;
+    descriptorWrites[9].descriptorType = vk::DescriptorType::eStorageBuffer;
+    descriptorWrites[9].descriptorCount = 1;
+    descriptorWrites[9].pBufferInfo = &lightmapRectBufferInfo;
+    
+    descriptorWrites[10].dstSet = descriptorSets[i];
+    descriptorWrites[10].dstBinding = 6;
+    descriptorWrites[10].dstArrayElement = 0;
+    descriptorWrites[10].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    descriptorWrites[10].descriptorCount = 1;
+    descriptorWrites[10].pImageInfo = &wallGridInfo;
+    
     device.updateDescriptorSets(static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
   }
 }
 
-void BulkinGraphicsPipeline::createDepthResources(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::Queue graphicsQueue, uint32_t width, uint32_t height) {
-  auto depthFormat = findDepthFormat(physicalDevice);
+void BulkinGraphicsPipeline::createDepthResources(vk::Device& device, vk::PhysicalDevice& physicalDevice, BulkinAllocator& allocator, vk::Queue graphicsQueue, uint32_t width, uint32_t height) {
+  depthFormat = findDepthFormat(physicalDevice);
+  
+  // a resize lands here again, hand the old attachment back first
+  if (depthImage) {
+    device.destroy(depthImageView);
+    device.destroy(depthImage);
+    allocator.free(depthImageMemory);
+  }
   
   Bulkin::createImage(width,
                       height,
                       depthFormat,
                       vk::ImageTiling::eOptimal,
-                      vk::ImageUsageFlagBits::eDepthStencilAttachment,
+                      occlusionCulling ? vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled : vk::ImageUsageFlagBits::eDepthStencilAttachment,
                       vk::MemoryPropertyFlagBits::eDeviceLocal,
                       device,
-                      physicalDevice,
+                      allocator,
                       depthImage,
-                      depthImageMemory, 1);
+                      depthImageMemory, 1,
+                      AllocationCategory::Attachment);
   depthImageView = Bulkin::createImageView(device, depthImage, depthFormat, vk::ImageAspectFlagBits::eDepth, 1);
   Bulkin::transitionImageLayout(device, commandPool, graphicsQueue, depthFormat, vk::ImageLayout::eUndefined, vk::ImageLayout::eDepthStencilAttachmentOptimal, depthImage, 1);
+  if (occlusionCulling)
+    occlusion.createPyramid(device, allocator, commandPool, graphicsQueue, depthImageView, width, height);
 }
 
 vk::Format BulkinGraphicsPipeline::findSupportedFormat(const std::vector<vk::Format> &candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features, vk::PhysicalDevice& physicalDevice) {
@@ -503,7 +931,9 @@ vk::Format BulkinGraphicsPipeline::findSupportedFormat(const std::vector<vk::For
 }
 
 vk::Format BulkinGraphicsPipeline::findDepthFormat(vk::PhysicalDevice& physicalDevice) {
-  return findSupportedFormat({vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint, vk::Format::eD24UnormS8Uint}, vk::ImageTiling::eOptimal, vk::FormatFeatureFlagBits::eDepthStencilAttachment, physicalDevice);
+  // the depth pyramid samples the attachment
+  auto features = occlusionCulling ? vk::FormatFeatureFlagBits::eDepthStencilAttachment | vk::FormatFeatureFlagBits::eSampledImage : vk::FormatFeatureFlagBits::eDepthStencilAttachment;
+  return findSupportedFormat({vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint, vk::Format::eD24UnormS8Uint}, vk::ImageTiling::eOptimal, features, physicalDevice);
 }
 
 bool BulkinGraphicsPipeline::hasStencilComponent(vk::Format format) {
@@ -0,0 +1,120 @@
+#include "job-pool.h"
+
+#include <algorithm>
+
+static thread_local uint32_t currentWorker = 0;
+
+void BulkinJobPool::create(uint32_t threadCount) {
+  // the level is loaded on the pool before the device exists, so a second
+  // create keeps the workers already running
+  if (!workers.empty())
+    return;
+  stopping = false;
+  threadCount = std::max(threadCount, 1u);
+  workers.reserve(threadCount);
+  for (uint32_t i = 0; i < threadCount; i++)
+    workers.emplace_back(&BulkinJobPool::work, this, i);
+}
+
+void BulkinJobPool::submit(std::function<void()> job) {
+  {
+    std::lock_guard lock(mutex);
+    jobs.push_back(std::move(job));
+  }
+  available.notify_one();
+}
+
+void BulkinJobPool::wait() {
+  std::unique_lock lock(mutex);
+  idle.wait(lock, [this]() { return jobs.empty() && running == 0; });
+}
+
+void BulkinJobPool::run(Batch &batch) {
+  if (batch.count == 0)
+    return;
+  {
+    std::lock_guard lock(mutex);
+    batch.following = batches;
+    batches = &batch;
+  }
+  available.notify_all();
+
+  // every worker that took the batch has unlinked it and let go by the time
+  // all indices are finished, so it is safe to leave the caller's stack
+  std::unique_lock lock(mutex);
+  batchDone.wait(lock, [&batch]() {
+    return batch.finished == batch.count && batch.workers == 0;
+  });
+}
+
+void BulkinJobPool::unlink(Batch &batch) {
+  for (auto **link = &batches; *link; link = &(*link)->following) {
+    if (*link == &batch) {
+      *link = batch.following;
+      return;
+    }
+  }
+}
+
+void BulkinJobPool::cleanup() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  available.notify_all();
+  for (auto &worker : workers)
+    worker.join();
+  workers.clear();
+}
+
+uint32_t BulkinJobPool::workerIndex() { return currentWorker; }
+
+void BulkinJobPool::work(uint32_t index) {
+  currentWorker = index;
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock lock(mutex);
+      available.wait(lock, [this]() {
+        return stopping || batches || !jobs.empty();
+      });
+
+      // batches go first, their callers are blocked on them
+      if (batches) {
+        auto &batch = *batches;
+        batch.workers++;
+        lock.unlock();
+
+        uint32_t finished = 0;
+        for (auto i = batch.next++; i < batch.count; i = batch.next++) {
+          batch.invoke(batch.context, i);
+          finished++;
+        }
+
+        lock.lock();
+        unlink(batch);
+        batch.finished += finished;
+        batch.workers--;
+        if (batch.finished == batch.count && batch.workers == 0)
+          batchDone.notify_all();
+        continue;
+      }
+
+      // queued jobs are still drained on shutdown so nobody waits forever
+      if (jobs.empty())
+        return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+      running++;
+    }
+
+    job();
+
+    {
+      std::lock_guard lock(mutex);
+      running--;
+      if (jobs.empty() && running == 0)
+        idle.notify_all();
+    }
+  }
+}
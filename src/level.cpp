@@ -6,11 +6,17 @@
 #include <tmxlite/ObjectGroup.hpp>
 #include <tmxlite/TileLayer.hpp>
 
+#include <cstdint>
+#include <limits>
+#include <print>
+
 BulkinLevel::BulkinLevel(const std::string &path, uint32_t wallTexture,
                          uint32_t floorTexture, uint32_t ceilingTexture,
-                         size_t maxHeight)
-    : wallTexture(wallTexture), floorTexture(floorTexture),
-      ceilingTexture(ceilingTexture), maxHeight(maxHeight) {
+                         size_t maxHeight, bool greedyMeshing, bool pvs,
+                         bool lightmap)
+    : path(path), wallTexture(wallTexture), floorTexture(floorTexture),
+      ceilingTexture(ceilingTexture), maxHeight(maxHeight),
+      greedyMeshing(greedyMeshing), pvs(pvs), lightmap(lightmap) {
   tmx::Map map;
   if (map.load(path)) {
     const auto &layers = map.getLayers();
@@ -63,6 +69,11 @@ BulkinLevel::BulkinLevel(const std::string &path, uint32_t wallTexture,
           auto y = static_cast<float>(maxHeight) - 0.1f;
           auto z = position.y / map.getTileSize().y;
           PointLight pointLight(glm::vec3(x, y, z));
+          for (const auto &property : object.getProperties()) {
+            if (property.getName() == "radius" &&
+                property.getType() == tmx::Property::Type::Float)
+              pointLight.radius = property.getFloatValue();
+          }
           pointLights.push_back(pointLight);
         }
       }
@@ -72,54 +83,297 @@ BulkinLevel::BulkinLevel(const std::string &path, uint32_t wallTexture,
   }
 }
 
-void BulkinLevel::loadLevel(Bulkin &app) {
+uint32_t BulkinLevel::regionAt(size_t x, size_t z) const {
+  return visibility.regionAt(static_cast<int64_t>(x), static_cast<int64_t>(z));
+}
+
+WallGrid BulkinLevel::wallGrid() const {
+  WallGrid grid;
+  grid.width = static_cast<uint32_t>(width);
+  grid.depth = static_cast<uint32_t>(depth);
+  grid.height = static_cast<float>(maxHeight);
+  grid.cells.resize(width * depth);
+  for (size_t z = 0; z < depth; z++)
+    for (size_t x = 0; x < width; x++)
+      grid.cells[z * width + x] = walls[z][x] != 0 ? 1 : 0;
+  return grid;
+}
+
+void BulkinLevel::addQuad(Bulkin &app, glm::vec3 position, uint32_t face,
+                          uint32_t texture, glm::vec2 size, uint32_t region) {
+  auto quad = app.addQuad(position, static_cast<int>(face), texture, size,
+                          region);
+  if (faces.empty())
+    firstQuad = quad;
+  faces.push_back({position, face, size});
+}
+
+void BulkinLevel::bakeLightmap(BulkinJobPool &jobs) {
+  // the level's quads are added back to back, so the faces line up with the
+  // quad handles from the first one on
+  if (lightmap && !faces.empty())
+    baked.build(path + ".lightmap", walls, std::move(faces), pointLights,
+                firstQuad, firstLight, jobs);
+  faces.clear();
+}
+
+void BulkinLevel::loadLevel(Bulkin &app, BulkinJobPool &jobs) {
   app.setPlayerPos(playerPos);
-  for (auto &light : pointLights)
-    app.addPointLight(light);
+  // the level's lights are added back to back, so the baked ones are a run
+  // starting at the first
+  for (size_t i = 0; i < pointLights.size(); i++) {
+    auto light = app.addPointLight(pointLights[i]);
+    if (i == 0)
+      firstLight = light;
+  }
+  // every quad is tagged with the region of the open cell it faces, so it is
+  // only drawn when that cell can be seen
+  visibility.build(walls, pvs, jobs);
+  if (pvs)
+    std::println("pvs: {} regions, {:.1f}% of region pairs visible",
+                 visibility.regionCount(), visibility.density() * 100.0);
+  if (greedyMeshing) {
+    addGreedyQuads(app);
+    bakeLightmap(jobs);
+    return;
+  }
   for (size_t z = 0; z < depth; z++) {
     for (size_t x = 0; x < width; x++) {
       auto wall = walls[z][x];
       if (wall == 1) {
         if (z != depth - 1 && walls[z + 1][x] == 0) {
           for (size_t height = 0; height < maxHeight; height++) {
-            app.addQuad(
-                glm::vec3(0.0f + x, static_cast<float>(height), 0.0f + z), 0.0f,
-                glm::vec3(1.0f), 1.0f, 1, wallTexture);
+            addQuad(app,
+                    glm::vec3(0.0f + x, static_cast<float>(height), 0.0f + z),
+                    1, wallTexture, glm::vec2(1.0f), regionAt(x, z + 1));
           }
         }
         if (x != width - 1 && walls[z][x + 1] == 0) {
           for (size_t height = 0; height < maxHeight; height++) {
-            app.addQuad(
-                glm::vec3(0.5f + x, static_cast<float>(height), -0.5f + z),
-                90.0f, glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, 2, wallTexture);
+            addQuad(app,
+                    glm::vec3(0.5f + x, static_cast<float>(height), -0.5f + z),
+                    2, wallTexture, glm::vec2(1.0f), regionAt(x + 1, z));
           }
         }
         if (x != 0 && walls[z][x - 1] == 0) {
           for (size_t height = 0; height < maxHeight; height++) {
-            app.addQuad(
-                glm::vec3(-0.5f + x, static_cast<float>(height), -0.5f + z),
-                270.0f, glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, 3, wallTexture);
+            addQuad(app,
+                    glm::vec3(-0.5f + x, static_cast<float>(height), -0.5f + z),
+                    3, wallTexture, glm::vec2(1.0f), regionAt(x - 1, z));
           }
         }
         if (z != 0 && walls[z - 1][x] == 0) {
           for (size_t height = 0; height < maxHeight; height++) {
-            app.addQuad(
-                glm::vec3(0.0f + x, static_cast<float>(height), -1.0f + z),
-                180.0f, glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, 0, wallTexture);
+            addQuad(app,
+                    glm::vec3(0.0f + x, static_cast<float>(height), -1.0f + z),
+                    0, wallTexture, glm::vec2(1.0f), regionAt(x, z - 1));
           }
         }
       }
 
       auto floor = floors[z][x];
       if (floor == 1 && wall != 1)
-        app.addQuad(glm::vec3(x, 0.0f, z), 270.0f, glm::vec3(1.0f, 0.0f, 0.0f),
-                    1.0f, 4, floorTexture);
+        addQuad(app, glm::vec3(x, 0.0f, z), 4, floorTexture, glm::vec2(1.0f),
+                regionAt(x, z));
 
       auto ceiling = ceilings[z][x];
       if (ceiling == 1 && wall != 1)
-        app.addQuad(glm::vec3(x, static_cast<float>(maxHeight), -1.0f + z),
-                    90.0f, glm::vec3(1.0f, 0.0f, 0.0f), 1.0f, 5,
-                    ceilingTexture);
+        addQuad(app, glm::vec3(x, static_cast<float>(maxHeight), -1.0f + z),
+                5, ceilingTexture, glm::vec2(1.0f), regionAt(x, z));
+    }
+  }
+  bakeLightmap(jobs);
+}
+
+struct GreedyRect {
+  size_t x, z, width, depth;
+  int64_t key;
+};
+
+// merges cells with the same key into maximal rectangles, growing along x
+// first and then along z; cells keyed -1 are empty. runs stop at the largest
+// size a packed instance can hold
+static std::vector<GreedyRect>
+greedyMesh(std::vector<std::vector<int64_t>> keys, bool mergeX, bool mergeZ) {
+  constexpr size_t maxRun = (1u << INSTANCE_SIZE_BITS) - 1;
+  std::vector<GreedyRect> rects;
+  size_t depth = keys.size();
+  for (size_t z = 0; z < depth; z++) {
+    size_t width = keys[z].size();
+    for (size_t x = 0; x < width; x++) {
+      auto key = keys[z][x];
+      if (key < 0)
+        continue;
+
+      size_t w = 1;
+      while (mergeX && w < maxRun && x + w < width &&
+             keys[z][x + w] == key)
+        w++;
+
+      size_t d = 1;
+      while (mergeZ && d < maxRun && z + d < depth) {
+        bool rowMatches = true;
+        for (size_t i = 0; i < w && rowMatches; i++)
+          rowMatches = keys[z + d][x + i] == key;
+        if (!rowMatches)
+          break;
+        d++;
+      }
+
+      for (size_t j = 0; j < d; j++)
+        for (size_t i = 0; i < w; i++)
+          keys[z + j][x + i] = -1;
+
+      rects.push_back({x, z, w, d, key});
+    }
+  }
+  return rects;
+}
+
+void BulkinLevel::addGreedyQuads(Bulkin &app) {
+  // one key grid per face direction: a cell carries its texture and the pvs
+  // region it faces when that face is exposed, so merged rectangles are
+  // coplanar, same-facing, same-texture and never straddle two regions by
+  // construction
+  std::vector<std::vector<int64_t>> empty(
+      depth, std::vector<int64_t>(width, -1));
+  auto front = empty, right = empty, left = empty, back = empty;
+  auto floorKeys = empty, ceilingKeys = empty;
+  auto key = [](uint32_t texture, uint32_t region) {
+    return static_cast<int64_t>(region) << INSTANCE_TEXTURE_BITS | texture;
+  };
+
+  for (size_t z = 0; z < depth; z++) {
+    for (size_t x = 0; x < width; x++) {
+      auto wall = walls[z][x];
+      if (wall == 1) {
+        if (z != depth - 1 && walls[z + 1][x] == 0)
+          front[z][x] = key(wallTexture, regionAt(x, z + 1));
+        if (x != width - 1 && walls[z][x + 1] == 0)
+          right[z][x] = key(wallTexture, regionAt(x + 1, z));
+        if (x != 0 && walls[z][x - 1] == 0)
+          left[z][x] = key(wallTexture, regionAt(x - 1, z));
+        if (z != 0 && walls[z - 1][x] == 0)
+          back[z][x] = key(wallTexture, regionAt(x, z - 1));
+      }
+      if (floors[z][x] == 1 && wall != 1)
+        floorKeys[z][x] = key(floorTexture, regionAt(x, z));
+      if (ceilings[z][x] == 1 && wall != 1)
+        ceilingKeys[z][x] = key(ceilingTexture, regionAt(x, z));
+    }
+  }
+
+  auto texture = [](const GreedyRect &rect) {
+    return static_cast<uint32_t>(rect.key &
+                                 ((1 << INSTANCE_TEXTURE_BITS) - 1));
+  };
+  auto region = [](const GreedyRect &rect) {
+    return static_cast<uint32_t>(rect.key >> INSTANCE_TEXTURE_BITS);
+  };
+
+  auto height = static_cast<float>(maxHeight);
+  auto centerOffset = [](size_t start, size_t length) {
+    return static_cast<float>(start) +
+           (static_cast<float>(length) - 1.0f) * 0.5f;
+  };
+
+  for (const auto &rect : greedyMesh(front, true, false))
+    addQuad(app, glm::vec3(centerOffset(rect.x, rect.width), 0.0f,
+                           static_cast<float>(rect.z)),
+            1, texture(rect),
+            glm::vec2(static_cast<float>(rect.width), height),
+            region(rect));
+  for (const auto &rect : greedyMesh(right, false, true))
+    addQuad(app, glm::vec3(0.5f + static_cast<float>(rect.x), 0.0f,
+                           -0.5f + centerOffset(rect.z, rect.depth)),
+            2, texture(rect),
+            glm::vec2(static_cast<float>(rect.depth), height),
+            region(rect));
+  for (const auto &rect : greedyMesh(left, false, true))
+    addQuad(app, glm::vec3(-0.5f + static_cast<float>(rect.x), 0.0f,
+                           -0.5f + centerOffset(rect.z, rect.depth)),
+            3, texture(rect),
+            glm::vec2(static_cast<float>(rect.depth), height),
+            region(rect));
+  for (const auto &rect : greedyMesh(back, true, false))
+    addQuad(app, glm::vec3(centerOffset(rect.x, rect.width), 0.0f,
+                           -1.0f + static_cast<float>(rect.z)),
+            0, texture(rect),
+            glm::vec2(static_cast<float>(rect.width), height),
+            region(rect));
+  for (const auto &rect : greedyMesh(floorKeys, true, true))
+    addQuad(app, glm::vec3(centerOffset(rect.x, rect.width), 0.0f,
+                           static_cast<float>(rect.z + rect.depth - 1)),
+            4, texture(rect),
+            glm::vec2(static_cast<float>(rect.width),
+                      static_cast<float>(rect.depth)),
+            region(rect));
+  for (const auto &rect : greedyMesh(ceilingKeys, true, true))
+    addQuad(app, glm::vec3(centerOffset(rect.x, rect.width), height,
+                           -1.0f + static_cast<float>(rect.z)),
+            5, texture(rect),
+            glm::vec2(static_cast<float>(rect.width),
+                      static_cast<float>(rect.depth)),
+            region(rect));
+}
+
+std::vector<glm::vec2> BulkinLevel::cameraPath() {
+  // depth-first tour over every open cell reachable from the player, walking
+  // back along the tree so consecutive waypoints are always adjacent cells
+  std::vector<glm::vec2> path;
+  if (depth == 0 || width == 0)
+    return path;
+
+  auto cellCenter = [](size_t x, size_t z) {
+    return glm::vec2(static_cast<float>(x), static_cast<float>(z) - 0.5f);
+  };
+
+  size_t startX = 0, startZ = 0;
+  float bestDistance = std::numeric_limits<float>::max();
+  for (size_t z = 0; z < depth; z++) {
+    for (size_t x = 0; x < width; x++) {
+      if (walls[z][x] != 0)
+        continue;
+      float distance = glm::length(cellCenter(x, z) - playerPos);
+      if (distance < bestDistance) {
+        bestDistance = distance;
+        startX = x;
+        startZ = z;
+      }
+    }
+  }
+  if (bestDistance == std::numeric_limits<float>::max())
+    return path;
+
+  std::vector<std::vector<bool>> visited(depth,
+                                         std::vector<bool>(width, false));
+  std::vector<std::pair<size_t, size_t>> stack = {{startX, startZ}};
+  visited[startZ][startX] = true;
+  path.push_back(cellCenter(startX, startZ));
+
+  const int offsets[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+  while (!stack.empty()) {
+    auto [x, z] = stack.back();
+    bool advanced = false;
+    for (const auto &offset : offsets) {
+      auto nx = static_cast<int64_t>(x) + offset[0];
+      auto nz = static_cast<int64_t>(z) + offset[1];
+      if (nx < 0 || nz < 0 || nx >= static_cast<int64_t>(width) ||
+          nz >= static_cast<int64_t>(depth))
+        continue;
+      if (visited[nz][nx] || walls[nz][nx] != 0)
+        continue;
+      visited[nz][nx] = true;
+      stack.push_back({static_cast<size_t>(nx), static_cast<size_t>(nz)});
+      path.push_back(cellCenter(nx, nz));
+      advanced = true;
+      break;
+    }
+    if (!advanced) {
+      stack.pop_back();
+      if (!stack.empty())
+        path.push_back(cellCenter(stack.back().first, stack.back().second));
     }
   }
+  return path;
 }
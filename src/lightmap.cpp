@@ -0,0 +1,333 @@
+#include "lightmap.h"
+
+#include "job-pool.h"
+#include "pvs.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <print>
+#include <stdexcept>
+
+constexpr char LIGHTMAP_MAGIC[8] = {'B', 'L', 'K', 'L', 'M', 'A', 'P', '1'};
+
+struct LightmapHeader {
+  char magic[8];
+  uint64_t key;
+  uint32_t width;
+  uint32_t height;
+  uint32_t faceCount;
+  uint32_t padding;
+};
+
+static_assert(sizeof(LightmapHeader) == 32);
+
+// local x, local y and normal of each face id, must match shader.vert
+static const glm::vec3 faceAxisX[6] = {{-1, 0, 0}, {1, 0, 0}, {0, 0, -1},
+                                       {0, 0, 1},  {1, 0, 0}, {1, 0, 0}};
+static const glm::vec3 faceAxisY[6] = {{0, 1, 0}, {0, 1, 0}, {0, 1, 0},
+                                       {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+static const glm::vec3 faceNormal[6] = {{0, 0, -1}, {0, 0, 1}, {1, 0, 0},
+                                        {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}};
+
+void BulkinLightmap::build(const std::string &path,
+                           const std::vector<std::vector<uint32_t>> &walls,
+                           std::vector<LightmapFace> faces,
+                           const std::vector<PointLight> &lights,
+                           uint32_t firstQuad, uint32_t firstLight,
+                           BulkinJobPool &jobs) {
+  this->walls = walls;
+  this->faces = std::move(faces);
+  this->lights = lights;
+  this->firstQuad = firstQuad;
+  this->firstLight = firstLight;
+  lightCount = static_cast<uint32_t>(lights.size());
+  width = 0;
+  height = 0;
+  rects.clear();
+  texels.clear();
+  if (this->faces.empty())
+    return;
+
+  auto expected = key();
+  if (load(path, expected)) {
+    std::println("lightmap: {} faces in a {}x{} atlas, loaded from {}",
+                 this->faces.size(), width, height, path);
+  } else {
+    auto start = std::chrono::steady_clock::now();
+    bake(jobs);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    save(path, expected);
+    std::println("lightmap: {} faces in a {}x{} atlas, baked in {:.0f} ms",
+                 this->faces.size(), width, height, elapsed.count());
+  }
+
+  // only the bake reads these
+  this->walls.clear();
+  this->lights.clear();
+}
+
+uint64_t BulkinLightmap::key() const {
+  // fnv-1a over everything the texels depend on, so a stale atlas is never
+  // loaded whichever input changed
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&hash](const void *data, size_t size) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ull;
+    }
+  };
+  uint32_t settings[] = {LIGHTMAP_TEXELS_PER_CELL, LIGHTMAP_MAX_SIZE,
+                         LIGHTMAP_SHADOW_SAMPLES};
+  mix(settings, sizeof(settings));
+  mix(&LIGHTMAP_LIGHT_RADIUS, sizeof(float));
+  for (const auto &row : walls)
+    mix(row.data(), row.size() * sizeof(uint32_t));
+  for (const auto &face : faces) {
+    mix(&face.position, sizeof(face.position));
+    mix(&face.face, sizeof(face.face));
+    mix(&face.size, sizeof(face.size));
+  }
+  for (const auto &light : lights) {
+    mix(&light.position, sizeof(light.position));
+    mix(&light.diffuse, sizeof(light.diffuse));
+    mix(&light.radius, sizeof(light.radius));
+  }
+  return hash;
+}
+
+bool BulkinLightmap::load(const std::string &path, uint64_t expected) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  LightmapHeader header{};
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file || std::memcmp(header.magic, LIGHTMAP_MAGIC, 8) != 0 ||
+      header.key != expected || header.faceCount != faces.size())
+    return false;
+
+  rects.resize(header.faceCount);
+  texels.resize(static_cast<size_t>(header.width) * header.height);
+  file.read(reinterpret_cast<char *>(rects.data()),
+            static_cast<std::streamsize>(rects.size() * sizeof(glm::vec4)));
+  file.read(reinterpret_cast<char *>(texels.data()),
+            static_cast<std::streamsize>(texels.size() * sizeof(uint64_t)));
+  if (!file) {
+    rects.clear();
+    texels.clear();
+    return false;
+  }
+  width = header.width;
+  height = header.height;
+  return true;
+}
+
+void BulkinLightmap::save(const std::string &path, uint64_t key) const {
+  // a level directory that cannot be written to only costs a bake per run
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    return;
+
+  LightmapHeader header{};
+  std::memcpy(header.magic, LIGHTMAP_MAGIC, 8);
+  header.key = key;
+  header.width = width;
+  header.height = height;
+  header.faceCount = static_cast<uint32_t>(faces.size());
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(rects.data()),
+             static_cast<std::streamsize>(rects.size() * sizeof(glm::vec4)));
+  file.write(reinterpret_cast<const char *>(texels.data()),
+             static_cast<std::streamsize>(texels.size() * sizeof(uint64_t)));
+}
+
+void BulkinLightmap::bake(BulkinJobPool &jobs) {
+  std::vector<Placement> placements;
+  for (auto texelsPerCell = LIGHTMAP_TEXELS_PER_CELL;; texelsPerCell /= 2) {
+    placements = pack(texelsPerCell);
+    if (width <= LIGHTMAP_MAX_SIZE && height <= LIGHTMAP_MAX_SIZE)
+      break;
+    if (texelsPerCell == 1)
+      throw std::runtime_error("level too large for the lightmap atlas");
+  }
+
+  texels.assign(static_cast<size_t>(width) * height,
+                glm::packHalf4x16(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+  rects.resize(faces.size());
+  for (size_t i = 0; i < faces.size(); i++) {
+    const auto &placement = placements[i];
+    rects[i] = glm::vec4(static_cast<float>(placement.x) / width,
+                         static_cast<float>(placement.y) / height,
+                         static_cast<float>(placement.width) / width,
+                         static_cast<float>(placement.height) / height);
+  }
+
+  // every face only writes its own rectangle, so they bake in parallel
+  jobs.run(static_cast<uint32_t>(faces.size()),
+           [this, &placements](uint32_t i) { bakeFace(i, placements[i]); });
+}
+
+std::vector<BulkinLightmap::Placement>
+BulkinLightmap::pack(uint32_t texelsPerCell) {
+  // shelf packing, tallest first. every rectangle has a one texel border of
+  // copied edge texels so bilinear filtering never reads a neighbour
+  std::vector<Placement> placements(faces.size());
+  uint64_t area = 0;
+  uint32_t widest = 0;
+  for (size_t i = 0; i < faces.size(); i++) {
+    auto cells = glm::max(glm::round(faces[i].size), glm::vec2(1.0f));
+    placements[i].width = static_cast<uint32_t>(cells.x) * texelsPerCell;
+    placements[i].height = static_cast<uint32_t>(cells.y) * texelsPerCell;
+    area += static_cast<uint64_t>(placements[i].width + 2) *
+            (placements[i].height + 2);
+    widest = std::max(widest, placements[i].width + 2);
+  }
+  width = std::bit_ceil(std::max(
+      widest, static_cast<uint32_t>(std::ceil(std::sqrt(double(area))))));
+
+  std::vector<size_t> order(faces.size());
+  std::iota(order.begin(), order.end(), size_t{0});
+  std::stable_sort(order.begin(), order.end(), [&placements](auto a, auto b) {
+    return placements[a].height > placements[b].height;
+  });
+
+  uint32_t x = 0, y = 0, shelf = 0;
+  for (auto i : order) {
+    auto &placement = placements[i];
+    if (x + placement.width + 2 > width) {
+      x = 0;
+      y += shelf;
+      shelf = 0;
+    }
+    placement.x = x + 1;
+    placement.y = y + 1;
+    x += placement.width + 2;
+    shelf = std::max(shelf, placement.height + 2);
+  }
+  height = y + shelf;
+  return placements;
+}
+
+void BulkinLightmap::bakeFace(size_t index, const Placement &placement) {
+  const auto &face = faces[index];
+  auto axisX = faceAxisX[face.face];
+  auto axisY = faceAxisY[face.face];
+  auto normal = faceNormal[face.face];
+
+  std::vector<glm::vec3> values(static_cast<size_t>(placement.width) *
+                                placement.height);
+  for (uint32_t j = 0; j < placement.height; j++) {
+    for (uint32_t i = 0; i < placement.width; i++) {
+      float u = (static_cast<float>(i) + 0.5f) / placement.width;
+      float v = (static_cast<float>(j) + 0.5f) / placement.height;
+      auto position = face.position + axisX * ((u - 0.5f) * face.size.x) +
+                      axisY * (v * face.size.y);
+      values[j * placement.width + i] = light(position, normal);
+    }
+  }
+
+  for (int64_t j = -1; j <= static_cast<int64_t>(placement.height); j++) {
+    for (int64_t i = -1; i <= static_cast<int64_t>(placement.width); i++) {
+      auto sourceI = std::clamp<int64_t>(i, 0, placement.width - 1);
+      auto sourceJ = std::clamp<int64_t>(j, 0, placement.height - 1);
+      auto value = values[sourceJ * placement.width + sourceI];
+      auto texel = (placement.y + j) * width + (placement.x + i);
+      texels[texel] = glm::packHalf4x16(glm::vec4(value, 1.0f));
+    }
+  }
+}
+
+glm::vec3 BulkinLightmap::light(glm::vec3 position, glm::vec3 normal) const {
+  // a texel on a wall sits exactly on the cell boundary, nudge it into the
+  // open cell it faces before walking the grid
+  auto origin = BulkinPvs::gridPosition(position + normal * 1e-3f);
+  glm::vec3 total(0.0f);
+
+  for (const auto &light : lights) {
+    auto offset = light.position - position;
+    float distance = std::max(glm::length(offset), 1e-4f);
+    if (distance >= light.radius)
+      continue;
+    float falloff = 1.0f - std::pow(distance / light.radius, 4.0f);
+    float attenuation = falloff * falloff / distance;
+    float diffuse = std::max(glm::dot(offset / distance, normal), 0.0f);
+
+    // walls are full height, so a ray is blocked as soon as its footprint on
+    // the grid crosses a wall cell. the samples sit on a disc around the
+    // light, the fraction that gets through is the penumbra
+    float visible = 0.0f;
+    if (diffuse > 0.0f) {
+      uint32_t unblocked = 0;
+      for (uint32_t k = 0; k < LIGHTMAP_SHADOW_SAMPLES; k++) {
+        float r = LIGHTMAP_LIGHT_RADIUS *
+                  std::sqrt((static_cast<float>(k) + 0.5f) /
+                            LIGHTMAP_SHADOW_SAMPLES);
+        float angle = 2.39996323f * static_cast<float>(k);
+        auto sample = light.position +
+                      glm::vec3(r * std::cos(angle), 0.0f, r * std::sin(angle));
+        if (!blocked(origin, BulkinPvs::gridPosition(sample)))
+          unblocked++;
+      }
+      visible = static_cast<float>(unblocked) / LIGHTMAP_SHADOW_SAMPLES;
+    }
+
+    // the same diffuse and unshadowed ambient terms as BlinnPhong
+    total += light.diffuse * attenuation * (diffuse * visible + 0.1f);
+  }
+  return total;
+}
+
+bool BulkinLightmap::blocked(glm::vec2 from, glm::vec2 to) const {
+  auto solid = [this](int64_t x, int64_t z) {
+    if (x < 0 || z < 0 || z >= static_cast<int64_t>(walls.size()) ||
+        x >= static_cast<int64_t>(walls[z].size()))
+      return true;
+    return walls[z][x] != 0;
+  };
+
+  // the same walk as BulkinPvs::traceRay, measured in fractions of the
+  // segment so it stops at the light
+  constexpr float infinity = std::numeric_limits<float>::infinity();
+  auto direction = to - from;
+  auto cellX = static_cast<int64_t>(std::floor(from.x));
+  auto cellZ = static_cast<int64_t>(std::floor(from.y));
+  auto endX = static_cast<int64_t>(std::floor(to.x));
+  auto endZ = static_cast<int64_t>(std::floor(to.y));
+  int64_t stepX = direction.x > 0.0f ? 1 : -1;
+  int64_t stepZ = direction.y > 0.0f ? 1 : -1;
+  float deltaX = direction.x != 0.0f ? std::abs(1.0f / direction.x) : infinity;
+  float deltaZ = direction.y != 0.0f ? std::abs(1.0f / direction.y) : infinity;
+  float nextX = direction.x > 0.0f
+                    ? (static_cast<float>(cellX + 1) - from.x) * deltaX
+                    : (from.x - static_cast<float>(cellX)) * deltaX;
+  float nextZ = direction.y > 0.0f
+                    ? (static_cast<float>(cellZ + 1) - from.y) * deltaZ
+                    : (from.y - static_cast<float>(cellZ)) * deltaZ;
+
+  while (cellX != endX || cellZ != endZ) {
+    if (nextX < nextZ) {
+      if (nextX > 1.0f)
+        break;
+      cellX += stepX;
+      nextX += deltaX;
+    } else {
+      if (nextZ > 1.0f)
+        break;
+      cellZ += stepZ;
+      nextZ += deltaZ;
+    }
+    if (solid(cellX, cellZ))
+      return true;
+  }
+  return false;
+}
@@ -0,0 +1,50 @@
+#include "mapped-file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+BulkinMappedFile::BulkinMappedFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat info{};
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void *view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+    if (view != MAP_FAILED) {
+      mapped = static_cast<const std::byte *>(view);
+      length = static_cast<size_t>(info.st_size);
+    }
+  }
+
+  // the mapping keeps the file alive on its own
+  close(fd);
+}
+
+BulkinMappedFile::BulkinMappedFile(BulkinMappedFile &&other) noexcept
+    : mapped(std::exchange(other.mapped, nullptr)),
+      length(std::exchange(other.length, 0)) {}
+
+BulkinMappedFile &
+BulkinMappedFile::operator=(BulkinMappedFile &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    mapped = std::exchange(other.mapped, nullptr);
+    length = std::exchange(other.length, 0);
+  }
+  return *this;
+}
+
+BulkinMappedFile::~BulkinMappedFile() { unmap(); }
+
+void BulkinMappedFile::unmap() {
+  if (mapped)
+    munmap(const_cast<std::byte *>(mapped), length);
+  mapped = nullptr;
+  length = 0;
+}
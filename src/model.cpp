@@ -6,7 +6,107 @@
 
 #include <glm/gtc/quaternion.hpp>
 
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <print>
+
+constexpr uint32_t COOKED_MESH_MAGIC = 0x534d4b42; // "BKMS"
+constexpr uint32_t COOKED_MESH_VERSION = 1;
+
+// a cooked mesh is this header, the diffuse texture name from the material,
+// then the vertex and index blobs, each starting on a 16 byte boundary.
+// the source size and write time tell a stale cook apart from a current one
+struct CookedMeshHeader {
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint32_t vertexSize = 0;
+  uint32_t diffuseLength = 0;
+  uint64_t sourceSize = 0;
+  int64_t sourceTime = 0;
+  uint64_t vertexOffset = 0;
+  uint64_t indexOffset = 0;
+  uint32_t vertexCount = 0;
+  uint32_t indexCount = 0;
+  float boundsMin[3] = {};
+  float boundsMax[3] = {};
+};
+
+static void sourceStamp(const std::string &path, uint64_t &size,
+                        int64_t &time) {
+  std::error_code error;
+  size = std::filesystem::file_size(path, error);
+  if (error)
+    size = 0;
+  auto writeTime = std::filesystem::last_write_time(path, error);
+  time = error ? 0 : writeTime.time_since_epoch().count();
+}
+
+static uint64_t alignOffset(uint64_t offset) { return (offset + 15) & ~15ull; }
+
 void BulkinModel::loadModel() {
+  auto cookedPath = modelPath + ".bkmesh";
+  if (mapCooked(cookedPath))
+    return;
+
+  cook(modelPath, cookedPath);
+  if (!mapCooked(cookedPath))
+    throw std::runtime_error("unable to load cooked model " + cookedPath);
+}
+
+bool BulkinModel::mapCooked(const std::string &cookedPath) {
+  auto file = std::make_shared<BulkinMappedFile>(cookedPath);
+  if (!file->isOpen() || file->size() < sizeof(CookedMeshHeader))
+    return false;
+
+  CookedMeshHeader header;
+  memcpy(&header, file->data(), sizeof(header));
+  if (header.magic != COOKED_MESH_MAGIC ||
+      header.version != COOKED_MESH_VERSION ||
+      header.vertexSize != sizeof(Vertex))
+    return false;
+
+  // a missing source is fine, the cooked file can ship on its own
+  if (std::filesystem::exists(modelPath)) {
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    sourceStamp(modelPath, sourceSize, sourceTime);
+    if (header.sourceSize != sourceSize || header.sourceTime != sourceTime) {
+      std::println("discarding stale cooked model {}", cookedPath);
+      return false;
+    }
+  }
+
+  uint64_t vertexBytes = uint64_t(header.vertexCount) * sizeof(Vertex);
+  uint64_t indexBytes = uint64_t(header.indexCount) * sizeof(uint32_t);
+  if (sizeof(header) + header.diffuseLength > file->size() ||
+      header.vertexOffset % 16 != 0 || header.indexOffset % 16 != 0 ||
+      header.vertexOffset + vertexBytes > file->size() ||
+      header.indexOffset + indexBytes > file->size())
+    return false;
+
+  auto diffuse = reinterpret_cast<const char *>(file->data() + sizeof(header));
+  auto directory = modelPath.substr(0, modelPath.find_last_of('/'));
+  diffusePath = directory + "/" + std::string(diffuse, header.diffuseLength);
+
+  vertices = std::span(
+      reinterpret_cast<const Vertex *>(file->data() + header.vertexOffset),
+      header.vertexCount);
+  indices = std::span(
+      reinterpret_cast<const uint32_t *>(file->data() + header.indexOffset),
+      header.indexCount);
+  boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1],
+                        header.boundsMin[2]);
+  boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1],
+                        header.boundsMax[2]);
+  cooked = std::move(file);
+  return true;
+}
+
+void BulkinModel::cook(const std::string &modelPath,
+                       const std::string &cookedPath) {
+  std::println("cooking model {}", modelPath);
   Assimp::Importer importer;
 
   const aiScene *scene = importer.ReadFile(
@@ -21,34 +121,96 @@ void BulkinModel::loadModel() {
   if (scene == nullptr || !scene->HasMeshes())
     throw std::runtime_error("unable to load model");
 
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  std::string diffuse;
+  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+
   for (size_t i = 0; i < scene->mNumMeshes; i++) {
     auto mesh = scene->mMeshes[i];
+    // every mesh indexes from zero, shift it past the ones already merged
+    auto baseVertex = static_cast<uint32_t>(vertices.size());
     for (size_t j = 0; j < mesh->mNumVertices; j++) {
       Vertex vertex;
       vertex.pos = {mesh->mVertices[j].x, mesh->mVertices[j].y,
                     mesh->mVertices[j].z};
       vertex.texCoord = {mesh->mTextureCoords[0][j].x,
                          mesh->mTextureCoords[0][j].y};
-      vertex.normal = {mesh->mNormals[j].x, mesh->mNormals[i].y,
+      vertex.normal = {mesh->mNormals[j].x, mesh->mNormals[j].y,
                        mesh->mNormals[j].z};
       vertex.color = {1.0f, 1.0f, 1.0f};
+      boundsMin = glm::min(boundsMin, vertex.pos);
+      boundsMax = glm::max(boundsMax, vertex.pos);
       vertices.push_back(vertex);
     }
     for (size_t j = 0; j < mesh->mNumFaces; j++) {
       aiFace face = mesh->mFaces[j];
       for (size_t k = 0; k < face.mNumIndices; k++) {
-        indices.push_back(face.mIndices[k]);
+        indices.push_back(baseVertex + face.mIndices[k]);
       }
     }
     auto *material = scene->mMaterials[mesh->mMaterialIndex];
     aiString str;
     material->GetTexture(aiTextureType_DIFFUSE, 0, &str);
-    auto directory = modelPath.substr(0, modelPath.find_last_of('/'));
-    diffusePath = directory + "/" + str.C_Str();
+    diffuse = str.C_Str();
+  }
+
+  CookedMeshHeader header{};
+  header.magic = COOKED_MESH_MAGIC;
+  header.version = COOKED_MESH_VERSION;
+  header.vertexSize = sizeof(Vertex);
+  header.diffuseLength = static_cast<uint32_t>(diffuse.size());
+  sourceStamp(modelPath, header.sourceSize, header.sourceTime);
+  header.vertexCount = static_cast<uint32_t>(vertices.size());
+  header.indexCount = static_cast<uint32_t>(indices.size());
+  header.vertexOffset = alignOffset(sizeof(header) + diffuse.size());
+  header.indexOffset =
+      alignOffset(header.vertexOffset + sizeof(Vertex) * vertices.size());
+  for (int axis = 0; axis < 3; axis++) {
+    header.boundsMin[axis] = boundsMin[axis];
+    header.boundsMax[axis] = boundsMax[axis];
   }
+
+  // written next to the real file and renamed so a crash never leaves a
+  // truncated cook behind
+  auto tempPath = cookedPath + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+      throw std::runtime_error("failed to write cooked model " + cookedPath);
+
+    const char padding[16] = {};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(diffuse.data(), static_cast<std::streamsize>(diffuse.size()));
+    file.write(padding, static_cast<std::streamsize>(
+                            header.vertexOffset - sizeof(header) -
+                            diffuse.size()));
+    file.write(reinterpret_cast<const char *>(vertices.data()),
+               static_cast<std::streamsize>(sizeof(Vertex) * vertices.size()));
+    file.write(padding,
+               static_cast<std::streamsize>(
+                   header.indexOffset - header.vertexOffset -
+                   sizeof(Vertex) * vertices.size()));
+    file.write(reinterpret_cast<const char *>(indices.data()),
+               static_cast<std::streamsize>(sizeof(uint32_t) * indices.size()));
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, cookedPath, error);
+  if (error)
+    throw std::runtime_error("failed to write cooked model " + cookedPath +
+                             ": " + error.message());
 }
 
-glm::mat4 BulkinModel::modelMatrix() {
+void BulkinModel::setTransform(glm::vec3 pos, float angle, glm::vec3 rotation, float scale) {
+  this->pos = pos;
+  this->angle = angle;
+  this->rotation = rotation;
+  this->scale = scale;
+}
+
+glm::mat4 BulkinModel::modelMatrix() const {
   auto model = glm::mat4(1.0f);
   model = glm::translate(model, pos);
   glm::quat rot = glm::angleAxis(glm::radians(angle), rotation);
@@ -56,15 +218,3 @@ glm::mat4 BulkinModel::modelMatrix() {
   model = glm::scale(model, glm::vec3(scale));
   return model;
 }
-
-std::vector<uint32_t> BulkinModel::getIndices() { return indices; }
-
-std::vector<Vertex> BulkinModel::getVertices() { return vertices; }
-
-uint32_t BulkinModel::getIndicesSize() {
-  return static_cast<uint32_t>(indices.size());
-}
-
-uint32_t BulkinModel::getVerticesSize() {
-  return static_cast<uint32_t>(vertices.size());
-}
@@ -0,0 +1,454 @@
+#include "occlusion-pipeline.h"
+#include "bulkin.h"
+#include "constants.h"
+#include "graphics-pipeline.h"
+#include "hiz-shader.h"
+#include "occlusion-shader.h"
+#include "vertex.h"
+
+#include <algorithm>
+#include <bit>
+
+constexpr uint32_t OCCLUSION_WORKGROUP_SIZE = 64;
+constexpr uint32_t PYRAMID_WORKGROUP_SIZE = 8;
+constexpr uint32_t OCCLUSION_TEST_BINDINGS = 9;
+
+struct OcclusionPushConstants {
+  uint32_t modelCount;
+  OcclusionPhase phase;
+};
+
+vk::Pipeline BulkinOcclusionPipeline::createPipeline(
+    vk::Device &device, vk::PipelineCache pipelineCache,
+    const unsigned char *code, size_t codeSize, vk::PipelineLayout layout) {
+  auto shaderModule =
+      BulkinGraphicsPipeline::createShaderModule(code, codeSize, device);
+
+  vk::PipelineShaderStageCreateInfo stageInfo{};
+  stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+  stageInfo.module = shaderModule;
+  stageInfo.pName = "main";
+
+  vk::ComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.stage = stageInfo;
+  pipelineInfo.layout = layout;
+
+  auto [result, computePipeline] =
+      device.createComputePipeline(pipelineCache, pipelineInfo);
+  if (result != vk::Result::eSuccess)
+    throw std::runtime_error("cannot create occlusion pipeline");
+
+  device.destroy(shaderModule);
+  return computePipeline;
+}
+
+void BulkinOcclusionPipeline::create(vk::Device &device,
+                                     vk::PipelineCache pipelineCache) {
+  vk::PushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(OcclusionPushConstants);
+
+  vk::PipelineLayoutCreateInfo testLayoutInfo{};
+  testLayoutInfo.setLayoutCount = 1;
+  testLayoutInfo.pSetLayouts = &testDescriptorSetLayout;
+  testLayoutInfo.pushConstantRangeCount = 1;
+  testLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  testPipelineLayout = device.createPipelineLayout(testLayoutInfo);
+  testPipeline =
+      createPipeline(device, pipelineCache, shaders_occlusion_spv,
+                     shaders_occlusion_spv_len, testPipelineLayout);
+
+  vk::PipelineLayoutCreateInfo pyramidLayoutInfo{};
+  pyramidLayoutInfo.setLayoutCount = 1;
+  pyramidLayoutInfo.pSetLayouts = &pyramidDescriptorSetLayout;
+  pyramidPipelineLayout = device.createPipelineLayout(pyramidLayoutInfo);
+  pyramidPipeline = createPipeline(device, pipelineCache, shaders_hiz_spv,
+                                   shaders_hiz_spv_len, pyramidPipelineLayout);
+}
+
+void BulkinOcclusionPipeline::createDescriptorLayout(vk::Device &device) {
+  std::array<vk::DescriptorSetLayoutBinding, OCCLUSION_TEST_BINDINGS>
+      bindings{};
+
+  for (uint32_t i = 0; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+  }
+  bindings[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+  bindings[8].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+
+  vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  testDescriptorSetLayout = device.createDescriptorSetLayout(layoutInfo);
+
+  std::array<vk::DescriptorSetLayoutBinding, 2> pyramidBindings{};
+  pyramidBindings[0].binding = 0;
+  pyramidBindings[0].descriptorType =
+      vk::DescriptorType::eCombinedImageSampler;
+  pyramidBindings[0].descriptorCount = 1;
+  pyramidBindings[0].stageFlags = vk::ShaderStageFlagBits::eCompute;
+  pyramidBindings[1].binding = 1;
+  pyramidBindings[1].descriptorType = vk::DescriptorType::eStorageImage;
+  pyramidBindings[1].descriptorCount = 1;
+  pyramidBindings[1].stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+  vk::DescriptorSetLayoutCreateInfo pyramidLayoutInfo{};
+  pyramidLayoutInfo.bindingCount =
+      static_cast<uint32_t>(pyramidBindings.size());
+  pyramidLayoutInfo.pBindings = pyramidBindings.data();
+
+  pyramidDescriptorSetLayout =
+      device.createDescriptorSetLayout(pyramidLayoutInfo);
+}
+
+void BulkinOcclusionPipeline::createDescriptorSets(vk::Device &device,
+                                                   BulkinBuffer &buffers) {
+  modelCount = buffers.modelDrawCount;
+
+  std::array<vk::DescriptorPoolSize, 3> poolSizes;
+  poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
+  poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  poolSizes[1].type = vk::DescriptorType::eStorageBuffer;
+  poolSizes[1].descriptorCount =
+      7 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  poolSizes[2].type = vk::DescriptorType::eCombinedImageSampler;
+  poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+  vk::DescriptorPoolCreateInfo poolInfo{};
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+  testDescriptorPool = device.createDescriptorPool(poolInfo);
+
+  std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
+                                               testDescriptorSetLayout);
+  vk::DescriptorSetAllocateInfo allocInfo{};
+  allocInfo.descriptorPool = testDescriptorPool;
+  allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+  allocInfo.pSetLayouts = layouts.data();
+
+  testDescriptorSets = device.allocateDescriptorSets(allocInfo);
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vk::DescriptorBufferInfo uniformBufferInfo{};
+    uniformBufferInfo.buffer = buffers.uniformBuffers[i];
+    uniformBufferInfo.offset = 0;
+    uniformBufferInfo.range = sizeof(UniformBufferObject);
+
+    std::array<vk::Buffer, OCCLUSION_TEST_BINDINGS - 2> storageBuffers = {
+        buffers.modelInstanceBuffers[i], buffers.modelBoundsBuffer,
+        buffers.modelDrawCommandBuffer,  buffers.earlyModelDrawBuffers[i],
+        buffers.lateModelDrawBuffers[i], buffers.modelDrawCountBuffers[i],
+        buffers.modelRetestBuffers[i]};
+    std::array<vk::DescriptorBufferInfo, OCCLUSION_TEST_BINDINGS - 2>
+        storageBufferInfos{};
+    std::array<vk::WriteDescriptorSet, OCCLUSION_TEST_BINDINGS - 1>
+        descriptorWrites{};
+
+    descriptorWrites[0].dstSet = testDescriptorSets[i];
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].dstArrayElement = 0;
+    descriptorWrites[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pBufferInfo = &uniformBufferInfo;
+
+    for (uint32_t j = 0; j < storageBuffers.size(); j++) {
+      storageBufferInfos[j].buffer = storageBuffers[j];
+      storageBufferInfos[j].offset = 0;
+      storageBufferInfos[j].range = vk::WholeSize;
+
+      descriptorWrites[j + 1].dstSet = testDescriptorSets[i];
+      descriptorWrites[j + 1].dstBinding = j + 1;
+      descriptorWrites[j + 1].dstArrayElement = 0;
+      descriptorWrites[j + 1].descriptorType =
+          vk::DescriptorType::eStorageBuffer;
+      descriptorWrites[j + 1].descriptorCount = 1;
+      descriptorWrites[j + 1].pBufferInfo = &storageBufferInfos[j];
+    }
+
+    device.updateDescriptorSets(
+        static_cast<uint32_t>(descriptorWrites.size()),
+        descriptorWrites.data(), 0, nullptr);
+    writePyramidDescriptor(device, testDescriptorSets[i]);
+  }
+}
+
+void BulkinOcclusionPipeline::writePyramidDescriptor(vk::Device &device,
+                                                     vk::DescriptorSet set) {
+  vk::DescriptorImageInfo pyramidInfo{};
+  pyramidInfo.imageLayout = vk::ImageLayout::eGeneral;
+  pyramidInfo.imageView = pyramidView;
+  pyramidInfo.sampler = pyramidSampler;
+
+  vk::WriteDescriptorSet descriptorWrite{};
+  descriptorWrite.dstSet = set;
+  descriptorWrite.dstBinding = 8;
+  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pImageInfo = &pyramidInfo;
+
+  device.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+}
+
+void BulkinOcclusionPipeline::createPyramid(
+    vk::Device &device, BulkinAllocator &allocator,
+    vk::CommandPool commandPool, vk::Queue graphicsQueue,
+    vk::ImageView depthImageView, uint32_t width, uint32_t height) {
+  destroyPyramid(device, allocator);
+
+  // the first level is already half the depth buffer, a full size copy would
+  // only be read by the level above it
+  vk::Extent2D extent{std::max((width + 1) / 2, 1u),
+                      std::max((height + 1) / 2, 1u)};
+  auto levels = static_cast<uint32_t>(
+      std::bit_width(std::max(extent.width, extent.height)));
+
+  Bulkin::createImage(extent.width, extent.height, vk::Format::eR32Sfloat,
+                      vk::ImageTiling::eOptimal,
+                      vk::ImageUsageFlagBits::eStorage |
+                          vk::ImageUsageFlagBits::eSampled |
+                          vk::ImageUsageFlagBits::eTransferDst,
+                      vk::MemoryPropertyFlagBits::eDeviceLocal, device,
+                      allocator, pyramidImage, pyramidImageMemory, levels,
+                      AllocationCategory::Attachment);
+  pyramidView = Bulkin::createImageView(device, pyramidImage,
+                                        vk::Format::eR32Sfloat,
+                                        vk::ImageAspectFlagBits::eColor,
+                                        levels);
+  for (uint32_t level = 0; level < levels; level++) {
+    vk::ImageViewCreateInfo viewInfo{};
+    viewInfo.image = pyramidImage;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = vk::Format::eR32Sfloat;
+    viewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    viewInfo.subresourceRange.baseMipLevel = level;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    pyramidLevelViews.push_back(device.createImageView(viewInfo));
+    pyramidLevelExtents.push_back(
+        {std::max(extent.width >> level, 1u),
+         std::max(extent.height >> level, 1u)});
+  }
+
+  vk::SamplerCreateInfo samplerInfo{};
+  samplerInfo.magFilter = vk::Filter::eNearest;
+  samplerInfo.minFilter = vk::Filter::eNearest;
+  samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+  samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = vk::LodClampNone;
+  pyramidSampler = device.createSampler(samplerInfo);
+
+  // the pyramid stays in general layout for good, and starts out at the far
+  // plane so nothing is rejected before a frame has been drawn
+  auto commandBuffer =
+      BulkinBuffer::beginSingleTimeCommands(device, commandPool);
+  vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0, levels,
+                                  0, 1};
+  vk::ImageMemoryBarrier2 barrier{};
+  barrier.srcStageMask = vk::PipelineStageFlagBits2::eTopOfPipe;
+  barrier.dstStageMask = vk::PipelineStageFlagBits2::eTransfer;
+  barrier.dstAccessMask = vk::AccessFlagBits2::eTransferWrite;
+  barrier.oldLayout = vk::ImageLayout::eUndefined;
+  barrier.newLayout = vk::ImageLayout::eGeneral;
+  barrier.srcQueueFamilyIndex = vk::QueueFamilyIgnored;
+  barrier.dstQueueFamilyIndex = vk::QueueFamilyIgnored;
+  barrier.image = pyramidImage;
+  barrier.subresourceRange = range;
+  vk::DependencyInfo dependencyInfo{};
+  dependencyInfo.imageMemoryBarrierCount = 1;
+  dependencyInfo.pImageMemoryBarriers = &barrier;
+  commandBuffer.pipelineBarrier2(dependencyInfo);
+  commandBuffer.clearColorImage(pyramidImage, vk::ImageLayout::eGeneral,
+                                vk::ClearColorValue(1.0f, 1.0f, 1.0f, 1.0f),
+                                range);
+  BulkinBuffer::endSingleTimeCommands(commandBuffer, device, graphicsQueue,
+                                      commandPool);
+
+  // every level reads the one below it, the first reads the depth buffer
+  std::array<vk::DescriptorPoolSize, 2> poolSizes;
+  poolSizes[0].type = vk::DescriptorType::eCombinedImageSampler;
+  poolSizes[0].descriptorCount = levels;
+  poolSizes[1].type = vk::DescriptorType::eStorageImage;
+  poolSizes[1].descriptorCount = levels;
+
+  vk::DescriptorPoolCreateInfo poolInfo{};
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = levels;
+
+  pyramidDescriptorPool = device.createDescriptorPool(poolInfo);
+
+  std::vector<vk::DescriptorSetLayout> layouts(levels,
+                                               pyramidDescriptorSetLayout);
+  vk::DescriptorSetAllocateInfo allocInfo{};
+  allocInfo.descriptorPool = pyramidDescriptorPool;
+  allocInfo.descriptorSetCount = levels;
+  allocInfo.pSetLayouts = layouts.data();
+
+  pyramidDescriptorSets = device.allocateDescriptorSets(allocInfo);
+
+  for (uint32_t level = 0; level < levels; level++) {
+    vk::DescriptorImageInfo sourceInfo{};
+    sourceInfo.imageLayout =
+        level == 0 ? vk::ImageLayout::eDepthStencilReadOnlyOptimal
+                   : vk::ImageLayout::eGeneral;
+    sourceInfo.imageView =
+        level == 0 ? depthImageView : pyramidLevelViews[level - 1];
+    sourceInfo.sampler = pyramidSampler;
+
+    vk::DescriptorImageInfo destinationInfo{};
+    destinationInfo.imageLayout = vk::ImageLayout::eGeneral;
+    destinationInfo.imageView = pyramidLevelViews[level];
+
+    std::array<vk::WriteDescriptorSet, 2> descriptorWrites{};
+    descriptorWrites[0].dstSet = pyramidDescriptorSets[level];
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].dstArrayElement = 0;
+    descriptorWrites[0].descriptorType =
+        vk::DescriptorType::eCombinedImageSampler;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pImageInfo = &sourceInfo;
+
+    descriptorWrites[1].dstSet = pyramidDescriptorSets[level];
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].dstArrayElement = 0;
+    descriptorWrites[1].descriptorType = vk::DescriptorType::eStorageImage;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &destinationInfo;
+
+    device.updateDescriptorSets(
+        static_cast<uint32_t>(descriptorWrites.size()),
+        descriptorWrites.data(), 0, nullptr);
+  }
+
+  // the test sets only exist once the buffers are up, the first pyramid is
+  // written into them when they are created
+  for (auto set : testDescriptorSets)
+    writePyramidDescriptor(device, set);
+}
+
+void BulkinOcclusionPipeline::recordTest(vk::CommandBuffer commandBuffer,
+                                         BulkinBuffer &buffers,
+                                         uint32_t currentFrame,
+                                         OcclusionPhase phase) {
+  if (phase == OcclusionPhase::Early) {
+    // both phases of this frame count up from zero, and last frame's pyramid
+    // has to be finished before it is sampled
+    commandBuffer.fillBuffer(buffers.modelDrawCountBuffers[currentFrame], 0,
+                             vk::WholeSize, 0);
+
+    std::array<vk::MemoryBarrier2, 2> clearBarriers{};
+    clearBarriers[0].srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+    clearBarriers[0].srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+    clearBarriers[0].dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+    clearBarriers[0].dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+                                     vk::AccessFlagBits2::eShaderStorageWrite;
+    clearBarriers[1].srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+    clearBarriers[1].srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite;
+    clearBarriers[1].dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+    clearBarriers[1].dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead;
+
+    vk::DependencyInfo clearDependency{};
+    clearDependency.memoryBarrierCount =
+        static_cast<uint32_t>(clearBarriers.size());
+    clearDependency.pMemoryBarriers = clearBarriers.data();
+    commandBuffer.pipelineBarrier2(clearDependency);
+  }
+
+  OcclusionPushConstants pushConstants{modelCount, phase};
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, testPipeline);
+  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                   testPipelineLayout, 0, 1,
+                                   &testDescriptorSets[currentFrame], 0,
+                                   nullptr);
+  commandBuffer.pushConstants(testPipelineLayout,
+                              vk::ShaderStageFlagBits::eCompute, 0,
+                              sizeof(OcclusionPushConstants), &pushConstants);
+  commandBuffer.dispatch(
+      (modelCount + OCCLUSION_WORKGROUP_SIZE - 1) / OCCLUSION_WORKGROUP_SIZE,
+      1, 1);
+
+  vk::MemoryBarrier2 testBarrier{};
+  testBarrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  testBarrier.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite;
+  testBarrier.dstStageMask = vk::PipelineStageFlagBits2::eDrawIndirect |
+                             vk::PipelineStageFlagBits2::eComputeShader;
+  testBarrier.dstAccessMask = vk::AccessFlagBits2::eIndirectCommandRead |
+                              vk::AccessFlagBits2::eShaderStorageRead;
+
+  vk::DependencyInfo testDependency{};
+  testDependency.memoryBarrierCount = 1;
+  testDependency.pMemoryBarriers = &testBarrier;
+  commandBuffer.pipelineBarrier2(testDependency);
+}
+
+void BulkinOcclusionPipeline::recordPyramid(vk::CommandBuffer commandBuffer) {
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             pyramidPipeline);
+
+  // the early phase of this frame already read last frame's pyramid
+  vk::MemoryBarrier2 levelBarrier{};
+  levelBarrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  levelBarrier.srcAccessMask = vk::AccessFlagBits2::eShaderSampledRead |
+                               vk::AccessFlagBits2::eShaderStorageWrite;
+  levelBarrier.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
+  levelBarrier.dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead |
+                               vk::AccessFlagBits2::eShaderStorageWrite;
+
+  vk::DependencyInfo levelDependency{};
+  levelDependency.memoryBarrierCount = 1;
+  levelDependency.pMemoryBarriers = &levelBarrier;
+
+  for (size_t level = 0; level < pyramidDescriptorSets.size(); level++) {
+    commandBuffer.pipelineBarrier2(levelDependency);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                     pyramidPipelineLayout, 0, 1,
+                                     &pyramidDescriptorSets[level], 0,
+                                     nullptr);
+    auto extent = pyramidLevelExtents[level];
+    commandBuffer.dispatch(
+        (extent.width + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE,
+        (extent.height + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE,
+        1);
+  }
+  commandBuffer.pipelineBarrier2(levelDependency);
+}
+
+void BulkinOcclusionPipeline::destroyPyramid(vk::Device &device,
+                                             BulkinAllocator &allocator) {
+  if (!pyramidImage)
+    return;
+  device.destroy(pyramidDescriptorPool);
+  device.destroy(pyramidSampler);
+  for (auto view : pyramidLevelViews)
+    device.destroy(view);
+  pyramidLevelViews.clear();
+  pyramidLevelExtents.clear();
+  device.destroy(pyramidView);
+  device.destroy(pyramidImage);
+  allocator.free(pyramidImageMemory);
+  pyramidImage = nullptr;
+}
+
+void BulkinOcclusionPipeline::cleanup(vk::Device &device,
+                                      BulkinAllocator &allocator) {
+  destroyPyramid(device, allocator);
+  device.destroy(testDescriptorPool);
+  device.destroy(testDescriptorSetLayout);
+  device.destroy(testPipelineLayout);
+  device.destroy(testPipeline);
+  device.destroy(pyramidDescriptorSetLayout);
+  device.destroy(pyramidPipelineLayout);
+  device.destroy(pyramidPipeline);
+}
@@ -0,0 +1,85 @@
+#include "pipeline-cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <print>
+#include <vector>
+
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43504b42; // "BKPC"
+constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+
+void BulkinPipelineCache::load(vk::Device &device,
+                               vk::PhysicalDevice &physicalDevice) {
+  auto properties = physicalDevice.getProperties();
+  header.magic = PIPELINE_CACHE_MAGIC;
+  header.version = PIPELINE_CACHE_VERSION;
+  header.vendorID = properties.vendorID;
+  header.deviceID = properties.deviceID;
+  header.driverVersion = properties.driverVersion;
+  memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(),
+         VK_UUID_SIZE);
+
+  std::vector<char> data;
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (file.is_open()) {
+    size_t fileSize = static_cast<size_t>(file.tellg());
+    Header stored{};
+    if (fileSize >= sizeof(Header)) {
+      file.seekg(0);
+      file.read(reinterpret_cast<char *>(&stored), sizeof(Header));
+    }
+
+    bool valid = fileSize >= sizeof(Header) && stored.magic == header.magic &&
+                 stored.version == header.version &&
+                 stored.vendorID == header.vendorID &&
+                 stored.deviceID == header.deviceID &&
+                 stored.driverVersion == header.driverVersion &&
+                 memcmp(stored.pipelineCacheUUID, header.pipelineCacheUUID,
+                        VK_UUID_SIZE) == 0 &&
+                 stored.dataSize == fileSize - sizeof(Header);
+
+    if (valid) {
+      data.resize(stored.dataSize);
+      file.read(data.data(), static_cast<std::streamsize>(stored.dataSize));
+    } else {
+      std::println("discarding stale pipeline cache {}", path);
+    }
+  }
+
+  vk::PipelineCacheCreateInfo createInfo{};
+  createInfo.initialDataSize = data.size();
+  createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+  cache = device.createPipelineCache(createInfo);
+}
+
+void BulkinPipelineCache::save(vk::Device &device) {
+  if (!cache)
+    return;
+
+  auto data = device.getPipelineCacheData(cache);
+  header.dataSize = data.size();
+
+  // write next to the real file and rename so a crash never leaves a
+  // truncated cache behind
+  auto tempPath = path + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+      return;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    file.write(reinterpret_cast<const char *>(data.data()),
+               static_cast<std::streamsize>(data.size()));
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error)
+    std::println("failed to save pipeline cache {}: {}", path,
+                 error.message());
+}
+
+void BulkinPipelineCache::cleanup(vk::Device &device) {
+  device.destroy(cache);
+}
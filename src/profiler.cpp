@@ -0,0 +1,206 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <fstream>
+
+constexpr vk::QueryPipelineStatisticFlags PROFILER_STATISTICS =
+    vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices |
+    vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+    vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+    vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations |
+    vk::QueryPipelineStatisticFlagBits::eComputeShaderInvocations;
+
+void BulkinProfiler::create(vk::Device &device,
+                            vk::PhysicalDevice &physicalDevice) {
+  // the pools are small, so they are created whether or not profiling is on
+  // and it can be switched while running
+  auto limits = physicalDevice.getProperties().limits;
+  timestampPeriod = limits.timestampPeriod;
+  supported = limits.timestampComputeAndGraphics;
+  if (!supported)
+    return;
+  auto features = physicalDevice.getFeatures();
+  pipelineStatistics = features.pipelineStatisticsQuery;
+  inheritedQueries = pipelineStatistics && features.inheritedQueries;
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vk::QueryPoolCreateInfo timestampInfo{};
+    timestampInfo.queryType = vk::QueryType::eTimestamp;
+    timestampInfo.queryCount = 2 * PROFILER_PASS_COUNT;
+    timestampPools[i] = device.createQueryPool(timestampInfo);
+
+    if (pipelineStatistics) {
+      vk::QueryPoolCreateInfo statisticsInfo{};
+      statisticsInfo.queryType = vk::QueryType::ePipelineStatistics;
+      statisticsInfo.queryCount = PROFILER_PASS_COUNT;
+      statisticsInfo.pipelineStatistics = PROFILER_STATISTICS;
+      statisticsPools[i] = device.createQueryPool(statisticsInfo);
+    }
+  }
+}
+
+void BulkinProfiler::reset(vk::CommandBuffer commandBuffer,
+                           uint32_t currentFrame) {
+  commandBuffer.resetQueryPool(timestampPools[currentFrame], 0,
+                               2 * PROFILER_PASS_COUNT);
+  if (pipelineStatistics)
+    commandBuffer.resetQueryPool(statisticsPools[currentFrame], 0,
+                                 PROFILER_PASS_COUNT);
+}
+
+void BulkinProfiler::beginPass(vk::CommandBuffer commandBuffer,
+                               uint32_t currentFrame, ProfilerPass pass,
+                               bool secondaries) {
+  auto index = static_cast<uint32_t>(pass);
+  commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands,
+                                timestampPools[currentFrame], 2 * index);
+  if (pipelineStatistics && (!secondaries || inheritedQueries))
+    commandBuffer.beginQuery(statisticsPools[currentFrame], index, {});
+}
+
+void BulkinProfiler::endPass(vk::CommandBuffer commandBuffer,
+                             uint32_t currentFrame, ProfilerPass pass,
+                             bool secondaries) {
+  auto index = static_cast<uint32_t>(pass);
+  if (pipelineStatistics && (!secondaries || inheritedQueries))
+    commandBuffer.endQuery(statisticsPools[currentFrame], index);
+  commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands,
+                                timestampPools[currentFrame], 2 * index + 1);
+}
+
+void BulkinProfiler::collect(vk::Device &device, uint32_t currentFrame) {
+  // called once the frame's fence has signalled, so the queries written the
+  // last time this frame slot was submitted are complete and never stall
+  if (!submitted[currentFrame]) {
+    submitted[currentFrame] = true;
+    return;
+  }
+
+  // every query is followed by its availability word so passes that were not
+  // recorded this frame can be skipped
+  std::array<uint64_t, 4 * PROFILER_PASS_COUNT> timestamps{};
+  auto result = device.getQueryPoolResults(
+      timestampPools[currentFrame], 0, 2 * PROFILER_PASS_COUNT,
+      sizeof(timestamps), timestamps.data(), 2 * sizeof(uint64_t),
+      vk::QueryResultFlagBits::e64 |
+          vk::QueryResultFlagBits::eWithAvailability);
+  if (result != vk::Result::eSuccess && result != vk::Result::eNotReady)
+    throw std::runtime_error("failed to read timestamp queries");
+
+  constexpr size_t statisticsStride = PROFILER_STATISTIC_COUNT + 1;
+  std::array<uint64_t, statisticsStride * PROFILER_PASS_COUNT> statistics{};
+  if (pipelineStatistics) {
+    result = device.getQueryPoolResults(
+        statisticsPools[currentFrame], 0, PROFILER_PASS_COUNT,
+        sizeof(statistics), statistics.data(),
+        statisticsStride * sizeof(uint64_t),
+        vk::QueryResultFlagBits::e64 |
+            vk::QueryResultFlagBits::eWithAvailability);
+    if (result != vk::Result::eSuccess && result != vk::Result::eNotReady)
+      throw std::runtime_error("failed to read pipeline statistics queries");
+  }
+
+  frameCount++;
+  for (uint32_t pass = 0; pass < PROFILER_PASS_COUNT; pass++) {
+    uint64_t begin = timestamps[4 * pass];
+    uint64_t beginAvailable = timestamps[4 * pass + 1];
+    uint64_t end = timestamps[4 * pass + 2];
+    uint64_t endAvailable = timestamps[4 * pass + 3];
+    if (!beginAvailable || !endAvailable)
+      continue;
+
+    PassSample sample{};
+    sample.frame = frameCount;
+    sample.milliseconds =
+        static_cast<double>(end - begin) * timestampPeriod / 1000000.0;
+    if (pipelineStatistics &&
+        statistics[statisticsStride * pass + PROFILER_STATISTIC_COUNT]) {
+      for (size_t i = 0; i < PROFILER_STATISTIC_COUNT; i++)
+        sample.statistics[i] = statistics[statisticsStride * pass + i];
+    }
+
+    samples[pass].push_back(sample);
+    if (samples[pass].size() > PROFILER_WINDOW)
+      samples[pass].pop_front();
+  }
+}
+
+PassStatistics BulkinProfiler::getStatistics(ProfilerPass pass) const {
+  const auto &passSamples = samples[static_cast<uint32_t>(pass)];
+  PassStatistics statistics{};
+  statistics.samples = passSamples.size();
+  if (passSamples.empty())
+    return statistics;
+
+  std::vector<double> times;
+  times.reserve(passSamples.size());
+  double total = 0.0;
+  for (const auto &sample : passSamples) {
+    times.push_back(sample.milliseconds);
+    total += sample.milliseconds;
+  }
+
+  auto p99 = times.begin() + (times.size() - 1) * 99 / 100;
+  std::nth_element(times.begin(), p99, times.end());
+
+  statistics.minMilliseconds = *std::min_element(times.begin(), times.end());
+  statistics.avgMilliseconds = total / static_cast<double>(times.size());
+  statistics.p99Milliseconds = *p99;
+  statistics.lastStatistics = passSamples.back().statistics;
+  return statistics;
+}
+
+void BulkinProfiler::writeCsv(const std::string &path) const {
+  std::ofstream file(path);
+  if (!file.is_open())
+    throw std::runtime_error("failed to open profiler csv");
+
+  file << "frame,pass,gpu_ms,ia_vertices,vs_invocations,clip_primitives,"
+          "fs_invocations,cs_invocations\n";
+  for (uint32_t pass = 0; pass < PROFILER_PASS_COUNT; pass++) {
+    for (const auto &sample : samples[pass]) {
+      file << sample.frame << ','
+           << passName(static_cast<ProfilerPass>(pass)) << ','
+           << sample.milliseconds;
+      for (auto statistic : sample.statistics)
+        file << ',' << statistic;
+      file << '\n';
+    }
+  }
+}
+
+vk::QueryPipelineStatisticFlags BulkinProfiler::inheritedStatistics() const {
+  return inheritedQueries ? PROFILER_STATISTICS
+                          : vk::QueryPipelineStatisticFlags{};
+}
+
+void BulkinProfiler::restart() { submitted.fill(false); }
+
+bool BulkinProfiler::isSupported() const { return supported; }
+
+void BulkinProfiler::cleanup(vk::Device &device) {
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    device.destroy(timestampPools[i]);
+    if (pipelineStatistics)
+      device.destroy(statisticsPools[i]);
+  }
+}
+
+const char *BulkinProfiler::passName(ProfilerPass pass) {
+  switch (pass) {
+  case ProfilerPass::Culling:
+    return "culling";
+  case ProfilerPass::Occlusion:
+    return "occlusion";
+  case ProfilerPass::Clusters:
+    return "clusters";
+  case ProfilerPass::Main:
+    return "main";
+  case ProfilerPass::Pyramid:
+    return "pyramid";
+  case ProfilerPass::Late:
+    return "late";
+  default:
+    return "unknown";
+  }
+}
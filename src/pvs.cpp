@@ -0,0 +1,159 @@
+#include "pvs.h"
+
+#include "job-pool.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+void BulkinPvs::build(const std::vector<std::vector<uint32_t>> &walls,
+                      bool bake, BulkinJobPool &jobs) {
+  depth = walls.size();
+  width = depth > 0 ? walls[0].size() : 0;
+  regions = 0;
+  cellRegions.assign(width * depth, PVS_NO_REGION);
+  rows.clear();
+  rowOffsets.clear();
+  visiblePairs = 0;
+
+  // every block with at least one open cell becomes a region, numbered in
+  // scan order
+  auto blocksX = (width + PVS_REGION_SIZE - 1) / PVS_REGION_SIZE;
+  auto blocksZ = (depth + PVS_REGION_SIZE - 1) / PVS_REGION_SIZE;
+  std::vector<uint32_t> blockRegions(blocksX * blocksZ, PVS_NO_REGION);
+  for (size_t z = 0; z < depth; z++) {
+    for (size_t x = 0; x < width; x++) {
+      if (walls[z][x] != 0)
+        continue;
+      auto &block =
+          blockRegions[z / PVS_REGION_SIZE * blocksX + x / PVS_REGION_SIZE];
+      if (block == PVS_NO_REGION)
+        block = regions++;
+      cellRegions[z * width + x] = block;
+    }
+  }
+  if (regions == 0 || !bake)
+    return;
+
+  // each region only writes its own row, so they trace in parallel
+  size_t rowBytes = (regions + 7) / 8;
+  std::vector<std::vector<uint8_t>> visible(
+      regions, std::vector<uint8_t>(rowBytes, 0));
+  jobs.run(regions, [this, &visible](uint32_t region) {
+    traceRegion(region, visible[region]);
+  });
+
+  // sight lines work both ways, so a pair any sampled ray found is kept in
+  // both rows to make up for rays that slipped past a narrow opening
+  for (uint32_t a = 0; a < regions; a++) {
+    for (uint32_t b = a + 1; b < regions; b++) {
+      bool ab = visible[a][b / 8] & (1u << (b % 8));
+      bool ba = visible[b][a / 8] & (1u << (a % 8));
+      if (ab != ba) {
+        visible[a][b / 8] |= static_cast<uint8_t>(1u << (b % 8));
+        visible[b][a / 8] |= static_cast<uint8_t>(1u << (a % 8));
+      }
+    }
+  }
+
+  rowOffsets.reserve(regions + 1);
+  for (const auto &row : visible) {
+    for (auto byte : row)
+      visiblePairs += std::popcount(byte);
+    rowOffsets.push_back(static_cast<uint32_t>(rows.size()));
+    compress(row);
+  }
+  rowOffsets.push_back(static_cast<uint32_t>(rows.size()));
+}
+
+uint32_t BulkinPvs::regionAt(int64_t x, int64_t z) const {
+  if (x < 0 || z < 0 || x >= static_cast<int64_t>(width) ||
+      z >= static_cast<int64_t>(depth))
+    return PVS_NO_REGION;
+  return cellRegions[static_cast<size_t>(z) * width + static_cast<size_t>(x)];
+}
+
+uint32_t BulkinPvs::regionAt(glm::vec3 position) const {
+  auto grid = gridPosition(position);
+  return regionAt(static_cast<int64_t>(std::floor(grid.x)),
+                  static_cast<int64_t>(std::floor(grid.y)));
+}
+
+void BulkinPvs::decompress(uint32_t region, std::span<uint32_t> bits) const {
+  std::fill(bits.begin(), bits.end(), 0u);
+  if (region >= regions)
+    return;
+
+  size_t byte = 0;
+  for (auto i = rowOffsets[region]; i < rowOffsets[region + 1]; i++) {
+    if (rows[i] == 0) {
+      byte += rows[++i];
+      continue;
+    }
+    if (byte / 4 < bits.size())
+      bits[byte / 4] |= static_cast<uint32_t>(rows[i]) << (8 * (byte % 4));
+    byte++;
+  }
+}
+
+double BulkinPvs::density() const {
+  if (regions == 0)
+    return 1.0;
+  return static_cast<double>(visiblePairs) /
+         (static_cast<double>(regions) * static_cast<double>(regions));
+}
+
+void BulkinPvs::traceRegion(uint32_t region,
+                            std::vector<uint8_t> &visible) const {
+  auto mark = [&visible](uint32_t seen) {
+    visible[seen / 8] |= static_cast<uint8_t>(1u << (seen % 8));
+  };
+  mark(region);
+
+  // rays leave from the middle and from just inside each corner of every open
+  // cell
+  constexpr float inset = 0.45f;
+  const glm::vec2 samples[5] = {{0.5f, 0.5f},
+                                {0.5f - inset, 0.5f - inset},
+                                {0.5f + inset, 0.5f - inset},
+                                {0.5f - inset, 0.5f + inset},
+                                {0.5f + inset, 0.5f + inset}};
+
+  for (size_t z = 0; z < depth; z++) {
+    for (size_t x = 0; x < width; x++) {
+      if (cellRegions[z * width + x] != region)
+        continue;
+
+      for (const auto &sample : samples) {
+        glm::vec2 origin = glm::vec2(x, z) + sample;
+        for (uint32_t ray = 0; ray < PVS_RAY_COUNT; ray++) {
+          float angle = glm::two_pi<float>() *
+                        (static_cast<float>(ray) + 0.5f) /
+                        static_cast<float>(PVS_RAY_COUNT);
+          traceRay(origin, glm::vec2(std::cos(angle), std::sin(angle)),
+                   mark);
+        }
+      }
+    }
+  }
+}
+
+void BulkinPvs::compress(std::span<const uint8_t> row) {
+  // non-zero bytes are stored as they are, a run of zero bytes becomes a zero
+  // followed by the run length
+  for (size_t i = 0; i < row.size(); i++) {
+    if (row[i] != 0) {
+      rows.push_back(row[i]);
+      continue;
+    }
+    uint8_t run = 1;
+    while (i + 1 < row.size() && row[i + 1] == 0 && run < 255) {
+      run++;
+      i++;
+    }
+    rows.push_back(0);
+    rows.push_back(run);
+  }
+}
@@ -1,26 +1,60 @@
 #include "quad.h"
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/quaternion.hpp>
-
-void BulkinQuad::addQuad(glm::vec3 position, float angle, glm::vec3 rotation, float scale, int faceId, uint32_t textureIndex) {
-  auto model = glm::mat4(1.0f);
-  model = glm::translate(model, position);
-  glm::quat rot = glm::angleAxis(glm::radians(angle), rotation);
-  model = model * glm::mat4_cast(rot);
-  model = glm::scale(model, glm::vec3(scale));
-  matrices.push_back(model);
-  faceIds.push_back(faceId);
-  textureIndices.push_back(textureIndex);
+
+#include <cmath>
+#include <stdexcept>
+
+uint32_t BulkinQuad::addQuad(glm::vec3 position, glm::vec2 size, int faceId, uint32_t textureIndex, uint32_t region) {
+  // the orientation of each face id is fixed in the vertex and culling
+  // shaders, size is in whole cells and the texture repeats once per cell
+  auto width = static_cast<uint32_t>(std::lround(size.x));
+  auto height = static_cast<uint32_t>(std::lround(size.y));
+  if (faceId < 0 || faceId > 5)
+    throw std::runtime_error("invalid quad face id");
+  if (textureIndex >= (1u << INSTANCE_TEXTURE_BITS))
+    throw std::runtime_error("quad texture index out of range");
+  if (width == 0 || height == 0 || width >= (1u << INSTANCE_SIZE_BITS) || height >= (1u << INSTANCE_SIZE_BITS))
+    throw std::runtime_error("quad size out of range");
+
+  PerInstanceData instance{};
+  instance.position[0] = position.x;
+  instance.position[1] = position.y;
+  instance.position[2] = position.z;
+  instance.packed = static_cast<uint32_t>(faceId) |
+                    textureIndex << INSTANCE_FACE_BITS |
+                    width << (INSTANCE_FACE_BITS + INSTANCE_TEXTURE_BITS) |
+                    height << (INSTANCE_FACE_BITS + INSTANCE_TEXTURE_BITS + INSTANCE_SIZE_BITS);
+  instances.push_back(instance);
+  regions.push_back(region);
+  return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void BulkinQuad::setPosition(uint32_t quad, glm::vec3 position) {
+  if (quad >= instances.size())
+    throw std::runtime_error("invalid quad handle");
+  instances[quad].position[0] = position.x;
+  instances[quad].position[1] = position.y;
+  instances[quad].position[2] = position.z;
+}
+
+void BulkinQuad::setRegion(uint32_t quad, uint32_t region) {
+  if (quad >= regions.size())
+    throw std::runtime_error("invalid quad handle");
+  regions[quad] = region;
+}
+
+void BulkinQuad::setTexture(uint32_t quad, uint32_t textureIndex) {
+  if (quad >= instances.size())
+    throw std::runtime_error("invalid quad handle");
+  if (textureIndex >= (1u << INSTANCE_TEXTURE_BITS))
+    throw std::runtime_error("quad texture index out of range");
+  constexpr uint32_t textureMask = ((1u << INSTANCE_TEXTURE_BITS) - 1) << INSTANCE_FACE_BITS;
+  instances[quad].packed = (instances[quad].packed & ~textureMask) | textureIndex << INSTANCE_FACE_BITS;
 }
 
-uint32_t BulkinQuad::getInstanceCount() {
-  return static_cast<uint32_t>(matrices.size());
+uint32_t BulkinQuad::getInstanceCount() const {
+  return static_cast<uint32_t>(instances.size());
 }
 
-PerInstanceData BulkinQuad::getInstanceData(size_t i) {
-  return PerInstanceData {
-    .model = matrices[i],
-    .faceId = faceIds[i],
-    .textureIndex = textureIndices[i]
-  };
+const PerInstanceData& BulkinQuad::getInstanceData(size_t i) const {
+  return instances[i];
 }
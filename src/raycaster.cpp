@@ -0,0 +1,90 @@
+#include "raycaster.h"
+
+#include "constants.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+void BulkinRaycaster::trace(const BulkinPvs &pvs, const glm::mat4 &view,
+                            const glm::vec3 &viewPos, float aspect,
+                            BulkinJobPool &jobs, std::span<uint32_t> bits) {
+  std::fill(bits.begin(), bits.end(), 0u);
+  auto mark = [](std::span<uint32_t> words, uint32_t region) {
+    if (region / 32 < words.size())
+      words[region / 32] |= 1u << (region % 32);
+  };
+  mark(bits, pvs.regionAt(viewPos));
+
+  float first, last;
+  fan(view, aspect, first, last);
+  auto origin = BulkinPvs::gridPosition(viewPos);
+
+  // every job fills its own words, they are merged once all rays are walked.
+  // the words are kept from frame to frame and the jobs run as one batch on
+  // the pool, so tracing allocates nothing once the region count is known
+  uint32_t jobCount =
+      (RAYCAST_RAY_COUNT + RAYCAST_RAYS_PER_JOB - 1) / RAYCAST_RAYS_PER_JOB;
+  jobBits.resize(jobCount);
+  for (auto &words : jobBits)
+    words.assign(bits.size(), 0u);
+  jobs.run(jobCount, [this, &pvs, &mark, origin, first, last](uint32_t job) {
+    std::span<uint32_t> words = jobBits[job];
+    auto end = std::min((job + 1) * RAYCAST_RAYS_PER_JOB, RAYCAST_RAY_COUNT);
+    for (auto ray = job * RAYCAST_RAYS_PER_JOB; ray < end; ray++) {
+      float angle = first + (last - first) * (static_cast<float>(ray) + 0.5f) /
+                                static_cast<float>(RAYCAST_RAY_COUNT);
+      pvs.traceRay(origin, glm::vec2(std::cos(angle), std::sin(angle)),
+                   [&mark, words](uint32_t region) { mark(words, region); });
+    }
+  });
+
+  for (const auto &words : jobBits) {
+    for (size_t i = 0; i < bits.size(); i++)
+      bits[i] |= words[i];
+  }
+}
+
+void BulkinRaycaster::fan(const glm::mat4 &view, float aspect, float &first,
+                          float &last) {
+  // the rows of the view rotation are the camera axes in world space, grid
+  // space angles are measured from +x towards +z
+  glm::vec3 right(view[0][0], view[1][0], view[2][0]);
+  glm::vec3 up(view[0][1], view[1][1], view[2][1]);
+  glm::vec3 forward(-view[0][2], -view[1][2], -view[2][2]);
+  glm::vec2 heading(forward.x, forward.z);
+
+  // pitching the camera widens the frustum's footprint on the grid, so the fan
+  // spans the frustum's corner edges rather than the horizontal field of view.
+  // once a corner points behind the camera, or there is no heading at all when
+  // looking straight up or down, every direction is walked
+  bool full = glm::length(heading) < 1e-4f;
+  float base = std::atan2(heading.y, heading.x);
+  float low = 0.0f, high = 0.0f;
+  float tanY = std::tan(glm::radians(FIELD_OF_VIEW) * 0.5f);
+  float tanX = tanY * aspect;
+  for (float x : {-tanX, tanX}) {
+    for (float y : {-tanY, tanY}) {
+      auto corner = forward + right * x + up * y;
+      glm::vec2 footprint(corner.x, corner.z);
+      if (glm::dot(footprint, heading) <= 0.0f)
+        full = true;
+      float angle = std::atan2(footprint.y, footprint.x) - base;
+      angle = std::remainder(angle, glm::two_pi<float>());
+      low = std::min(low, angle);
+      high = std::max(high, angle);
+    }
+  }
+
+  if (full) {
+    first = 0.0f;
+    last = glm::two_pi<float>();
+    return;
+  }
+  // half a ray's spacing of slack on either side keeps the edge of the screen
+  // covered
+  float slack = 0.5f * (high - low) / static_cast<float>(RAYCAST_RAY_COUNT);
+  first = base + low - slack;
+  last = base + high + slack;
+}
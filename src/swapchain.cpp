@@ -22,17 +22,11 @@ void BulkinSwapchain::chooseSwapPresentMode() {
   presentMode = vk::PresentModeKHR::eFifo;
 }
 
-void BulkinSwapchain::chooseSwapExtent(GLFWwindow *window) {
+void BulkinSwapchain::chooseSwapExtent(vk::Extent2D framebufferExtent) {
   if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
     extent = capabilities.currentExtent;
   } else {
-    int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
-    
-    vk::Extent2D actualExtext = {
-      static_cast<uint32_t>(width),
-      static_cast<uint32_t>(height)
-    };
+    vk::Extent2D actualExtext = framebufferExtent;
     
     actualExtext.width = std::clamp(actualExtext.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
     actualExtext.height = std::clamp(actualExtext.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
@@ -47,10 +41,10 @@ void BulkinSwapchain::querySwapchainSupport(vk::PhysicalDevice& physicalDevice,
   presentModes = physicalDevice.getSurfacePresentModesKHR(surface);
 }
 
-void BulkinSwapchain::createSwapchain(vk::Device& device, vk::SurfaceKHR& surface, GLFWwindow *window, QueueFamilyIndices indices) {
+void BulkinSwapchain::createSwapchain(vk::Device& device, vk::SurfaceKHR& surface, vk::Extent2D framebufferExtent, QueueFamilyIndices indices) {
   chooseSwapSurfaceFormat();
   chooseSwapPresentMode();
-  chooseSwapExtent(window);
+  chooseSwapExtent(framebufferExtent);
   
   uint32_t imageCount = capabilities.minImageCount + 1;
   if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount)
@@ -95,8 +89,29 @@ void BulkinSwapchain::createImageViews(vk::Device& device) {
   }
 }
 
-void BulkinSwapchain::cleanup(vk::Device& device) {
-  device.destroy(swapchain);
+void BulkinSwapchain::createOffscreen(vk::Device& device, BulkinAllocator& allocator, uint32_t width, uint32_t height, uint32_t imageCount) {
+  offscreen = true;
+  extent = vk::Extent2D(width, height);
+  imageFormat = vk::Format::eB8G8R8A8Srgb;
+  finalLayout = vk::ImageLayout::eTransferSrcOptimal;
+  
+  images.resize(imageCount);
+  imageMemory.resize(imageCount);
+  for (size_t i = 0; i < imageCount; i++)
+    Bulkin::createImage(width, height, imageFormat, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal, device, allocator, images[i], imageMemory[i], 1, AllocationCategory::Attachment);
+  
+  createImageViews(device);
+}
+
+void BulkinSwapchain::cleanup(vk::Device& device, BulkinAllocator& allocator) {
+  if (offscreen) {
+    for (size_t i = 0; i < images.size(); i++) {
+      device.destroy(images[i]);
+      allocator.free(imageMemory[i]);
+    }
+  } else {
+    device.destroy(swapchain);
+  }
   for (const auto& imageView: imageViews)
     device.destroy(imageView);
 }
@@ -105,16 +120,11 @@ bool BulkinSwapchain::isAdequate() {
   return !formats.empty() && !presentModes.empty();
 }
 
-void BulkinSwapchain::recreate(vk::Device& device, vk::SurfaceKHR& surface, GLFWwindow* window, QueueFamilyIndices indices) {
-  int width = 0, height = 0;
-  glfwGetFramebufferSize(window, &width, &height);
-  while (width == 0 || height == 0) {
-    glfwGetFramebufferSize(window, &width, &height);
-    glfwWaitEvents();
-  }
-  
+// may run off the main thread, so the caller supplies the framebuffer size and
+// waits out a minimised window itself
+void BulkinSwapchain::recreate(vk::Device& device, BulkinAllocator& allocator, vk::SurfaceKHR& surface, vk::Extent2D framebufferExtent, QueueFamilyIndices indices) {
   device.waitIdle();
-  cleanup(device);
-  createSwapchain(device, surface, window, indices);
+  cleanup(device, allocator);
+  createSwapchain(device, surface, framebufferExtent, indices);
   createImageViews(device);
 }
@@ -0,0 +1,302 @@
+#include "texture-cooker.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <print>
+#include <vector>
+
+constexpr uint32_t BC1_BLOCK_BYTES = 8;
+
+static float srgbToLinear(uint8_t value) {
+  static const auto table = []() {
+    std::array<float, 256> table{};
+    for (size_t i = 0; i < table.size(); i++) {
+      float c = static_cast<float>(i) / 255.0f;
+      table[i] = c <= 0.04045f ? c / 12.92f
+                               : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return table;
+  }();
+  return table[value];
+}
+
+static uint8_t linearToSrgb(float value) {
+  value = std::clamp(value, 0.0f, 1.0f);
+  float c = value <= 0.0031308f
+                ? value * 12.92f
+                : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+  return static_cast<uint8_t>(std::lround(c * 255.0f));
+}
+
+// 2x2 box filter, the colour channels are averaged as linear light
+static std::vector<uint8_t> downsample(const std::vector<uint8_t> &source,
+                                       uint32_t width, uint32_t height,
+                                       uint32_t mipWidth, uint32_t mipHeight) {
+  std::vector<uint8_t> mip(static_cast<size_t>(mipWidth) * mipHeight * 4);
+  for (uint32_t y = 0; y < mipHeight; y++) {
+    for (uint32_t x = 0; x < mipWidth; x++) {
+      uint32_t x0 = std::min(2 * x, width - 1);
+      uint32_t x1 = std::min(2 * x + 1, width - 1);
+      uint32_t y0 = std::min(2 * y, height - 1);
+      uint32_t y1 = std::min(2 * y + 1, height - 1);
+      const uint8_t *texels[4] = {
+          &source[(static_cast<size_t>(y0) * width + x0) * 4],
+          &source[(static_cast<size_t>(y0) * width + x1) * 4],
+          &source[(static_cast<size_t>(y1) * width + x0) * 4],
+          &source[(static_cast<size_t>(y1) * width + x1) * 4]};
+
+      uint8_t *out = &mip[(static_cast<size_t>(y) * mipWidth + x) * 4];
+      for (int c = 0; c < 3; c++) {
+        float sum = 0.0f;
+        for (auto texel : texels)
+          sum += srgbToLinear(texel[c]);
+        out[c] = linearToSrgb(sum * 0.25f);
+      }
+      uint32_t alpha = 0;
+      for (auto texel : texels)
+        alpha += texel[3];
+      out[3] = static_cast<uint8_t>((alpha + 2) / 4);
+    }
+  }
+  return mip;
+}
+
+static uint16_t packRgb565(const int color[3]) {
+  return static_cast<uint16_t>(((color[0] * 31 + 127) / 255) << 11 |
+                               ((color[1] * 63 + 127) / 255) << 5 |
+                               ((color[2] * 31 + 127) / 255));
+}
+
+static void unpackRgb565(uint16_t packed, int color[3]) {
+  int r = (packed >> 11) & 31;
+  int g = (packed >> 5) & 63;
+  int b = packed & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+// endpoints come from the block's bounding box, inset by a sixteenth and
+// flipped onto the diagonal the colours actually run along
+static void encodeBlockBC1(const uint8_t (&texels)[16][4], uint8_t *out) {
+  int minColor[3] = {255, 255, 255};
+  int maxColor[3] = {0, 0, 0};
+  int mean[3] = {0, 0, 0};
+  for (const auto &texel : texels) {
+    for (int c = 0; c < 3; c++) {
+      minColor[c] = std::min<int>(minColor[c], texel[c]);
+      maxColor[c] = std::max<int>(maxColor[c], texel[c]);
+      mean[c] += texel[c];
+    }
+  }
+
+  int covariance[3] = {0, 0, 0};
+  for (const auto &texel : texels) {
+    int green = texel[1] * 16 - mean[1];
+    for (int c = 0; c < 3; c++)
+      covariance[c] += (texel[c] * 16 - mean[c]) * green;
+  }
+
+  for (int c = 0; c < 3; c++) {
+    int inset = (maxColor[c] - minColor[c]) >> 4;
+    minColor[c] += inset;
+    maxColor[c] -= inset;
+    if (covariance[c] < 0)
+      std::swap(minColor[c], maxColor[c]);
+  }
+
+  uint16_t endpoint0 = packRgb565(maxColor);
+  uint16_t endpoint1 = packRgb565(minColor);
+  // endpoint0 > endpoint1 selects the opaque four colour mode
+  if (endpoint0 < endpoint1)
+    std::swap(endpoint0, endpoint1);
+
+  uint32_t indices = 0;
+  if (endpoint0 != endpoint1) {
+    int palette[4][3];
+    unpackRgb565(endpoint0, palette[0]);
+    unpackRgb565(endpoint1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (uint32_t i = 0; i < 16; i++) {
+      uint32_t best = 0;
+      int bestError = INT32_MAX;
+      for (uint32_t p = 0; p < 4; p++) {
+        int error = 0;
+        for (int c = 0; c < 3; c++) {
+          int delta = texels[i][c] - palette[p][c];
+          error += delta * delta;
+        }
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= best << (2 * i);
+    }
+  }
+
+  out[0] = static_cast<uint8_t>(endpoint0);
+  out[1] = static_cast<uint8_t>(endpoint0 >> 8);
+  out[2] = static_cast<uint8_t>(endpoint1);
+  out[3] = static_cast<uint8_t>(endpoint1 >> 8);
+  for (int i = 0; i < 4; i++)
+    out[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+static std::vector<uint8_t> encodeBC1(const std::vector<uint8_t> &pixels,
+                                      uint32_t width, uint32_t height) {
+  uint32_t blocksX = (width + 3) / 4;
+  uint32_t blocksY = (height + 3) / 4;
+  std::vector<uint8_t> blocks(static_cast<size_t>(blocksX) * blocksY *
+                              BC1_BLOCK_BYTES);
+
+  for (uint32_t by = 0; by < blocksY; by++) {
+    for (uint32_t bx = 0; bx < blocksX; bx++) {
+      // edge blocks repeat the last row and column
+      uint8_t texels[16][4];
+      for (uint32_t i = 0; i < 16; i++) {
+        uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+        uint32_t y = std::min(by * 4 + i / 4, height - 1);
+        memcpy(texels[i], &pixels[(static_cast<size_t>(y) * width + x) * 4],
+               4);
+      }
+      encodeBlockBC1(
+          texels,
+          &blocks[(static_cast<size_t>(by) * blocksX + bx) * BC1_BLOCK_BYTES]);
+    }
+  }
+  return blocks;
+}
+
+// basic data format descriptor for sRGB BC1: one 64 bit colour sample per
+// 4x4 block
+static std::array<uint32_t, 11> bc1Descriptor() {
+  std::array<uint32_t, 11> descriptor{};
+  descriptor[0] = sizeof(descriptor);
+  descriptor[1] = 0;                      // khronos vendor, basic descriptor
+  descriptor[2] = 2 | (24 + 16) << 16;    // version 2, one sample
+  descriptor[3] = 128 | 1 << 8 | 2 << 16; // BC1A model, BT.709, sRGB
+  descriptor[4] = 3 | 3 << 8;             // 4x4x1x1 texel blocks
+  descriptor[5] = BC1_BLOCK_BYTES;        // bytes in plane 0
+  descriptor[6] = 0;
+  descriptor[7] = 63 << 16;               // bit offset 0, 64 bits, colour
+  descriptor[8] = 0;                      // sample position
+  descriptor[9] = 0;                      // sample lower
+  descriptor[10] = UINT32_MAX;            // sample upper
+  return descriptor;
+}
+
+bool BulkinTextureCooker::cook(const unsigned char *pixels, uint32_t width,
+                               uint32_t height, const std::string &path) {
+  return write(encode(pixels, width, height), width, height, path);
+}
+
+std::vector<std::vector<uint8_t>>
+BulkinTextureCooker::encode(const unsigned char *pixels, uint32_t width,
+                            uint32_t height) {
+  uint32_t levelCount =
+      static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+
+  std::vector<std::vector<uint8_t>> levels(levelCount);
+  std::vector<uint8_t> mip(pixels, pixels + static_cast<size_t>(width) *
+                                                height * 4);
+  uint32_t mipWidth = width;
+  uint32_t mipHeight = height;
+  for (uint32_t level = 0; level < levelCount; level++) {
+    levels[level] = encodeBC1(mip, mipWidth, mipHeight);
+    if (level + 1 < levelCount) {
+      uint32_t nextWidth = std::max(mipWidth / 2, 1u);
+      uint32_t nextHeight = std::max(mipHeight / 2, 1u);
+      mip = downsample(mip, mipWidth, mipHeight, nextWidth, nextHeight);
+      mipWidth = nextWidth;
+      mipHeight = nextHeight;
+    }
+  }
+  return levels;
+}
+
+bool BulkinTextureCooker::write(const std::vector<std::vector<uint8_t>> &levels,
+                                uint32_t width, uint32_t height,
+                                const std::string &path) {
+  std::println("cooking texture {}", path);
+  auto levelCount = static_cast<uint32_t>(levels.size());
+  auto descriptor = bc1Descriptor();
+
+  Ktx2Header header{};
+  memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+  header.vkFormat = static_cast<uint32_t>(vk::Format::eBc1RgbSrgbBlock);
+  header.typeSize = 1;
+  header.pixelWidth = width;
+  header.pixelHeight = height;
+  header.faceCount = 1;
+  header.levelCount = levelCount;
+  header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) +
+                                               sizeof(Ktx2Level) * levelCount);
+  header.dfdByteLength = sizeof(descriptor);
+
+  // level data is stored smallest first, each level aligned to a block
+  std::vector<Ktx2Level> index(levelCount);
+  uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+  for (uint32_t level = levelCount; level-- > 0;) {
+    offset = (offset + BC1_BLOCK_BYTES - 1) / BC1_BLOCK_BYTES * BC1_BLOCK_BYTES;
+    index[level].byteOffset = offset;
+    index[level].byteLength = levels[level].size();
+    index[level].uncompressedByteLength = levels[level].size();
+    offset += levels[level].size();
+  }
+
+  // written next to the real file and renamed so a crash never leaves a
+  // truncated texture behind
+  auto tempPath = path + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      std::println("failed to write cooked texture {}", path);
+      return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(index.data()),
+               static_cast<std::streamsize>(sizeof(Ktx2Level) * levelCount));
+    file.write(reinterpret_cast<const char *>(descriptor.data()),
+               sizeof(descriptor));
+    for (uint32_t level = levelCount; level-- > 0;) {
+      const char padding[BC1_BLOCK_BYTES] = {};
+      auto position = static_cast<uint64_t>(file.tellp());
+      file.write(padding, static_cast<std::streamsize>(
+                              index[level].byteOffset - position));
+      file.write(reinterpret_cast<const char *>(levels[level].data()),
+                 static_cast<std::streamsize>(levels[level].size()));
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error) {
+    std::println("failed to write cooked texture {}: {}", path,
+                 error.message());
+    return false;
+  }
+  return true;
+}
+
+uint32_t BulkinTextureCooker::blockBytes(vk::Format format) {
+  switch (format) {
+  case vk::Format::eBc1RgbSrgbBlock:
+  case vk::Format::eBc1RgbaSrgbBlock:
+    return 8;
+  case vk::Format::eBc3SrgbBlock:
+  case vk::Format::eBc7SrgbBlock:
+    return 16;
+  default:
+    return 0;
+  }
+}
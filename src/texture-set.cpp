@@ -0,0 +1,140 @@
+#include "texture-set.h"
+#include "bulkin.h"
+#include "vertex.h"
+
+#include <algorithm>
+
+void BulkinTextureSet::create(vk::Device &device,
+                              vk::PhysicalDevice &physicalDevice,
+                              BulkinAllocator &allocator,
+                              std::span<BulkinTexture> textures,
+                              bool compressed) {
+  if (textures.empty())
+    throw std::runtime_error("no textures added");
+
+  for (auto &texture : textures)
+    texture.probe(compressed);
+
+  // the first texture of every shape stands for its group
+  std::vector<uint32_t> groupOf(textures.size());
+  std::vector<uint32_t> groupFirst;
+  std::vector<uint32_t> groupSize;
+  for (uint32_t i = 0; i < textures.size(); i++) {
+    uint32_t group = 0;
+    while (group < groupFirst.size() &&
+           !textures[groupFirst[group]].sameShape(textures[i]))
+      group++;
+    if (group == groupFirst.size()) {
+      groupFirst.push_back(i);
+      groupSize.push_back(0);
+    }
+    groupOf[i] = group;
+    groupSize[group]++;
+  }
+
+  auto arrayGroup = static_cast<uint32_t>(
+      std::max_element(groupSize.begin(), groupSize.end()) - groupSize.begin());
+  if (groupSize[arrayGroup] >= TEXTURE_ARRAY_SLOT)
+    throw std::runtime_error("too many textures in the tile array");
+  createArrayImage(device, allocator, textures[groupFirst[arrayGroup]],
+                   groupSize[arrayGroup]);
+
+  slots.resize(textures.size());
+  looseTextures.clear();
+  uint32_t layer = 0;
+  for (uint32_t i = 0; i < textures.size(); i++) {
+    if (groupOf[i] == arrayGroup) {
+      textures[i].useArrayLayer(arrayImage, layer);
+      slots[i] = TEXTURE_ARRAY_SLOT | layer++;
+    } else {
+      textures[i].createImage(device, allocator);
+      slots[i] = static_cast<uint32_t>(looseTextures.size());
+      looseTextures.push_back(i);
+    }
+  }
+  if (looseTextures.size() >= TEXTURE_ARRAY_SLOT)
+    throw std::runtime_error("too many loose textures");
+
+  createSampler(device, physicalDevice);
+}
+
+uint32_t BulkinTextureSet::bindlessCount() const {
+  return std::max(static_cast<uint32_t>(looseTextures.size()), 1u);
+}
+
+void BulkinTextureSet::cleanup(vk::Device &device,
+                               BulkinAllocator &allocator) {
+  device.destroy(sampler);
+  device.destroy(arrayView);
+  device.destroy(firstLayerView);
+  device.destroy(arrayImage);
+  allocator.free(arrayMemory);
+}
+
+void BulkinTextureSet::createArrayImage(vk::Device &device,
+                                        BulkinAllocator &allocator,
+                                        const BulkinTexture &shape,
+                                        uint32_t layers) {
+  auto format = shape.getFormat();
+  auto mipLevels = shape.getMipLevels();
+
+  vk::ImageCreateInfo imageInfo{};
+  imageInfo.imageType = vk::ImageType::e2D;
+  imageInfo.extent.width = shape.getWidth();
+  imageInfo.extent.height = shape.getHeight();
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = mipLevels;
+  imageInfo.arrayLayers = layers;
+  imageInfo.format = format;
+  imageInfo.tiling = vk::ImageTiling::eOptimal;
+  imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+  imageInfo.usage =
+      vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+  // uncompressed layers build their mip chain with blits
+  if (format == vk::Format::eR8G8B8A8Srgb)
+    imageInfo.usage |= vk::ImageUsageFlagBits::eTransferSrc;
+  imageInfo.sharingMode = vk::SharingMode::eExclusive;
+  imageInfo.samples = vk::SampleCountFlagBits::e1;
+  arrayImage = device.createImage(imageInfo);
+
+  arrayMemory = allocator.allocate(
+      device.getImageMemoryRequirements(arrayImage),
+      vk::MemoryPropertyFlagBits::eDeviceLocal, AllocationCategory::Texture);
+  device.bindImageMemory(arrayImage, arrayMemory.memory, arrayMemory.offset);
+
+  vk::ImageViewCreateInfo viewInfo{};
+  viewInfo.image = arrayImage;
+  viewInfo.viewType = vk::ImageViewType::e2DArray;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = mipLevels;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = layers;
+  arrayView = device.createImageView(viewInfo);
+
+  firstLayerView = Bulkin::createImageView(
+      device, arrayImage, format, vk::ImageAspectFlagBits::eColor, mipLevels);
+}
+
+void BulkinTextureSet::createSampler(vk::Device &device,
+                                     vk::PhysicalDevice &physicalDevice) {
+  vk::SamplerCreateInfo samplerInfo{};
+  samplerInfo.magFilter = vk::Filter::eLinear;
+  samplerInfo.minFilter = vk::Filter::eLinear;
+  samplerInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
+  samplerInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
+  samplerInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
+  samplerInfo.anisotropyEnable = vk::True;
+  vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+  samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+  samplerInfo.borderColor = vk::BorderColor::eIntOpaqueBlack;
+  samplerInfo.unnormalizedCoordinates = vk::False;
+  samplerInfo.compareEnable = vk::False;
+  samplerInfo.compareOp = vk::CompareOp::eAlways;
+  samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
+  samplerInfo.mipLodBias = 0.0f;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = vk::LodClampNone;
+  sampler = device.createSampler(samplerInfo);
+}
@@ -1,108 +1,196 @@
 #include "texture.h"
 #include "buffer.h"
 #include "bulkin.h"
+#include "texture-cooker.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-void BulkinTexture::load(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::CommandPool& commandPool, vk::Queue& graphicsQueue) {
-  int texWidth, texHeight, texChannels;
-  stbi_uc* pixels = stbi_load(filename.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-  vk::DeviceSize imageSize = texWidth * texHeight * 4;
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+
+// reads only the header of the cooked file or the source image, so the images
+// can be created and grouped before anything is decoded
+void BulkinTexture::probe(bool compressed) {
+  if (compressed && mapCooked(filename + ".ktx2"))
+    return;
+  
+  int texChannels;
+  if (!stbi_info(filename.c_str(), &width, &height, &texChannels))
+    throw std::runtime_error("failed to load texture image " + filename);
+  
+  // a missing or stale cooked file is encoded by decode, so the format is
+  // already known here
+  format = compressed ? vk::Format::eBc1RgbSrgbBlock : vk::Format::eR8G8B8A8Srgb;
+  mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+bool BulkinTexture::sameShape(const BulkinTexture& other) const {
+  return width == other.width && height == other.height && format == other.format && mipLevels == other.mipLevels;
+}
+
+void BulkinTexture::createImage(vk::Device& device, BulkinAllocator& allocator) {
+  vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+  if (format == vk::Format::eR8G8B8A8Srgb)
+    usage |= vk::ImageUsageFlagBits::eTransferSrc;
   
-  mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+  Bulkin::createImage(width, height, format, vk::ImageTiling::eOptimal, usage, vk::MemoryPropertyFlagBits::eDeviceLocal, device, allocator, image, imageMemory, mipLevels);
+  imageView = Bulkin::createImageView(device, image, format, vk::ImageAspectFlagBits::eColor, mipLevels);
+}
+
+void BulkinTexture::useArrayLayer(vk::Image arrayImage, uint32_t layer) {
+  image = arrayImage;
+  inArray = true;
+  this->layer = layer;
+}
+
+// runs on a worker thread and only touches this texture's pixels and levels
+void BulkinTexture::decode() {
+  if (cooked)
+    return;
+  
+  loadPixels();
+  if (format == vk::Format::eR8G8B8A8Srgb)
+    return;
+  
+  // the cooked file was missing or stale: encode now, keep the result for this
+  // run and write it out for the next one
+  encoded = BulkinTextureCooker::encode(pixels, width, height);
+  BulkinTextureCooker::write(encoded, width, height, filename + ".ktx2");
+  stbi_image_free(pixels);
+  pixels = nullptr;
+  
+  levels.clear();
+  for (const auto& level : encoded)
+    levels.push_back({reinterpret_cast<const std::byte*>(level.data()), level.size()});
+}
+
+void BulkinTexture::loadPixels() {
+  int texChannels;
+  pixels = stbi_load(filename.c_str(), &width, &height, &texChannels, STBI_rgb_alpha);
   
   if (!pixels)
-    throw std::runtime_error("failed to load texture image");
-  vk::Buffer stagingBuffer;
-  vk::DeviceMemory stagingBufferMemory;
+    throw std::runtime_error("failed to load texture image " + filename);
+}
+
+bool BulkinTexture::mapCooked(const std::string& cookedPath) {
+  std::error_code error;
+  auto cookedTime = std::filesystem::last_write_time(cookedPath, error);
+  if (error)
+    return false;
+  auto sourceTime = std::filesystem::last_write_time(filename, error);
+  if (!error && sourceTime > cookedTime)
+    return false;
+  
+  auto file = std::make_shared<BulkinMappedFile>(cookedPath);
+  if (!file->isOpen() || file->size() < sizeof(Ktx2Header))
+    return false;
+  
+  Ktx2Header header;
+  memcpy(&header, file->data(), sizeof(header));
+  auto cookedFormat = static_cast<vk::Format>(header.vkFormat);
+  auto blockBytes = BulkinTextureCooker::blockBytes(cookedFormat);
+  if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 || blockBytes == 0 || header.supercompressionScheme != 0 || header.pixelDepth != 0 || header.layerCount != 0 || header.faceCount != 1 || header.levelCount == 0 || header.pixelWidth == 0 || header.pixelHeight == 0)
+    return false;
+  if (sizeof(Ktx2Header) + sizeof(Ktx2Level) * header.levelCount > file->size())
+    return false;
+  
+  std::vector<Level> cookedLevels(header.levelCount);
+  auto index = file->data() + sizeof(Ktx2Header);
+  for (uint32_t level = 0; level < header.levelCount; level++) {
+    Ktx2Level entry;
+    memcpy(&entry, index + sizeof(Ktx2Level) * level, sizeof(entry));
+    
+    uint64_t blocksX = (std::max(header.pixelWidth >> level, 1u) + 3) / 4;
+    uint64_t blocksY = (std::max(header.pixelHeight >> level, 1u) + 3) / 4;
+    if (entry.byteLength != blocksX * blocksY * blockBytes || entry.byteOffset + entry.byteLength > file->size())
+      return false;
+    cookedLevels[level] = {file->data() + entry.byteOffset, entry.byteLength};
+  }
   
-  BulkinBuffer::createBuffer(device, physicalDevice, imageSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
+  format = cookedFormat;
+  width = static_cast<int>(header.pixelWidth);
+  height = static_cast<int>(header.pixelHeight);
+  mipLevels = header.levelCount;
+  levels = std::move(cookedLevels);
+  cooked = std::move(file);
+  return true;
+}
+
+// runs on the thread that owns the uploader once decode has finished
+void BulkinTexture::upload(vk::PhysicalDevice& physicalDevice, BulkinUploader& uploader) {
+  if (!levels.empty()) {
+    // every level is baked already, so there is nothing to blit; each copy is
+    // recorded right after its level is staged in case staging flushed the
+    // batch in between
+    for (uint32_t level = 0; level < mipLevels; level++) {
+      auto stagingOffset = uploader.stage(levels[level].data, levels[level].size);
+      auto commandBuffer = uploader.commandBuffer();
+      if (level == 0)
+        Bulkin::transitionImageLayout(commandBuffer, format, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, image, mipLevels, layer);
+      copyBufferToImage(commandBuffer, uploader.stagingBuffer(stagingOffset), uploader.stagingBufferOffset(stagingOffset), std::max(static_cast<uint32_t>(width) >> level, 1u), std::max(static_cast<uint32_t>(height) >> level, 1u), level);
+    }
+    Bulkin::transitionImageLayout(uploader.commandBuffer(), format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, image, mipLevels, layer);
+    levels.clear();
+    encoded.clear();
+    cooked.reset();
+    return;
+  }
   
-  void* data = device.mapMemory(stagingBufferMemory, 0, imageSize);
-  memcpy(data, pixels, static_cast<size_t>(imageSize));
-  device.unmapMemory(stagingBufferMemory);
+  vk::DeviceSize imageSize = static_cast<vk::DeviceSize>(width) * height * 4;
   
+  // the pixels are copied into the staging ring straight away, the transition,
+  // copy and mip chain are recorded into the uploader's batch and run when it
+  // is flushed together with the other level resources
+  auto stagingOffset = uploader.stage(pixels, imageSize);
   stbi_image_free(pixels);
+  pixels = nullptr;
   
-  Bulkin::createImage(texWidth, texHeight, vk::Format::eR8G8B8A8Srgb, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal, device, physicalDevice, image, imageMemory, mipLevels);
-  Bulkin::transitionImageLayout(device, commandPool, graphicsQueue, vk::Format::eR8G8B8A8Srgb, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, image, mipLevels);
-  copyBufferToImage(stagingBuffer, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), device, commandPool, graphicsQueue);
-  generateMipmaps(image, vk::Format::eR8G8B8A8Srgb, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), mipLevels, device, physicalDevice, commandPool, graphicsQueue);
-  
-  device.destroy(stagingBuffer);
-  device.free(stagingBufferMemory);
-  
-  createImageView(device);
-  createTextureSampler(device, physicalDevice);
+  auto commandBuffer = uploader.commandBuffer();
+  Bulkin::transitionImageLayout(commandBuffer, vk::Format::eR8G8B8A8Srgb, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, image, mipLevels, layer);
+  copyBufferToImage(commandBuffer, uploader.stagingBuffer(stagingOffset), uploader.stagingBufferOffset(stagingOffset), static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0);
+  generateMipmaps(commandBuffer, image, vk::Format::eR8G8B8A8Srgb, width, height, mipLevels, physicalDevice);
 }
 
-void BulkinTexture::createImageView(vk::Device& device) {
-  imageView = Bulkin::createImageView(device, image, vk::Format::eR8G8B8A8Srgb, vk::ImageAspectFlagBits::eColor, mipLevels);
-}
-
-void BulkinTexture::copyBufferToImage(vk::Buffer buffer, uint32_t width, uint32_t height, vk::Device device, vk::CommandPool commandPool, vk::Queue graphicsQueue) {
-  auto commandBuffer = BulkinBuffer::beginSingleTimeCommands(device, commandPool);
-
+void BulkinTexture::copyBufferToImage(vk::CommandBuffer commandBuffer, vk::Buffer buffer, vk::DeviceSize offset, uint32_t width, uint32_t height, uint32_t mipLevel) {
   vk::BufferImageCopy region{};
-  region.bufferOffset = 0;
+  region.bufferOffset = offset;
   region.bufferRowLength = 0;
   region.bufferImageHeight = 0;
   
   region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-  region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.mipLevel = mipLevel;
+  region.imageSubresource.baseArrayLayer = layer;
   region.imageSubresource.layerCount = 1;
   
   region.imageOffset = vk::Offset3D{0, 0, 0};
   region.imageExtent = vk::Extent3D{width, height, 1};
   
   commandBuffer.copyBufferToImage(buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
-  
-  BulkinBuffer::endSingleTimeCommands(commandBuffer, device, graphicsQueue, commandPool);
 }
 
-void BulkinTexture::createTextureSampler(vk::Device& device, vk::PhysicalDevice& physicalDevice) {
-  vk::SamplerCreateInfo samplerInfo{};
-  samplerInfo.magFilter = vk::Filter::eLinear;
-  samplerInfo.minFilter = vk::Filter::eLinear;
-  samplerInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
-  samplerInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
-  samplerInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
-  samplerInfo.anisotropyEnable = vk::True;
-  vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
-  samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-  samplerInfo.borderColor = vk::BorderColor::eIntOpaqueBlack;
-  samplerInfo.unnormalizedCoordinates = vk::False;
-  samplerInfo.compareEnable = vk::False;
-  samplerInfo.compareOp = vk::CompareOp::eAlways;
-  samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
-  samplerInfo.mipLodBias = 0.0f;
-  samplerInfo.minLod = 0.0f;
-  samplerInfo.maxLod = vk::LodClampNone;
-  sampler = device.createSampler(samplerInfo);
-}
-
-void BulkinTexture::cleanup(vk::Device &device) {
+void BulkinTexture::cleanup(vk::Device &device, BulkinAllocator &allocator) {
+  if (pixels)
+    stbi_image_free(pixels);
+  if (inArray)
+    return;
   device.destroy(image);
-  device.free(imageMemory);
+  allocator.free(imageMemory);
   device.destroy(imageView);
-  device.destroy(sampler);
 }
 
-void BulkinTexture::generateMipmaps(vk::Image image, vk::Format imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels, vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::CommandPool& commandPool, vk::Queue& graphicsQueue) {
+void BulkinTexture::generateMipmaps(vk::CommandBuffer commandBuffer, vk::Image image, vk::Format imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels, vk::PhysicalDevice& physicalDevice) {
   vk::FormatProperties formatProperties = physicalDevice.getFormatProperties(imageFormat);
   
   if (!(formatProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear))
     throw std::runtime_error("texture image format does not support linear blitting");
   
-  auto commandBuffer = BulkinBuffer::beginSingleTimeCommands(device, commandPool);
-  
   vk::ImageMemoryBarrier barrier{};
   barrier.image = image;
   barrier.srcQueueFamilyIndex = vk::QueueFamilyIgnored;
   barrier.dstQueueFamilyIndex = vk::QueueFamilyIgnored;
   barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
-  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.baseArrayLayer = layer;
   barrier.subresourceRange.layerCount = 1;
   barrier.subresourceRange.levelCount = 1;
   
@@ -123,13 +211,13 @@ void BulkinTexture::generateMipmaps(vk::Image image, vk::Format imageFormat, int
     blit.srcOffsets[1] = vk::Offset3D(mipWidth, mipHeight, 1);
     blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
     blit.srcSubresource.mipLevel = i - 1;
-    blit.srcSubresource.baseArrayLayer = 0;
+    blit.srcSubresource.baseArrayLayer = layer;
     blit.srcSubresource.layerCount = 1;
     blit.dstOffsets[0] = vk::Offset3D(0, 0, 0);
     blit.dstOffsets[1] = vk::Offset3D(mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1);
     blit.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
     blit.dstSubresource.mipLevel = i;
-    blit.dstSubresource.baseArrayLayer = 0;
+    blit.dstSubresource.baseArrayLayer = layer;
     blit.dstSubresource.layerCount = 1;
     
     commandBuffer.blitImage(image, vk::ImageLayout::eTransferSrcOptimal, image, vk::ImageLayout::eTransferDstOptimal, 1, &blit, vk::Filter::eLinear);
@@ -152,6 +240,4 @@ void BulkinTexture::generateMipmaps(vk::Image image, vk::Format imageFormat, int
   barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
   
   commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, nullptr, {}, nullptr, 1, &barrier);
-  
-  BulkinBuffer::endSingleTimeCommands(commandBuffer, device, graphicsQueue, commandPool);
 }
@@ -0,0 +1,119 @@
+#include "uploader.h"
+#include "buffer.h"
+
+#include <cstring>
+
+void BulkinUploader::create(vk::Device &device, BulkinAllocator &allocator,
+                            vk::CommandPool commandPool, vk::Queue queue,
+                            vk::DeviceSize ringSize) {
+  this->device = device;
+  this->allocator = &allocator;
+  this->queue = queue;
+  this->ringSize = ringSize;
+
+  BulkinBuffer::createBuffer(device, allocator, ringSize,
+                             vk::BufferUsageFlagBits::eTransferSrc,
+                             vk::MemoryPropertyFlagBits::eHostVisible |
+                                 vk::MemoryPropertyFlagBits::eHostCoherent,
+                             ring, ringMemory, AllocationCategory::Staging);
+  ringMapped = static_cast<char *>(ringMemory.mapped);
+
+  vk::CommandBufferAllocateInfo allocInfo{};
+  allocInfo.level = vk::CommandBufferLevel::ePrimary;
+  allocInfo.commandPool = commandPool;
+  allocInfo.commandBufferCount = 1;
+  batch = device.allocateCommandBuffers(allocInfo).front();
+
+  fence = device.createFence(vk::FenceCreateInfo());
+}
+
+vk::CommandBuffer BulkinUploader::commandBuffer() {
+  if (!recording) {
+    vk::CommandBufferBeginInfo beginInfo{};
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    batch.begin(beginInfo);
+    recording = true;
+  }
+  return batch;
+}
+
+vk::Buffer BulkinUploader::stagingBuffer(vk::DeviceSize offset) {
+  if (offset < ringSize)
+    return ring;
+  return overflows[static_cast<size_t>(offset - ringSize)].buffer;
+}
+
+vk::DeviceSize BulkinUploader::stagingBufferOffset(vk::DeviceSize offset) {
+  return offset < ringSize ? offset : 0;
+}
+
+vk::DeviceSize BulkinUploader::stage(const void *contents, vk::DeviceSize size,
+                                     vk::DeviceSize alignment) {
+  if (size > ringSize) {
+    Overflow overflow;
+    BulkinBuffer::createBuffer(device, *allocator, size,
+                               vk::BufferUsageFlagBits::eTransferSrc,
+                               vk::MemoryPropertyFlagBits::eHostVisible |
+                                   vk::MemoryPropertyFlagBits::eHostCoherent,
+                               overflow.buffer, overflow.memory,
+                               AllocationCategory::Staging);
+    memcpy(overflow.memory.mapped, contents, size);
+    overflows.push_back(overflow);
+    return ringSize + overflows.size() - 1;
+  }
+
+  // the ring is only ever rewound once the batch reading from it has
+  // finished, so a full ring means submitting what is queued so far
+  auto offset = (ringHead + alignment - 1) / alignment * alignment;
+  if (offset + size > ringSize) {
+    flush();
+    offset = 0;
+  }
+
+  memcpy(ringMapped + offset, contents, size);
+  ringHead = offset + size;
+  return offset;
+}
+
+void BulkinUploader::uploadBuffer(const void *contents, vk::DeviceSize size,
+                                  vk::Buffer dst, vk::DeviceSize dstOffset) {
+  auto offset = stage(contents, size);
+
+  vk::BufferCopy region{};
+  region.srcOffset = stagingBufferOffset(offset);
+  region.dstOffset = dstOffset;
+  region.size = size;
+  commandBuffer().copyBuffer(stagingBuffer(offset), dst, region);
+}
+
+void BulkinUploader::flush() {
+  if (recording) {
+    batch.end();
+    recording = false;
+
+    vk::SubmitInfo submitInfo{};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch;
+    queue.submit(submitInfo, fence);
+
+    if (device.waitForFences(fence, vk::True, UINT64_MAX) !=
+        vk::Result::eSuccess)
+      throw std::runtime_error("failed to wait for upload batch");
+    device.resetFences(fence);
+    batch.reset();
+  }
+
+  for (auto &overflow : overflows) {
+    device.destroy(overflow.buffer);
+    allocator->free(overflow.memory);
+  }
+  overflows.clear();
+  ringHead = 0;
+}
+
+void BulkinUploader::cleanup() {
+  flush();
+  device.destroy(fence);
+  device.destroy(ring);
+  allocator->free(ringMemory);
+}